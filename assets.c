@@ -0,0 +1,212 @@
+/* fingerprinted assets: each file at the top of the public directory,
+ * and the favicon, copied into the destination as <stem>.<hash>.<ext>.
+ * pages link those names, so an asset's url changes with its content,
+ * and the headers file (see manifest.c) can mark it immutable.
+ * copies of older versions are left in place, for pages still cached.
+ */
+#include "config.h"
+
+#if FINGERPRINT_ASSETS
+
+#include "assets.h"
+#include "based.h"
+#include "output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* most files fingerprinted. only the top of the public directory is,
+ * not pix/, which recipes link their pictures from by name */
+#define MAX_ASSETS 64
+/* the favicon's data uri, which is turned into FAVICON_FILE */
+#define SVG_URI "data:image/svg+xml,"
+
+struct asset {
+	char name[PATH_LEN];      /* as in the public directory */
+	char url[PATH_LEN + 16];  /* name with the content hash */
+};
+
+static struct asset assets[MAX_ASSETS];
+static size_t nassets = 0;
+
+/* Assets record format, one line per asset, the public directory's
+ * in name order, then the favicon:
+ *	<name> <url>\n
+ */
+static const char FMT_ASSET_LINE[] = "%s %s\n";
+
+/* adds `name`, of `size` bytes of `data`, to the assets, and makes sure
+ * its fingerprinted copy exists in `dst` (or is streamed). */
+static void
+fingerprint(const char *name, const char *data, size_t size, char *dst)
+{
+	struct asset *a;
+	const char *ext;
+	char out[PATH_LEN * 3], *old;
+	size_t oldsize;
+	uint64_t hash;
+	FILE *f;
+	int stem;
+
+	if (MAX_ASSETS == nassets) die("more than %d assets to fingerprint.", MAX_ASSETS);
+	if (strlen(name) >= PATH_LEN) die("asset name too long: %s", name);
+	a = &assets[nassets++];
+	strcpy(a->name, name);
+	hash = hash_bytes(data, size, HASH_SEED);
+	ext = strrchr(name, '.');
+	if (NULL == ext) ext = name + strlen(name);
+	stem = ext - name;
+	snprintf(a->url, sizeof(a->url), "%.*s.%08lx%s",
+		stem, name, (unsigned long)(hash & 0xffffffff), ext);
+
+	/* copies are small, one that exists is checked rather than trusted,
+	 * they're served as immutable */
+	sprintf(out, "%s/%s", dst, a->url);
+	if (!streaming) {
+		old = read_file(out, &oldsize);
+		if ((NULL == old || oldsize != size || 0 != memcmp(old, data, size))
+		 && !write_atomic(out, data, size))
+			die("failed to write %s.", out);
+		free(old);
+		return;
+	}
+	f = output_open(out);
+	if (NULL == f || size != fwrite(data, 1, size, f))
+		die("failed to stream %s.", out);
+	output_close(f);
+}
+
+/* the favicon's svg, out of its data uri's %xx escapes */
+static char *
+favicon_svg(size_t *size)
+{
+	const char *p = FAVICON + strlen(SVG_URI);
+	char *svg, *q;
+	unsigned c;
+
+	svg = q = malloc(sizeof(FAVICON));
+	if (NULL == svg) die("could not allocate the favicon.");
+	for (; '\0' != *p; ++p) {
+		if ('%' == p[0] && 1 == sscanf(p + 1, "%2x", &c)) {
+			*q++ = c;
+			p += 2;
+		} else {
+			*q++ = *p;
+		}
+	}
+	*size = q - svg;
+	return svg;
+}
+
+/* fingerprints every file at the top of `pubdir` into `dst`, and the
+ * favicon if it's an svg. returns how many assets there are. */
+size_t
+fingerprint_assets(char *pubdir, char *dst)
+{
+	struct dirent **files;
+	struct stat st;
+	char path[PATH_LEN * 2], *data;
+	size_t size;
+	int n, i;
+
+	nassets = 0;
+	n = scandir(pubdir, &files, NULL, alphasort);
+	for (i = 0; i < n; ++i) {
+		snprintf(path, sizeof(path), "%s/%s", pubdir, files[i]->d_name);
+		if (files[i]->d_name[0] != '.'
+		 && 0 == stat(path, &st) && S_ISREG(st.st_mode)) {
+			data = read_file(path, &size);
+			if (NULL == data) die("could not read %s.", path);
+			fingerprint(files[i]->d_name, data, size, dst);
+			free(data);
+		}
+		free(files[i]);
+	}
+	if (n >= 0) free(files);
+	if (0 == strncmp(FAVICON, SVG_URI, strlen(SVG_URI))) {
+		data = favicon_svg(&size);
+		fingerprint(FAVICON_FILE, data, size, dst);
+		free(data);
+	}
+	return nassets;
+}
+
+/* the fingerprinted name of asset `name`, or `name` itself if
+ * there's no such asset. */
+const char *
+asset_url(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < nassets; ++i)
+		if (0 == strcmp(assets[i].name, name))
+			return assets[i].url;
+	return name;
+}
+
+const char *
+favicon_url(void)
+{
+	const char *url = asset_url(FAVICON_FILE);
+	return url == FAVICON_FILE ? FAVICON : url;
+}
+
+/* the assets' record, in `buf` (freed by the caller) */
+static size_t
+listing(char **buf)
+{
+	FILE *f;
+	size_t size, i;
+
+	f = open_memstream(buf, &size);
+	if (NULL == f) die("could not allocate the assets record.");
+	for (i = 0; i < nassets; ++i)
+		fprintf(f, FMT_ASSET_LINE, assets[i].name, assets[i].url);
+	fclose(f);
+	return size;
+}
+
+/* covers every url pages link to */
+uint64_t
+assets_key(void)
+{
+	char *buf;
+	size_t size = listing(&buf);
+	uint64_t key = hash_bytes(buf, size, HASH_SEED);
+
+	free(buf);
+	return key;
+}
+
+/* whether pages were written with other assets than these, as saved
+ * to `record` by assets_record(), or it's missing. */
+bool
+assets_changed(char *record)
+{
+	char *buf, *old;
+	size_t size = listing(&buf), oldsize;
+	bool changed;
+
+	old = read_file(record, &oldsize);
+	changed = NULL == old || oldsize != size || 0 != memcmp(old, buf, size);
+	free(old);
+	free(buf);
+	return changed;
+}
+
+void
+assets_record(char *record)
+{
+	char *buf;
+	size_t size = listing(&buf);
+
+	if (!write_atomic(record, buf, size))
+		fprintf(stderr, "warning: can't write %s.\n", record);
+	free(buf);
+}
+
+#endif
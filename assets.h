@@ -0,0 +1,22 @@
+/* static assets named after their content, cached for good */
+#ifndef _ASSETS_H
+#define _ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+#if FINGERPRINT_ASSETS
+size_t fingerprint_assets(char *, char *);
+const char *asset_url(const char *);
+const char *favicon_url(void);
+uint64_t assets_key(void);
+bool assets_changed(char *);
+void assets_record(char *);
+#else
+#define asset_url(name) (name)
+#define favicon_url()   (FAVICON)
+#endif
+
+#endif
@@ -15,38 +15,86 @@
 #include <assert.h>
 /* looping through directories */
 #include <dirent.h>
+/* reading sources ahead */
+#include "scan.h"
 /* parsing markdown + tags */
 #include "md.h"
 /* writing rss + atom files */
 #include "rss.h"
+/* responsive images */
+#if IMAGE_PIPELINE
+#include "pix.h"
+#endif
+/* deploy manifest */
+#include "manifest.h"
+/* writing files, or streaming a tar archive */
+#include "output.h"
+/* build profiling */
+#include "prof.h"
+/* checking sources */
+#include "lint.h"
+/* sharded builds */
+#include "shard.h"
+/* related recipes */
+#if RELATED_RECIPES
+#include "related.h"
+#endif
+/* fuzzy search */
+#if SEARCH_INDEX
+#include "search.h"
+#endif
+#if SITEMAP
+#include "sitemap.h"
+#endif
+/* fingerprinted style sheets */
+#include "assets.h"
+/* recipe catalog */
+#include "catalog.h"
+/* recipes by date */
+#include "dates.h"
 /* caching */
 #if GIT_INTEGRATION
 #include "cache.h"
+#include "store.h"
 #endif
 
 #include "based.h"
 
 void usage(char *prog)
 {
-	fprintf(stderr, "usage: %s [-hqC] [-s <src-dir>] [-d <dest-dir>] [-c <cache-file>]\n", prog);
+	fprintf(stderr, "usage: %s [-hqlaMXJC] [-s <src-dir>] [-d <dest-dir>] [-p <public-dir>] [-c <cache-file>]\n"
+	                "       [-m <manifest>] [-D <deployed-manifest>] [-P <trace-file>] [-A <store-dir>]\n"
+	                "       [-S <k>/<n>] [-Q <query>]\n", prog);
 	fprintf(stderr, "  -h	print help (this usage message).\n");
 	fprintf(stderr, "  -s	(default: %s) specify source (markdown) directory.\n", ARTICLES_MARKDOWN);
-	fprintf(stderr, "  -d	(default: %s) specify destination (html) directory.\n", ARTICLES_HTML);
+	fprintf(stderr, "  -d	(default: %s) specify destination (html) directory,\n"
+	                "	or - to stream a tar archive to stdout.\n", ARTICLES_HTML);
+	fprintf(stderr, "  -p	(default: %s) specify public (static assets) directory.\n", PUBLIC_DIR);
 	fprintf(stderr, "  -c	(default: %s) specify cache file.\n", CACHE_FILE);
+	fprintf(stderr, "  -m	(default: %s) specify deploy manifest file.\n", MANIFEST_FILE);
+	fprintf(stderr, "  -D	don't build, list files changed since the given (deployed) manifest.\n");
+	fprintf(stderr, "  -A	share rendered recipes with other builds through a store directory.\n");
+	fprintf(stderr, "  -P	profile build phases, writing a json (chrome) trace to the given file.\n");
+	fprintf(stderr, "  -S	build shard k of n: only its recipes, and a partial for -J.\n"
+	                "	each shard keeps its own cache file (<cache-file>.<k>-of-<n>).\n");
+	fprintf(stderr, "  -J	don't build, merge the partials of every shard in <dest-dir>\n"
+	                "	into the index, paginator, tag pages and feeds.\n");
 	fprintf(stderr, "  -q	be quiet (no logging to stdout or stderr).\n");
+	fprintf(stderr, "  -a	with -d -, stream the public directory before the html.\n");
+	fprintf(stderr, "  -M	minify html, collapsing whitespace outside <pre> &c.\n");
+	fprintf(stderr, "  -l	don't build, lint recipes and pictures (in <public-dir>/pix).\n");
+	fprintf(stderr, "  -Q	don't build, search the recipes indexed in <dest-dir>, and time it.\n");
+	fprintf(stderr, "  -X	don't build, compare the built-in markdown engine with discount.\n");
 	fprintf(stderr, "  -C	clean build (ignore cache file).\n");
 }
 
-#define BOLD 1
-#define RESET 0
-
 /* look-up table of 256 ansi escape code.
  * each section is 7 bytes: (\x1B + [ + digit1 + digit2 + digit3 + m + NUL).
  * shorter codes are left-aligned, right-padded with NULs.
  * each code is intercalted by NUL bytes.
  * needless to say, this is not thread-safe, nothing in this program is. */
 static char _escbuf[256 * 7] = { '\0' };
-static char *
+char *
 ansi(int code)
 {
 	char *dest;
@@ -58,6 +106,18 @@ ansi(int code)
 }
 
 static int verbosity = 1;
+/* static assets (style sheets, pictures) deployed alongside the html */
+static char *pubdir = (char *)PUBLIC_DIR;
+/* hashes of every deployed file, written after each build */
+static char *manifestfile = (char *)MANIFEST_FILE;
+/* content-addressed artifacts shared between builds, or NULL */
+static char *storedir = NULL;
+#if GIT_INTEGRATION
+/* pages were written with other assets, they're all rewritten */
+static bool restyled = false;
+#endif
+/* this build's shard (from 1) of `shards`, 0 of 0 if not sharded */
+static unsigned shard = 0, shards = 0;
 static int
 logprint(char *fmt, ...)
 {
@@ -150,111 +210,172 @@ struct letter_on_page {
 	unsigned page;
 };
 
-/* pages for paginator */
-static int
-write_pages(char *dst, struct recipelist *recipe)
+/* recipes of one paginator in title order, with the page
+ * each change of their first letter falls on */
+struct pageindex {
+	struct recipelist **recipes;
+	unsigned count, pages;
+	struct letter_on_page *letters;
+	unsigned lettercount;
+};
+
+/* alphord() of every recipe, indexed like `recipemem`, as it's
+ * needed again for every paginator the recipe is in */
+static char recipeletters[MAX_RECIPES] = { 0 };
+
+static char
+recipe_letter(struct recipelist *recipe)
 {
-	FILE *pagef;
-	char pagefile[PATH_LEN];
-	struct recipelist *first, *last;  /* recipe before current recipe */
-	unsigned page, pages, count, lettercount;
-	bool open = false;
-	struct letter_on_page *letterpages, *letterpage;
+	char *letter = &recipeletters[recipe - recipemem];
 
-	first = last = recipe;
-	pages = atleast(recipecount, RECIPES_PER_PAGE);
+	if (*letter == '\0') *letter = alphord(recipe->title);
+	return *letter;
+}
 
-	/* initial indexing of recipes according to alphabet */
-	lettercount = 0;
-	letterpages = calloc(30, sizeof(struct letter_on_page));
-	letterpages[lettercount++] =
-		(struct letter_on_page){ alphord(recipe->title), 1 };
-	for (page = 1; page <= pages; ++page) {
-		for (count = 0; count < RECIPES_PER_PAGE && recipe != NULL;
-				last = recipe, recipe = recipe->next, ++count) {
-			if (alphord(last->title) == alphord(recipe->title))
-				continue;
-			letterpages[lettercount++] =
-				(struct letter_on_page){ alphord(recipe->title), page };
-		}
+/* initial indexing of recipes according to alphabet */
+static void
+index_pages(struct pageindex *ix)
+{
+	unsigned i;
+
+	ix->pages = atleast(ix->count, RECIPES_PER_PAGE);
+	ix->lettercount = 0;
+	/* one entry per change of letter, which without a collating locale
+	 * can be more than there are letters in the alphabet */
+	ix->letters = calloc(ix->count + 1, sizeof(struct letter_on_page));
+	if (NULL == ix->letters) die("could not allocate paginator.");
+	for (i = 0; i < ix->count; ++i) {
+		if (i > 0 && recipe_letter(ix->recipes[i - 1]) == recipe_letter(ix->recipes[i]))
+			continue;
+		ix->letters[ix->lettercount++] = (struct letter_on_page){
+			recipe_letter(ix->recipes[i]), i / RECIPES_PER_PAGE + 1 };
 	}
+}
 
-	last = recipe = first;
-	for (page = 1; page <= pages; ++page) {
-		sprintf(pagefile, "%s/"FMT_PAGE_FILE, dst, page);
-		pagef = fopen(pagefile, "w");
-		if (NULL == pagef) die("failed to open page %u for writing.", page);
-		/* each page needs full valid HTML */
-		fprintf(pagef, FMT_HTML_HEAD, PAGE_TITLE, DESCRIPTION, FAVICON);
-		fprintf(pagef, FMT_HTML_PAGINATE_HEAD);
-		fprintf(pagef, "</head>\n<body>\n");
+/* page links and buttons of one of `pages` pages, named by `prefix`
+ * (see FMT_PAGE_FILE) */
+static void
+write_page_nav(FILE *pagef, char *prefix, unsigned page, unsigned pages)
+{
+	unsigned count;
+
+	fprintf(pagef, "<nav>\n");
+	/* write page links */
+	fprintf(pagef, FMT_HTML_PAGINATE_PAGE_LINKS_START);
+	for (count = 1; count <= pages; ++count)
+		if (count != page)
+			fprintf(pagef, FMT_HTML_PAGINATE_PAGE_LINK, prefix, count, count);
+	fprintf(pagef, FMT_HTML_PAGINATE_PAGE_LINKS_END);
+	/* write appropriate paginator buttons */
+	fprintf(pagef, FMT_HTML_PAGINATE_BUTTONS_START);
+	if (page != 1) {  /* no back button on first page */
+		fprintf(pagef, FMT_HTML_PAGINATE_FIRST_BUTTON, prefix, 1);
+		fprintf(pagef, FMT_HTML_PAGINATE_BACK_BUTTON, prefix, page - 1);
+	}
+	fprintf(pagef, FMT_HTML_PAGINATE_CURRENT_PAGE, prefix, page, page);
+	if (page != pages) { /* no next button on last page */
+		fprintf(pagef, FMT_HTML_PAGINATE_NEXT_BUTTON, prefix, page + 1);
+		fprintf(pagef, FMT_HTML_PAGINATE_LAST_BUTTON, prefix, pages);
+	}
+	fprintf(pagef, FMT_HTML_PAGINATE_BUTTONS_END);
+	fprintf(pagef, "</nav>\n");
+}
 
-		/* write paginator alphabet bar */
-		fprintf(pagef, FMT_HTML_PAGINATE_BAR_START);
-		if (page != 1)
-			fprintf(pagef, "<span>");
-		for (count = 0, letterpage = letterpages;
-			 count < lettercount;
-			 ++count, ++letterpage) {
-			/* grey-out 'active' letters for page */
-			if (letterpage->page == page && !open) {
-				open = true;
-				if (page != 1)
-					fprintf(pagef, "</span>");
-				fprintf(pagef, "<span id=\"active\">");
-			}
-			if (letterpage->page != page && open) {
-				open = false;
+/* alphabet bar, recipe list and navigation of one paginator page,
+ * linking to the pages named by `prefix` (see FMT_PAGE_FILE). */
+static void
+write_page_body(FILE *pagef, char *prefix, unsigned page, struct pageindex *ix)
+{
+	struct recipelist *recipe, *last;
+	struct letter_on_page *letterpage;
+	unsigned count, i;
+	bool open = false;
+
+	/* write paginator alphabet bar */
+	fprintf(pagef, FMT_HTML_PAGINATE_BAR_START);
+	if (page != 1)
+		fprintf(pagef, "<span>");
+	for (count = 0, letterpage = ix->letters;
+		 count < ix->lettercount;
+		 ++count, ++letterpage) {
+		/* grey-out 'active' letters for page */
+		if (letterpage->page == page && !open) {
+			open = true;
+			if (page != 1)
 				fprintf(pagef, "</span>");
-				fprintf(pagef, "<span>");
-			}
-			fprintf(pagef, FMT_HTML_PAGINATE_BAR_LINK,
-			        letterpage->page, letterpage->letter);
+			fprintf(pagef, "<span id=\"active\">");
 		}
-		fprintf(pagef, "</span>");
-		fprintf(pagef, FMT_HTML_PAGINATE_BAR_END);
-
-		/* write recipe list entries with alphabet headers */
-		fprintf(pagef, FMT_HTML_PAGINATE_LIST_START);
-		fprintf(pagef, FMT_HTML_PAGINATE_HEADER, alphord(recipe->title));
-		for (count = 0; count < RECIPES_PER_PAGE && recipe != NULL;
-				last = recipe, recipe = recipe->next, ++count) {
-			/* if first character of recipe title advanced in the alphabet,
-			 * then print a new alphabetical heading */
-			if (alphord(recipe->title) != alphord(last->title)) {
-				fprintf(pagef, FMT_HTML_PAGINATE_HEADER, alphord(recipe->title));
-			}
-			fprintf(pagef, FMT_HTML_INDEX_LIST_ENTRY, recipe->url, recipe->title);
+		if (letterpage->page != page && open) {
+			open = false;
+			fprintf(pagef, "</span>");
+			fprintf(pagef, "<span>");
 		}
-
-		fprintf(pagef, FMT_HTML_PAGINATE_LIST_END);
-		/* write page navigation controls */
-		fprintf(pagef, "<nav>\n");
-		/* write page links */
-		fprintf(pagef, FMT_HTML_PAGINATE_PAGE_LINKS_START);
-		for (count = 1; count <= pages; ++count)
-			if (count != page)
-				fprintf(pagef, FMT_HTML_PAGINATE_PAGE_LINK, count, count);
-		fprintf(pagef, FMT_HTML_PAGINATE_PAGE_LINKS_END);
-		/* write appropriate paginator buttons */
-		fprintf(pagef, FMT_HTML_PAGINATE_BUTTONS_START);
-		if (page != 1) {  /* no back button on first page */
-			fprintf(pagef, FMT_HTML_PAGINATE_FIRST_BUTTON, 1);
-			fprintf(pagef, FMT_HTML_PAGINATE_BACK_BUTTON, page - 1);
+		fprintf(pagef, FMT_HTML_PAGINATE_BAR_LINK,
+		        prefix, letterpage->page, letterpage->letter);
+	}
+	fprintf(pagef, "</span>");
+	fprintf(pagef, FMT_HTML_PAGINATE_BAR_END);
+
+	/* write recipe list entries with alphabet headers */
+	i = (page - 1) * RECIPES_PER_PAGE;
+	last = ix->recipes[i];  /* recipe before current recipe */
+	fprintf(pagef, FMT_HTML_PAGINATE_LIST_START);
+	fprintf(pagef, FMT_HTML_PAGINATE_HEADER, recipe_letter(last));
+	for (count = 0; count < RECIPES_PER_PAGE && i < ix->count;
+			last = recipe, ++i, ++count) {
+		recipe = ix->recipes[i];
+		/* if first character of recipe title advanced in the alphabet,
+		 * then print a new alphabetical heading */
+		if (recipe_letter(recipe) != recipe_letter(last)) {
+			fprintf(pagef, FMT_HTML_PAGINATE_HEADER, recipe_letter(recipe));
 		}
-		fprintf(pagef, FMT_HTML_PAGINATE_CURRENT_PAGE, page, page);
-		if (page != pages) { /* no next button on last page */
-			fprintf(pagef, FMT_HTML_PAGINATE_NEXT_BUTTON, page + 1);
-			fprintf(pagef, FMT_HTML_PAGINATE_LAST_BUTTON, pages);
+		fprintf(pagef, FMT_HTML_INDEX_LIST_ENTRY, recipe->url, recipe->title);
+	}
+
+	fprintf(pagef, FMT_HTML_PAGINATE_LIST_END);
+	/* write page navigation controls */
+	write_page_nav(pagef, prefix, page, ix->pages);
+}
+
+/* pages for paginator.
+ * when `index` is given, the first page is also written into it. */
+static int
+write_pages(char *dst, struct recipelist *recipe, FILE *index)
+{
+	FILE *pagef;
+	char pagefile[PATH_LEN];
+	struct pageindex ix = { 0 };
+	unsigned page;
+
+	ix.recipes = calloc(recipecount + 1, sizeof(*ix.recipes));
+	if (NULL == ix.recipes) die("could not allocate paginator.");
+	for (; recipe != NULL; recipe = recipe->next)
+		ix.recipes[ix.count++] = recipe;
+	index_pages(&ix);
+
+	for (page = 1; page <= ix.pages; ++page) {
+		sprintf(pagefile, "%s/"FMT_PAGE_FILE, dst, "", page);
+		pagef = output_open(pagefile);
+		if (NULL == pagef) die("failed to open page %u for writing.", page);
+		/* each page needs full valid HTML */
+		fprintf(pagef, FMT_HTML_HEAD, PAGE_TITLE, DESCRIPTION,
+			favicon_url(), asset_url(STYLE_SHEET));
+		fprintf(pagef, FMT_HTML_PAGINATE_HEAD, asset_url(PAGE_STYLE_SHEET));
+		fprintf(pagef, "</head>\n<body>\n");
+		if (NULL != index) {
+			/* pages are visited directly, not in the index's iframe */
+			fprintf(pagef, FMT_HTML_BANNER, PAGE_TITLE);
+			if (page == 1)
+				write_page_body(index, "", page, &ix);
 		}
-		fprintf(pagef, FMT_HTML_PAGINATE_BUTTONS_END);
-		fprintf(pagef, "</nav>\n");
+		write_page_body(pagef, "", page, &ix);
 		/* page finished */
 		fprintf(pagef, "</body>\n</html>\n");
-		fclose(pagef);
+		prof_bytes(PHASE_PAGES, output_close(pagef));
 	}
 
-	free(letterpages);
+	free(ix.letters);
+	free(ix.recipes);
 	return EXIT_SUCCESS;
 }
 
@@ -267,22 +388,32 @@ write_index(char *dst, struct taglist *tag, struct recipelist *recipe)
 	char indexfile[PATH_LEN];
 	sprintf(indexfile, "%s/index.html", dst);
 
-	/* first write paginator pages */
-	res = write_pages(dst, recipe);
-	if (res != EXIT_SUCCESS) return res;
-
-	f = fopen(indexfile, "w");
-	fprintf(f, FMT_HTML_HEAD, PAGE_TITLE, DESCRIPTION, FAVICON);
+	f = output_open(indexfile);
+	if (NULL == f) die("failed to open %s for writing.", indexfile);
+	fprintf(f, FMT_HTML_HEAD, PAGE_TITLE, DESCRIPTION,
+		favicon_url(), asset_url(STYLE_SHEET));
 	fprintf(f, "</head>\n<body>\n");
 	fprintf(f, FMT_HTML_BANNER, PAGE_TITLE);
+#if DATE_PAGES
+	fprintf(f, HTML_INDEX_DATES);
+#endif
 	fprintf(f, FMT_HTML_INDEX_HEADER, DESCRIPTION);
 	/* loop through tags */
 	for (; tag != NULL; tag = tag->next) {
 		fprintf(f, FMT_HTML_TAG_ENTRY, tag->name, tag->name);
 		if (tag->next != NULL) fprintf(f, FMT_HTML_TAG_SEP);
 	}
+#if INLINE_FIRST_PAGE
+	/* first paginator page, in the index itself */
+	fprintf(f, FMT_HTML_INDEX_PAGES_START);
+	res = write_pages(dst, recipe, f);
+	fprintf(f, FMT_HTML_INDEX_PAGES_END);
+#else
 	/* embed iframe to paginator */
-	fprintf(f, FMT_HTML_INDEX_PAGINATOR, 1);
+	res = write_pages(dst, recipe, NULL);
+	fprintf(f, FMT_HTML_INDEX_PAGINATOR, "", 1);
+#endif
+	if (res != EXIT_SUCCESS) return res;
 	/* parse and insert index.md file */
 	mdf = fopen(INDEX_MARKDOWN, "r");
 	mmio = mkd_in(mdf, mkd_flags);
@@ -292,7 +423,7 @@ write_index(char *dst, struct taglist *tag, struct recipelist *recipe)
 	/* end index document */
 	fprintf(f, FMT_HTML_FOOTER);
 	fprintf(f, "</body>\n</html>\n");
-	fclose(f);
+	prof_bytes(PHASE_PAGES, output_close(f));
 
 	return EXIT_SUCCESS;
 }
@@ -301,8 +432,9 @@ write_index(char *dst, struct taglist *tag, struct recipelist *recipe)
 /* recipes display author information as well as upload + edit times.
  * this is achieved by checking the git commit history for the file.
  */
-static char date_format[50] = "--date=rfc";
-static char date_formatter[] = "--pretty=format:%ad";
+/* dates as "<epoch> <+hhmm>", see parse_gitdate() */
+static char date_format[] = "--date=format:%z";
+static char date_formatter[] = "--pretty=format:%at %ad";
 static char name_formatter[] = "--pretty=format:%an";
 static char *git_env[] = { "GIT_PAGER=cat", "PAGER=cat", (char *)0 };
 static char *git_log_added[] = {
@@ -316,44 +448,181 @@ static char *git_log_modified[] = {
 	(char *)0
 };
 
-static void
-git_command(char *output, ssize_t size, char *src, char *formatter, char *arguments[])
+static char *git_rev_list[] = {
+	"--no-pager", "rev-list", "--first-parent", "-n", "64", "HEAD",
+	(char *)0
+};
+static char *git_rev_parse[] = {
+	"--no-pager", "rev-parse", "--verify", "-q", "HEAD",
+	(char *)0
+};
+static char *git_is_ancestor[] = {
+	"--no-pager", "merge-base", "--is-ancestor", /*[3]*/ NULL, "HEAD",
+	(char *)0
+};
+/* oldest first, so later commits overwrite earlier ones */
+static char range_formatter[] = "--pretty=format:%x01%at %ad%x01%an";
+static char *git_log_range[] = {
+	"--no-pager", "log", "--reverse", "--no-renames", "--name-status",
+	/*[5]*/ NULL, /*[6]*/ NULL, /*[7]*/ NULL, "--", /*[9]*/ NULL,
+	(char *)0
+};
+
+/* runs git, returning its standard output as a stream.
+ * git_close() reaps the process, returning its exit status.
+ */
+static FILE *
+git_open(char *arguments[], pid_t *pid)
 {
-	pid_t pid;
 	int link[2];
-	ssize_t eaten;
-
-	arguments[5] = date_format;
-	arguments[6] = formatter;
-	arguments[8] = src;
 
 	if (0 != pipe(link)) die("pipe failed");
-	pid = fork();
-	if (pid == 0) {
+	*pid = fork();
+	if (*pid == 0) {
 		dup2(link[1], fileno(stdout));
 		close(link[0]); close(link[1]);
 		execve(GIT_PATH, arguments, git_env);
 		fprintf(stderr, "error: git command failed\n");
 		exit(1);
-	} else if (pid > 0) {
-		close(link[1]);
-		/* read output until fully consumed. */
-		eaten = -1;
-		while (eaten != 0) {
-			eaten = read(link[0], output, size);
-			if (-1 == eaten) {
-				if (EINTR == errno) continue;
-				die("read failed: %s", strerror(errno));
-			}
-			output += eaten;
-			size -= eaten;
-		}
-		close(link[0]);
-		wait(NULL);
-	} else {
+	} else if (*pid < 0) {
 		fprintf(stderr, "error: fork() failed\n");
 		exit(1);
 	}
+	close(link[1]);
+	return fdopen(link[0], "r");
+}
+
+static int
+git_close(FILE *out, pid_t pid)
+{
+	int status;
+
+	fclose(out);
+	if (-1 == waitpid(pid, &status, 0)) return -1;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void
+git_command(char *output, ssize_t size, char *src, char *formatter, char *arguments[])
+{
+	FILE *out;
+	pid_t pid;
+
+	prof_begin(PHASE_GIT);
+	arguments[5] = date_format;
+	arguments[6] = formatter;
+	arguments[8] = src;
+
+	out = git_open(arguments, &pid);
+	/* read output until fully consumed. */
+	fread(output, 1, size, out);
+	if (ferror(out)) die("read failed: %s", strerror(errno));
+	git_close(out, pid);
+	prof_end(PHASE_GIT);
+}
+
+static void
+git_date(struct gitdate *date, char *src, char *arguments[])
+{
+	char output[GITDATE_LEN] = { 0 };
+
+	git_command(output, sizeof(output) - 1, src, date_formatter, arguments);
+	parse_gitdate(date, output);
+}
+
+/* brings the author & dates of cached recipes up to date with HEAD,
+ * by walking only the commits made since the cache was written.
+ * touched recipes are marked modified so their pages are rewritten.
+ * when the cached commit is no longer in history (a rewrite) the cache
+ * is emptied, and everything is rescanned.
+ * returns true when every cached entry's git metadata is current.
+ */
+static bool
+git_history(struct cache *c, char *src)
+{
+	FILE *out;
+	pid_t pid;
+	char head[COMMIT_LEN] = { 0 };
+	char line[PATH_LEN * 2], author[32];
+	struct gitdate date = { 0 };
+	char *slug, *sep;
+	struct md *entry;
+	unsigned commits = 0, touched = 0;
+
+	prof_begin(PHASE_GIT);
+	out = git_open(git_rev_parse, &pid);
+	if (NULL == fgets(head, sizeof(head), out)) head[0] = '\0';
+	head[strcspn(head, "\n")] = '\0';
+	if (0 != git_close(out, pid)) head[0] = '\0';
+
+	if (head[0] == '\0' || c->head[0] == '\0') {
+		/* not a git repository, or a cache from before heads were kept */
+		strcpy(c->head, head);
+		prof_end(PHASE_GIT);
+		return false;
+	}
+	if (0 == strcmp(head, c->head)) {
+		prof_end(PHASE_GIT);
+		return true;
+	}
+
+	git_is_ancestor[3] = c->head;
+	out = git_open(git_is_ancestor, &pid);
+	if (0 != git_close(out, pid)) {
+		logprint("%shistory rewritten%s: rescanning all recipes\n",
+			ansi(BOLD), ansi(RESET));
+		c->size = 0;
+		strcpy(c->head, head);
+		prof_end(PHASE_GIT);
+		return false;
+	}
+
+	/* <range> is <cached-head>..HEAD */
+	sprintf(line, "%s..%s", c->head, head);
+	git_log_range[5] = date_format;
+	git_log_range[6] = range_formatter;
+	git_log_range[7] = line;
+	git_log_range[9] = src;
+	out = git_open(git_log_range, &pid);
+	author[0] = '\0';
+	while (NULL != fgets(line, sizeof(line), out)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '\x01') {
+			/* commit: \x01<date>\x01<author> */
+			++commits;
+			sep = strchr(line + 1, '\x01');
+			if (NULL == sep) continue;
+			*sep = '\0';
+			parse_gitdate(&date, line + 1);
+			snprintf(author, sizeof(author), "%.31s", sep + 1);
+			continue;
+		}
+		/* file: <status>\t<path>, deletes are left to join_cache() */
+		if ((line[0] != 'A' && line[0] != 'M') || line[1] != '\t')
+			continue;
+		slug = strrchr(line, '/');
+		slug = NULL != slug ? slug + 1 : line + 2;
+		sep = strrchr(slug, '.');
+		if (NULL == sep || 0 != strcmp(sep, ".md")) continue;
+		*sep = '\0';
+		entry = find_cache(c, slug);
+		if (NULL == entry) continue;  /* new, looked up when written */
+		if (line[0] == 'A') {
+			entry->added = date;
+			strcpy(entry->author, author);
+		} else {
+			entry->modified = date;
+		}
+		entry->mtime = 0;  /* forces a rewrite */
+		++touched;
+	}
+	if (0 != git_close(out, pid))
+		die("git log %.12s..%.12s failed.", c->head, head);
+	logprint("%shistory%s: %u commits since %.12s, %u recipes touched\n",
+		ansi(BOLD), ansi(RESET), commits, c->head, touched);
+	strcpy(c->head, head);
+	prof_end(PHASE_GIT);
+	return true;
 }
 #endif
 
@@ -439,7 +708,7 @@ expand_units(char *html)
 	} else if (uses_syntax) {
 		/* write metric and imperial sections to `expanded` */
 		assert(header != NULL && footer != NULL);
-		expanded = calloc(htmlsize * 2, 1);
+		expanded = calloc(htmlsize * 2 + 256, 1);  /* + <details> markup */
 		if (NULL == expanded)
 			die("could not allocate memory for recipe.");
 		i = 0;  /* offset in `expanded` */
@@ -447,15 +716,11 @@ expand_units(char *html)
 		strncpy(expanded + i, html, header - html);
 		i += header - html;
 		/* open metric details submenu and add content */
-		i += sprintf(expanded + i,
-			"<details class=\"units\" id=\"metric\">"
-			"<summary>Metric Units</summary>\n");
+		i += sprintf(expanded + i, "%s", HTML_UNITS_METRIC);
 		i += sprintf(expanded + i, "%s\n", metric);
 		i += sprintf(expanded + i, "</details>\n");
 		/* open imperial details tag and copy content */
-		i += sprintf(expanded + i,
-			"<details class=\"units\" id=\"imperial\" open>"
-			"<summary>US Customary Units</summary>\n");
+		i += sprintf(expanded + i, "%s", HTML_UNITS_IMPERIAL);
 		i += sprintf(expanded + i, "%s\n", imperial);
 		i += sprintf(expanded + i, "</details>\n");
 		/* copy in footer */
@@ -469,25 +734,46 @@ expand_units(char *html)
 }
 
 static int
-write_recipe(FILE *f, char *srcdir, struct md *recipe, bool modified)
+write_recipe(FILE *f, char *srcdir, char *dstdir, struct md *recipe, bool modified)
 {
 	char (*tag)[TAG_NAME_LEN];
 	char title[TITLE_LEN + sizeof(PAGE_TITLE) + 10] = { 0 };
 	char *recipehtml;
+#if IMAGE_PIPELINE
+	char *imagehtml;
+#else
+	(void)dstdir;
+#endif
 #if GIT_INTEGRATION
 	char adate[16] = { 0 };
 	char mdate[16] = { 0 };
 	char src[PATH_LEN];
+	struct tm tm;
 #else
 	(void)srcdir; (void)modified;
 #endif
 
 	sprintf(title, "%s – %s", recipe->title, PAGE_TITLE);
-	fprintf(f, FMT_HTML_HEAD, title, DESCRIPTION, FAVICON);
+	fprintf(f, FMT_HTML_HEAD, title, DESCRIPTION,
+		favicon_url(), asset_url(STYLE_SHEET));
 	fprintf(f, "</head>\n<body>\n");
 	fprintf(f, FMT_HTML_ARTICLE_HEADER);
-	/* expand {metric,imperial} syntax into two sections */
-	recipehtml = expand_units(recipe->html);
+	/* expand {metric,imperial} syntax into two sections,
+	 * unless the built-in engine already did */
+	prof_begin(PHASE_UNITS);
+	recipehtml = _builtin ? NULL : expand_units(recipe->html);
+	prof_end(PHASE_UNITS);
+#if IMAGE_PIPELINE
+	/* add dimensions, srcset & lazy-loading to <img> tags */
+	prof_begin(PHASE_IMAGES);
+	imagehtml = expand_images(NULL != recipehtml ? recipehtml : recipe->html,
+		pubdir, dstdir);
+	prof_end(PHASE_IMAGES);
+	if (NULL != imagehtml) {
+		free(recipehtml);
+		recipehtml = imagehtml;
+	}
+#endif
 	if (NULL != recipehtml) {
 		fprintf(f, "%s", recipehtml);
 		free(recipehtml);
@@ -505,20 +791,21 @@ write_recipe(FILE *f, char *srcdir, struct md *recipe, bool modified)
 #if GIT_INTEGRATION
 	/* call git for author name, date posted & date edited */
 	sprintf(src, "%s/%s.md", srcdir, recipe->slug);
-	sprintf(date_format, "--date=format:%s", FMT_RFC2822);
-	if (recipe->adate[0] == '\0')
-		git_command(recipe->adate,  32, src, date_formatter, git_log_added);
-	if (modified)
-		git_command(recipe->mdate,  32, src, date_formatter, git_log_modified);
-	if (recipe->mdate[0] == '\0')
-		strncpy(recipe->mdate, recipe->adate, sizeof(recipe->mdate) - 1);
+	if (recipe->added.epoch == 0)
+		git_date(&recipe->added, src, git_log_added);
+	if (modified && recipe->modified.epoch == 0)
+		git_date(&recipe->modified, src, git_log_modified);
+	if (recipe->modified.epoch == 0)
+		recipe->modified = recipe->added;
 	if (recipe->author[0] == '\0')
 		git_command(recipe->author, 32, src, name_formatter, git_log_added);
 	/* add to footer */
-	fprintf(f, FMT_HTML_ARTICLE_FOOTER,
-		from_rfc2822(PAGE_DATE_FORMAT, adate, 16, recipe->adate),
-		from_rfc2822(PAGE_DATE_FORMAT, mdate, 16, recipe->mdate),
-		recipe->author);
+	strftime(adate, sizeof(adate), PAGE_DATE_FORMAT, gitdate_tm(&recipe->added, &tm));
+	strftime(mdate, sizeof(mdate), PAGE_DATE_FORMAT, gitdate_tm(&recipe->modified, &tm));
+	fprintf(f, FMT_HTML_ARTICLE_FOOTER, adate, mdate, recipe->author);
+#endif
+#if RELATED_RECIPES
+	fputs(related_html(recipe->slug), f);
 #endif
 
 	fprintf(f, FMT_HTML_FOOTER);
@@ -527,49 +814,106 @@ write_recipe(FILE *f, char *srcdir, struct md *recipe, bool modified)
 	return EXIT_SUCCESS;
 }
 
+/* one page of a tag's recipes, as a whole document. tags with more
+ * than a page of recipes get the paginator's alphabet bar and
+ * navigation, across `@<tag>-page-N.html` files. */
+static void
+write_tag_page(char *file, char *tag, char *prefix, unsigned page, struct pageindex *ix)
+{
+	FILE *f;
+	char title[TAG_NAME_LEN + sizeof(PAGE_TITLE) + 20];
+	unsigned i;
+
+	f = output_open(file);
+	if (NULL == f) die("failed to open %s for writing.", file);
+	sprintf(title, FMT_TAG_TITLE, tag, PAGE_TITLE);
+	fprintf(f, FMT_HTML_HEAD, title, DESCRIPTION,
+		favicon_url(), asset_url(STYLE_SHEET));
+#if TAG_FEEDS
+	fprintf(f, FMT_HTML_TAG_FEEDS_HEAD, tag, tag);
+#endif
+	fprintf(f, "</head>\n<body>\n");
+	fprintf(f, FMT_HTML_BANNER, PAGE_TITLE);
+	fprintf(f, FMT_HTML_TAG_HEADER, tag);
+#if TAG_FEEDS
+	fprintf(f, FMT_HTML_TAG_FEEDS, tag, tag);
+#endif
+	if (ix->pages > 1) {
+		fprintf(f, FMT_HTML_INDEX_PAGES_START);
+		write_page_body(f, prefix, page, ix);
+		fprintf(f, FMT_HTML_INDEX_PAGES_END);
+	} else {
+		fprintf(f, FMT_HTML_INDEX_LIST_START);
+		for (i = 0; i < ix->count; ++i)
+			fprintf(f, FMT_HTML_INDEX_LIST_ENTRY,
+				ix->recipes[i]->url, ix->recipes[i]->title);
+		fprintf(f, FMT_HTML_INDEX_LIST_END);
+	}
+	fprintf(f, FMT_HTML_FOOTER);
+	fprintf(f, "</body>\n</html>\n");
+	prof_bytes(PHASE_TAGS, output_close(f));
+}
+
 static int
 write_tagfiles(char *dst, struct taglist *tags, struct recipelist *recipes)
 {
-	FILE *f;
+	/* every tag's recipes in title order, indexed like `tagmem` */
+	static struct pageindex index[MAX_TAGS];
+	static size_t recipetags[MAX_RECIPES][TAG_COUNT];
+	struct recipelist **members;
 	char (*rtag)[TAG_NAME_LEN];
-	char tagfile[PATH_LEN];
-	char title[TAG_NAME_LEN + sizeof(PAGE_TITLE) + 20];
+	char tagfile[PATH_LEN + TAG_NAME_LEN];
+	char prefix[TAG_NAME_LEN + 2];
 	struct taglist *tag;
 	struct recipelist *recipe;
+	struct pageindex *ix;
+	size_t i, t, total;
+	unsigned page;
 
-	/* create a tag file for each tag, with header content */
-	for (tag = tags; tag != NULL; tag = tag->next) {
-		sprintf(title, "Recipes tagged %s – %s", tag->name, PAGE_TITLE);
-		sprintf(tagfile, "%s/@%s.html", dst, tag->name);
-		f = fopen(tagfile, "w");
-		fprintf(f, FMT_HTML_HEAD, title, DESCRIPTION, FAVICON);
-		fprintf(f, "</head>\n<body>\n");
-		fprintf(f, FMT_HTML_BANNER, PAGE_TITLE);
-		fprintf(f, FMT_HTML_TAG_HEADER, tag->name);
-		fprintf(f, FMT_HTML_INDEX_LIST_START);
-		fclose(f);
+	/* count each tag's recipes, remembering which tags they are */
+	memset(index, 0, sizeof(index));
+	for (total = 0, recipe = recipes; recipe != NULL; recipe = recipe->next) {
+		for (t = 0, rtag = &recipe->tags[0];
+		     t < TAG_COUNT && (*rtag)[0] != '\0'; ++t, ++rtag) {
+			for (i = 0; i < tagcount && 0 != strcoll(tagmem[i].name, *rtag); ++i);
+			recipetags[recipe - recipemem][t] = i;
+			if (i == tagcount) continue;
+			++index[i].count;
+			++total;
+		}
 	}
-
-	/* go through each recipe, append the recipe
-	 * to the tag files of its corresponding tags */
+	members = calloc(total + 1, sizeof(*members));
+	if (NULL == members) die("could not allocate tag pages.");
+	for (total = i = 0; i < tagcount; ++i) {
+		index[i].recipes = members + total;
+		total += index[i].count;
+		index[i].count = 0;
+	}
+	/* then hand them out, the recipes being in title order already */
 	for (recipe = recipes; recipe != NULL; recipe = recipe->next) {
-		for (rtag = &recipe->tags[0]; (*rtag)[0] != '\0'; ++rtag) {
-			sprintf(tagfile, "%s/@%s.html", dst, *rtag);
-			f = fopen(tagfile, "a");
-			fprintf(f, FMT_HTML_INDEX_LIST_ENTRY, recipe->url, recipe->title);
-			fclose(f);
+		for (t = 0; t < TAG_COUNT && recipe->tags[t][0] != '\0'; ++t) {
+			i = recipetags[recipe - recipemem][t];
+			if (i == tagcount) continue;
+			index[i].recipes[index[i].count++] = recipe;
 		}
 	}
 
-	/* end the tag files with the footer content */
 	for (tag = tags; tag != NULL; tag = tag->next) {
+		ix = &index[tag - tagmem];
+		ix->pages = 1;
+		if (ix->count > RECIPES_PER_PAGE) index_pages(ix);
+		sprintf(prefix, "@%s-", tag->name);
+		/* the tag file is its first page, which is repeated
+		 * as page 1 when there are more */
 		sprintf(tagfile, "%s/@%s.html", dst, tag->name);
-		f = fopen(tagfile, "a");
-		fprintf(f, FMT_HTML_INDEX_LIST_END);
-		fprintf(f, FMT_HTML_FOOTER);
-		fprintf(f, "</body>\n</html>\n");
-		fclose(f);
+		write_tag_page(tagfile, tag->name, prefix, 1, ix);
+		for (page = 1; ix->pages > 1 && page <= ix->pages; ++page) {
+			sprintf(tagfile, "%s/" FMT_PAGE_FILE, dst, prefix, page);
+			write_tag_page(tagfile, tag->name, prefix, page, ix);
+		}
+		free(ix->letters);
 	}
+	free(members);
 
 	return EXIT_SUCCESS;
 }
@@ -593,74 +937,441 @@ slugsort(const struct dirent **_a, const struct dirent **_b)
 	return cmp;
 }
 
+/* picks the sources of this build's shard */
+static int
+shardfilter(const struct dirent *entry)
+{
+	char slug[SLUG_LEN];
+	size_t len = strlen(entry->d_name);
+
+	if (len < 3 || len - 3 >= sizeof(slug)) return 0;
+	memcpy(slug, entry->d_name, len - 3);
+	slug[len - 3] = '\0';
+	return in_shard(slug, shard, shards);
+}
+
+/* rendered feed entries, in the same order as `recipemem` */
+static struct feedentry feedmem[MAX_RECIPES] = { 0 };
+/* what the catalog has on each recipe, in the same order too */
+static struct catalogentry catalogmem[MAX_RECIPES] = { 0 };
+
 #if GIT_INTEGRATION
 /* cache structure (i couldn't think of any other name) */
 static struct cache hoard = { 0 };
+static struct store artifacts = { 0 };
+static bool storing = false;
+
+/* a checkout without a build cache (a fresh pull-request clone)
+ * starts from the one stored for its nearest first-parent ancestor,
+ * and git_history() catches up from there. */
+static void
+seed_cache(char *cachefile)
+{
+	FILE *out;
+	pid_t pid;
+	struct stat st;
+	char commit[COMMIT_LEN + 1];
+
+	if (0 == stat(cachefile, &st) && st.st_size > 0) return;
+	out = git_open(git_rev_list, &pid);
+	while (NULL != fgets(commit, sizeof(commit), out)) {
+		commit[strcspn(commit, "\n")] = '\0';
+		if (store_fetch_cache(&artifacts, commit, cachefile)) {
+			logprint("%sseeded cache%s: from %.12s\n",
+				ansi(BOLD), ansi(RESET), commit);
+			break;
+		}
+	}
+	git_close(out, pid);  /* may have been cut short */
+}
+
+/* a page also shows its related recipes */
+static uint64_t
+artifact_key(char *text, struct md *meta)
+{
+	uint64_t key = store_key(&artifacts, text, pubdir, meta);
+#if RELATED_RECIPES
+	const char *related = related_html(meta->slug);
+
+	if (0 != key) key = hash_bytes(related, strlen(related), key);
+#endif
+	return key;
+}
+
+/* takes a recipe rendered by any earlier build from the store,
+ * writing its page if `write`, and its feed entry to `entry`.
+ * returns false if the store doesn't have it. */
+static bool
+load_artifact(struct md *cached, char *text, char *dst, char *dstfile,
+              bool write, struct feedentry *entry, long *written)
+{
+	FILE *f;
+	uint64_t key;
+	char *html, *rss, *atom;
+	size_t size;
+
+	key = artifact_key(text, cached);
+	if (0 == key) return false;
+	html = store_get(&artifacts, key, "html", &size);
+	rss  = store_get(&artifacts, key, "rss",  NULL);
+	atom = store_get(&artifacts, key, "atom", NULL);
+	if (NULL == html || NULL == rss || NULL == atom) {
+		free(html); free(rss); free(atom);
+		return false;
+	}
+	*written = 0;
+	if (write) {
+		f = output_open(dstfile);
+		if (NULL == f) die("error opening %s.", dstfile);
+		fwrite(html, 1, size, f);
+		*written = output_close(f);
+#if IMAGE_PIPELINE
+		restore_images(html, pubdir, dst);
+#else
+		(void)dst;
+#endif
+	}
+	free(html);
+	restore_feed_entry(entry, cached, rss, atom);
+	return true;
+}
+#endif
+
+#if RELATED_RECIPES
+/* every recipe's title and tags, so related recipes are known before
+ * any page is written. they come from the cache, unless the source
+ * changed. a shard still has to know of every recipe. */
+static void
+collect_related(char *src, char *cachefile)
+{
+	struct dirent **names;
+	struct md meta;
+	char srcfile[PATH_LEN * 2];
+	char *relfile = NULL;
+	int n, i;
+	size_t len;
+#if GIT_INTEGRATION
+	char file[PATH_LEN + 16];
+	struct md *cached;
+	struct stat st;
+#else
+	(void)cachefile;
+#endif
+
+	n = scandir(src, &names, NULL, alphasort);
+	if (-1 == n) die("could not open source directory: %s\n.", src);
+	for (i = 0; i < n; free(names[i++])) {
+		len = strlen(names[i]->d_name);
+		if (names[i]->d_name[0] == '.' || len < 4) continue;
+		names[i]->d_name[len - 3] = '\0';  /* trim `.md` off */
+		memset(&meta, 0, sizeof(meta));
+		strncpy(meta.slug, names[i]->d_name, sizeof(meta.slug) - 1);
+		sprintf(srcfile, "%s/%s.md", src, meta.slug);
+#if GIT_INTEGRATION
+		cached = find_cache(&hoard, meta.slug);
+		if (NULL != cached && 0 == stat(srcfile, &st) && st.st_mtime == cached->mtime) {
+			memcpy(meta.title, cached->title, sizeof(meta.title));
+			memcpy(meta.tags,  cached->tags,  sizeof(meta.tags));
+			related_add(&meta);
+			continue;
+		}
+#endif
+		if (mdmeta(srcfile, &meta)) related_add(&meta);
+	}
+	free(names);
+#if GIT_INTEGRATION
+	/* a stream leaves the pages on disk, and so this, as they were */
+	snprintf(file, sizeof(file), "%s.related", cachefile);
+	if (!streaming) relfile = file;
+#endif
+	related_build(relfile);
+}
+#endif
+
+#if DATE_PAGES
+/* one page of the recipes in `order`, by the date they were added
+ * or last `edited`, as a whole document */
+static void
+write_date_page(char *file, char *heading, char *prefix, unsigned page,
+                unsigned pages, size_t *order, bool edited)
+{
+	FILE *f;
+	char title[64 + sizeof(PAGE_TITLE)], date[16];
+	struct gitdate *when;
+	struct tm tm;
+	size_t i, end;
+
+	f = output_open(file);
+	if (NULL == f) die("failed to open %s for writing.", file);
+	sprintf(title, "%s – %s", heading, PAGE_TITLE);
+	fprintf(f, FMT_HTML_HEAD, title, DESCRIPTION,
+		favicon_url(), asset_url(STYLE_SHEET));
+	fprintf(f, "</head>\n<body>\n");
+	fprintf(f, FMT_HTML_BANNER, PAGE_TITLE);
+	fprintf(f, FMT_HTML_DATES_HEADER, heading);
+	i = (page - 1) * RECIPES_PER_PAGE;
+	end = i + RECIPES_PER_PAGE < recipecount ? i + RECIPES_PER_PAGE : recipecount;
+	for (; i < end; ++i) {
+		when = edited ? &feedmem[order[i]].updated : &feedmem[order[i]].added;
+		strftime(date, sizeof(date), PAGE_DATE_FORMAT, gitdate_tm(when, &tm));
+		fprintf(f, FMT_HTML_DATES_ENTRY,
+			recipemem[order[i]].url, recipemem[order[i]].title, date);
+	}
+	fprintf(f, FMT_HTML_PAGINATE_LIST_END);
+	if (pages > 1) write_page_nav(f, prefix, page, pages);
+	fprintf(f, FMT_HTML_FOOTER);
+	fprintf(f, "</body>\n</html>\n");
+	prof_bytes(PHASE_PAGES, output_close(f));
+}
+
+/* `<name>.html`, and like tag pages, `<name>-page-N.html` when
+ * the recipes take more than one page */
+static void
+write_date_pages(char *dst, char *name, char *heading, size_t *order, bool edited)
+{
+	char file[PATH_LEN * 2], prefix[PATH_LEN];
+	unsigned page, pages;
+
+	pages = atleast(recipecount, RECIPES_PER_PAGE);
+	sprintf(prefix, "%s-", name);
+	sprintf(file, "%s/%s.html", dst, name);
+	write_date_page(file, heading, prefix, 1, pages, order, edited);
+	for (page = 1; pages > 1 && page <= pages; ++page) {
+		sprintf(file, "%s/" FMT_PAGE_FILE, dst, prefix, page);
+		write_date_page(file, heading, prefix, page, pages, order, edited);
+	}
+}
+#endif
+
+/* writes everything built from all recipes: feeds, index,
+ * paginator and tag pages, then the manifest. */
+static int
+finish(char *dst, struct taglist *tags, struct recipelist *recipes)
+{
+	struct dateindex dates;
+	size_t i;
+#if SEARCH_INDEX
+	char indexfile[PATH_LEN * 2];
+#endif
+
+#if SITEMAP
+	/* date pages by their recipes */
+	sitemap_build(feedmem, recipecount, recipes);
+#endif
+#if CATALOG
+	/* the catalog has the recipes in the order listed */
+	prof_begin(PHASE_CATALOG);
+	write_catalog(dst, tags, recipemem, feedmem, catalogmem, recipecount);
+	prof_end(PHASE_CATALOG);
+	logprint("%sfinished%s: %s/%s and %s/%s\n",
+		ansi(BOLD), ansi(RESET), dst, CATALOG_JSON_FILE, dst, CATALOG_BIN_FILE);
+#endif
+	/* order by date, merging what changed into the last build's order */
+	prof_begin(PHASE_DATES);
+	date_index(&dates, dst, feedmem, recipecount);
+	prof_end(PHASE_DATES);
+	logprint("%sfinished%s: date index, %lu added and %lu edited of %lu recipes sorted in\n",
+		ansi(BOLD), ansi(RESET), dates.moved[0], dates.moved[1], recipecount);
+	/* write rss and atom files, newest recipes first */
+	prof_begin(PHASE_FEEDS);
+	write_feeds(dst, feedmem, dates.added, recipecount);
+	prof_end(PHASE_FEEDS);
+	logprint("%sfinished%s: %s/%s and %s/%s files\n",
+		ansi(BOLD), ansi(RESET), dst, RSS_FILE, dst, ATOM_FILE);
+#if TAG_FEEDS
+	/* and each tag's, out of the same fragments */
+	prof_begin(PHASE_FEEDS);
+	i = write_tag_feeds(dst, tags, recipemem, feedmem, dates.added, recipecount);
+	prof_end(PHASE_FEEDS);
+	logprint("%sfinished%s: feeds of %lu of %lu tags rewritten\n",
+		ansi(BOLD), ansi(RESET), i, tagcount);
+#endif
+	for (i = 0; i < recipecount; ++i)
+		free_feed_entry(&feedmem[i]);
+#if DATE_PAGES
+	prof_begin(PHASE_PAGES);
+	write_date_pages(dst, RECENT_PAGE,  "Recently added",  dates.added,   false);
+	write_date_pages(dst, UPDATED_PAGE, "Recently edited", dates.updated, true);
+	prof_end(PHASE_PAGES);
+	logprint("%sfinished%s: %s/%s.html and %s/%s.html\n",
+		ansi(BOLD), ansi(RESET), dst, RECENT_PAGE, dst, UPDATED_PAGE);
+#endif
+	date_index_free(&dates);
+
+	/* write index.html file */
+	logprint("%sgenerating%s: %s/index.html\n",
+		ansi(BOLD), ansi(RESET), dst);
+	prof_begin(PHASE_PAGES);
+	write_index(dst, tags, recipes);
+	prof_end(PHASE_PAGES);
+	/* write all tag files */
+	logprint("%sgenerating%s: %lu tags filters\n",
+		ansi(BOLD), ansi(RESET), tagcount);
+	prof_begin(PHASE_TAGS);
+	write_tagfiles(dst, tags, recipes);
+	prof_end(PHASE_TAGS);
+#if SEARCH_INDEX
+	/* write search index */
+	sprintf(indexfile, "%s/%s", dst, SEARCH_INDEX_FILE);
+	prof_begin(PHASE_SEARCH);
+	write_search_index(indexfile, recipes);
+	prof_end(PHASE_SEARCH);
+	logprint("%sfinished%s: %s search index\n",
+		ansi(BOLD), ansi(RESET), indexfile);
+#endif
+#if SITEMAP
+	prof_begin(PHASE_SITEMAP);
+	write_sitemap(dst);
+	prof_end(PHASE_SITEMAP);
+	logprint("%sfinished%s: %s/%s\n",
+		ansi(BOLD), ansi(RESET), dst, SITEMAP_FILE);
+#endif
+
+	/* record what would be deployed, a stream has no manifest on disk */
+	if (streaming) {
+#if SITEMAP
+		prof_begin(PHASE_MANIFEST);
+		stream_headers(dst, sitemap_lastmod);
+		prof_end(PHASE_MANIFEST);
+		sitemap_free();
+#endif
+#if TAG_FEEDS
+		tag_feeds_free();
+#endif
+		return EXIT_SUCCESS;
+	}
+	prof_begin(PHASE_MANIFEST);
+#if SITEMAP
+	write_manifest(manifestfile, dst, pubdir, sitemap_lastmod);
+	sitemap_free();
+	logprint("%sfinished%s: %s/%s headers\n",
+		ansi(BOLD), ansi(RESET), dst, HEADERS_FILE);
+#else
+	write_manifest(manifestfile, dst, pubdir, NULL);
+#endif
+	prof_end(PHASE_MANIFEST);
+	logprint("%sfinished%s: %s manifest\n",
+		ansi(BOLD), ansi(RESET), manifestfile);
+#if TAG_FEEDS
+	tag_feeds_free();
 #endif
 
+	return EXIT_SUCCESS;
+}
+
 static int
 generate(char *src, char *dst, char *cachefile)
 {
-	FILE *dstf, *rssf, *atomf;
-	struct dirent **sources;
-	int entries;
+	FILE *dstf;
+	struct scan sources;
+	struct source *source;
 	/* file names */
 	char *slug;
-	char srcfile[PATH_LEN + 8] = { '\0' };  /* `+ 8` not necissary but makes gcc shut up */
-	char dstfile[PATH_LEN + 8] = { '\0' };
-	char rssfile[PATH_LEN]  = { '\0' };
-	char atomfile[PATH_LEN] = { '\0' };
+	char srcfile[PATH_LEN * 2] = { '\0' };
+	char dstfile[PATH_LEN * 2] = { '\0' };
 	/* contains html and metadata (i.e. tags) */
 	struct md *recipe;  /* parsed recipe */
 #if GIT_INTEGRATION
 	struct md *cached;  /* cahced recipe */
-	struct stat srcstat;
 	bool is_cached, modified, dst_exists;
+	bool relisted;  /* its related recipes changed */
+	bool history;  /* cached git metadata is current */
+#if FINGERPRINT_ASSETS
+	char assetrecord[PATH_LEN * 2];
+#endif
+	char *html = NULL;  /* rendered page, kept for the store */
+	size_t htmlsize;
+	uint64_t key;
 #endif
 	char (*tag)[TAG_NAME_LEN];
 	/* linked list of alphabetically sorted tags */
 	struct taglist *tags = NULL;
 	/* linked list of alphabetically sorted titles */
 	struct recipelist *recipes = NULL;
-
-	/* initialise rss and atom files */
-	sprintf(rssfile, "%s/%s", dst, RSS_FILE);
-	sprintf(atomfile, "%s/%s", dst, ATOM_FILE);
-	rssf = fopen(rssfile, "w");
-	atomf = fopen(atomfile, "w");
-	if (NULL == rssf)  die("failed to open %s for writing.", rssfile);
-	if (NULL == atomf) die("failed to open %s for writing.", rssfile);
-	write_rss_init(rssf);
-	write_atom_init(atomf);
+	size_t i;
+	long written;
 
 #if GIT_INTEGRATION
+	storing = NULL != storedir && init_store(&artifacts, storedir);
+#if IMAGE_PIPELINE
+	if (storing) pixstore = artifacts.pixdir;
+#endif
+	if (storing) seed_cache(cachefile);
 	/* initialise cache structure */
 	init_cache(&hoard, cachefile);
+	prof_begin(PHASE_CACHE_PARSE);
 	parse_cache(&hoard);
+	prof_end(PHASE_CACHE_PARSE);
+	history = git_history(&hoard, src);
+#if FINGERPRINT_ASSETS
+	snprintf(assetrecord, sizeof(assetrecord), "%s%s", cachefile, ASSETS_RECORD_SUFFIX);
+	restyled = assets_changed(assetrecord);
+	if (restyled)
+		logprint("%sassets changed%s: rewriting every page\n",
+			ansi(BOLD), ansi(RESET));
+#endif
 #else
 	(void)cachefile;
+	if (NULL != storedir)
+		fprintf(stderr, "warning: the artifact store needs GIT_INTEGRATION.\n");
 #endif
 
-	entries = scandir(src, &sources, NULL, slugsort);
-	if (-1 == entries)
+#if RELATED_RECIPES
+	prof_begin(PHASE_RELATED);
+	collect_related(src, cachefile);
+	prof_end(PHASE_RELATED);
+#endif
+
+#if CATALOG
+	catalog_open(dst);
+#endif
+
+	prof_begin(PHASE_SCANDIR);
+	if (-1 == scan_open(&sources, src, streaming ? NULL : dst,
+	                    shards ? shardfilter : NULL, slugsort))
 		die("could not open source directory: %s\n.", src);
+	prof_end(PHASE_SCANDIR);
 
-	while (0 != entries--) {
-		if (sources[entries]->d_name[0] == '.')
-			continue;  /* skip filenames starting with '.' */
-		slug = sources[entries]->d_name;
-		/* trim `.md` off */
-		slug[strlen(slug) - 3] = '\0';
+	while (NULL != (source = scan_next(&sources))) {
+		prof_begin(PHASE_RECIPE);
+		written = 0;
+		slug = source->slug;
+		if (NULL == source->text) die("could not read %s/%s.md.", src, slug);
 		sprintf(srcfile, "%s/%s.md",   src, slug);
 		sprintf(dstfile, "%s/%s.html", dst, slug);
 
 #if GIT_INTEGRATION
-		/* check cache is lined up */
-		cached = next_cache(&hoard);
-		is_cached = cached != NULL && 0 == strcmp(slug, cached->slug);
+		/* merge-join the listing with the cache */
+		cached = join_cache(&hoard, slug);
+		is_cached = cached != NULL;
 		/* compare timestamps */
-		stat(srcfile, &srcstat);
-		modified = is_cached && srcstat.st_mtime != cached->mtime;
+		modified = is_cached && source->mtime != cached->mtime;
+		dst_exists = source->dst_exists;
+#if RELATED_RECIPES
+		relisted = related_changed(slug);
+#else
+		relisted = false;
+#endif
+
+		/* rendered before, by this or any other checkout */
+		if (storing && is_cached && (!modified || history)
+		 && load_artifact(cached, source->text, dst, dstfile,
+		                  !dst_exists || modified || relisted || restyled,
+		                  &feedmem[recipecount], &written)) {
+			logprint("%sloaded artifact%s: %s\n",
+				ansi(BOLD), ansi(RESET), slug);
+			insert_tags(&tags, cached->tags);
+			insert_recipe(&recipes, cached, slug);
+#if CATALOG
+			catalog_note(&catalogmem[recipecount - 1], slug, cached->author,
+			             dstfile, written > 0);
+#endif
+			cached->mtime = source->mtime;
+			keep_cache(&hoard, cached);
+			prof_bytes(PHASE_WRITE, written);
+			prof_end_recipe(slug, written);
+			continue;
+		}
 
 		if (is_cached && !modified) {
 			logprint("%sloaded cache%s: %s\n",
@@ -675,7 +1386,9 @@ generate(char *src, char *dst, char *cachefile)
 #endif
 
 		/* convert md to html */
-		recipe = mdparse(src, slug);
+		prof_begin(PHASE_MDPARSE);
+		recipe = mdparse(src, slug, source->text, source->size);
+		prof_end(PHASE_MDPARSE);
 		logprint("  ├─ title: ‘%s’\n", recipe->title);
 		logprint("  ╰── tags: ");
 		for (tag = &recipe->tags[0]; (*tag)[0] != '\0'; ++tag)
@@ -686,82 +1399,218 @@ generate(char *src, char *dst, char *cachefile)
 		insert_recipe(&recipes, recipe, slug);
 
 #if GIT_INTEGRATION
-		recipe->mtime = srcstat.st_mtime;
+		recipe->mtime = source->mtime;
 		if (is_cached) {
 			/* fields that should never change, so are always valid */
-			strncpy(recipe->adate,  cached->adate,  sizeof(recipe->adate)  - 1);
+			recipe->added = cached->added;
 			strncpy(recipe->author, cached->author, sizeof(recipe->author) - 1);
-			if (!modified) {
-				/* only valid if not modified */
-				strncpy(recipe->mdate, cached->mdate, sizeof(recipe->mdate) - 1);
+			if (!modified || history) {
+				/* only valid if not modified, or history was scanned */
+				recipe->modified = cached->modified;
 			}
 		}
-		/* write recipe html file */
-		dst_exists = 0 == access(dstfile, F_OK);
-		if (!dst_exists || !is_cached || modified) {
-			dstf = fopen(dstfile, "w");
+		/* write recipe html file, through memory when storing it */
+		if (!dst_exists || !is_cached || modified || relisted || restyled) {
+			prof_begin(PHASE_WRITE);
+			if (storing) dstf = open_memstream(&html, &htmlsize);
+			else         dstf = output_open(dstfile);
 			if (NULL == dstf) die("error opening %s.", dstfile);
-			if (is_cached && !dst_exists && !modified) {
-				/* is cached, but dstfile doesn't exist, nor was it modified */
+			if (is_cached && !modified) {
+				/* is cached, but dstfile doesn't exist or lists
+				 * other related recipes, it wasn't modified */
 				cached->html = recipe->html;
-				write_recipe(dstf, src, cached, false);
+				write_recipe(dstf, src, dst, cached, false);
 				cached->html = NULL;
 			} else {
 				/* either not cached (new), or cached but source was modified */
 				assert(!is_cached || modified);
-				write_recipe(dstf, src, recipe, true);
-				/* insert or overwrite into cache */
-				if (modified) update_cache(&hoard, recipe);
-				else          insert_cache(&hoard, recipe);
+				write_recipe(dstf, src, dst, recipe, true);
 			}
-			fclose(dstf);
+			if (storing) {
+				fclose(dstf);
+				dstf = output_open(dstfile);
+				if (NULL == dstf) die("error opening %s.", dstfile);
+				fwrite(html, 1, htmlsize, dstf);
+			}
+			written = output_close(dstf);
+			prof_end(PHASE_WRITE);
 		}
+		if (is_cached && !modified) keep_cache(&hoard, cached);
+		else                        store_cache(&hoard, recipe);
 #else
 		/* write recipe html file */
-		dstf = fopen(dstfile, "w");
+		prof_begin(PHASE_WRITE);
+		dstf = output_open(dstfile);
 		if (NULL == dstf) die("error opening %s.", dstfile);
-		write_recipe(dstf, src, recipe, true);
-		fclose(dstf);
-#endif
-		/* write recipe rss fragment */
-		write_rss_entry(rssf, recipe);
-		/* write recipe atom fragment */
-		write_atom_entry(atomf, recipe);
-		mkd_cleanup(_mmio);  /* frees recipe->html */
+		write_recipe(dstf, src, dst, recipe, true);
+		written = output_close(dstf);
+		prof_end(PHASE_WRITE);
+#endif
+		/* render recipe rss & atom fragments, written out by date */
+		render_feed_entry(&feedmem[recipecount - 1], recipe);
+#if CATALOG && GIT_INTEGRATION
+		catalog_note(&catalogmem[recipecount - 1], slug, recipe->author,
+		             dstfile, written > 0);
+#elif CATALOG
+		catalog_note(&catalogmem[recipecount - 1], slug, "", dstfile, written > 0);
+#endif
+#if GIT_INTEGRATION
+		if (NULL != html) {
+			key = artifact_key(source->text, recipe);
+			if (0 != key) {
+				store_put(&artifacts, key, "html", html, htmlsize);
+				store_put(&artifacts, key, "rss",  feedmem[recipecount - 1].rss,
+					strlen(feedmem[recipecount - 1].rss));
+				store_put(&artifacts, key, "atom", feedmem[recipecount - 1].atom,
+					strlen(feedmem[recipecount - 1].atom));
+			}
+			free(html);
+			html = NULL;
+		}
+#endif
+		mdrelease();  /* frees recipe->html */
 		recipe = NULL;  /* not heap allocated */
+		prof_bytes(PHASE_WRITE, written);
+		prof_end_recipe(slug, written);
 	}
-	free(sources);
+	scan_close(&sources);
+#if RELATED_RECIPES
+	related_free();
+#endif
 
 	logprint("%sfinished%s: %lu recipes\n",
 		ansi(BOLD), ansi(RESET), recipecount);
 #if GIT_INTEGRATION
-	/* finish and dump cache */
-	dump_cache(&hoard);
-	logprint("%sfinished%s: cache rebuilt\n", ansi(BOLD), ansi(RESET));
-#endif
-	/* finish rss file */
-	write_rss_end(rssf);
-	fclose(rssf);
-	logprint("%sfinished%s: %s file\n",
-		ansi(BOLD), ansi(RESET), rssfile);
-	/* finish atom file */
-	write_atom_end(atomf);
-	fclose(atomf);
-	logprint("%sfinished%s: %s file\n",
-		ansi(BOLD), ansi(RESET), atomfile);
-
-	/* write index.html file */
-	logprint("%sgenerating%s: %s/index.html\n",
-		ansi(BOLD), ansi(RESET), dst);
-	write_index(dst, tags, recipes);
-	/* write all tag files */
-	logprint("%sgenerating%s: %lu tags filters\n",
-		ansi(BOLD), ansi(RESET), tagcount);
-	write_tagfiles(dst, tags, recipes);
+	/* finish and dump cache. a stream leaves the pages on disk as
+	 * they were, so not the cache, which says they're current, either */
+	if (!streaming) {
+		prof_begin(PHASE_CACHE_DUMP);
+		dump_cache(&hoard);
+#if FINGERPRINT_ASSETS
+		assets_record(assetrecord);
+#endif
+		/* a shard's cache only has its recipes, not for seeding others */
+		if (storing && !shards && hoard.head[0] != '\0')
+			store_save_cache(&artifacts, hoard.head, cachefile);
+		prof_end(PHASE_CACHE_DUMP);
+		logprint("%sfinished%s: cache rebuilt\n", ansi(BOLD), ansi(RESET));
+	}
+#endif
+	/* the rest needs every shard, it's left for the merge */
+	if (shards) {
+		sprintf(dstfile, "%s/" FMT_SHARD_FILE, dst, shard, shards);
+		write_partial(dstfile, recipemem, feedmem, catalogmem, recipecount);
+		for (i = 0; i < recipecount; ++i)
+			free_feed_entry(&feedmem[i]);
+		logprint("%sfinished%s: shard %u/%u partial\n",
+			ansi(BOLD), ansi(RESET), shard, shards);
+		return EXIT_SUCCESS;
+	}
+	return finish(dst, tags, recipes);
+}
 
+/* builds what generate() leaves to the merge, from every shard's
+ * partial in `dst`. each partial is in slug order, and so is their
+ * merge, as a single build would have seen them.
+ * the partials are removed once merged, so a shard that failed is
+ * never covered for by an old partial. */
+static int
+merge(char *dst)
+{
+	FILE **files;
+	struct md *metas;
+	struct feedentry *entries;
+	struct catalogentry *catalog;
+	struct taglist *tags = NULL;
+	struct recipelist *recipes = NULL;
+	char file[PATH_LEN * 2];
+	unsigned k, n, next;
+	int err;
+
+	n = find_partials(dst);
+	if (0 == n) die("no partials to merge in %s.", dst);
+	files   = calloc(n, sizeof(*files));
+	metas   = calloc(n, sizeof(*metas));
+	entries = calloc(n, sizeof(*entries));
+	catalog = calloc(n, sizeof(*catalog));
+	if (NULL == files || NULL == metas || NULL == entries || NULL == catalog)
+		die("could not allocate memory for %u shards.", n);
+	/* the head of each partial, a shard is done when its file is */
+	for (k = 0; k < n; ++k) {
+		files[k] = open_partial(dst, k + 1, n);
+		if (!read_partial(files[k], &metas[k], &entries[k], &catalog[k])) {
+			fclose(files[k]);
+			files[k] = NULL;
+		}
+	}
+	for (;;) {
+		for (next = n, k = 0; k < n; ++k)
+			if (NULL != files[k] && (next == n
+			 || 0 > strcoll(metas[k].slug, metas[next].slug)))
+				next = k;
+		if (next == n) break;
+		if (MAX_RECIPES == recipecount)
+			die("more than %d recipes to merge.", MAX_RECIPES);
+		insert_tags(&tags, metas[next].tags);
+		insert_recipe(&recipes, &metas[next], metas[next].slug);
+		feedmem[recipecount - 1] = entries[next];
+		catalogmem[recipecount - 1] = catalog[next];
+		if (!read_partial(files[next], &metas[next], &entries[next], &catalog[next])) {
+			fclose(files[next]);
+			files[next] = NULL;
+		}
+	}
+	free(files);
+	free(metas);
+	free(entries);
+	free(catalog);
+	logprint("%smerged%s: %lu recipes from %u shards\n",
+		ansi(BOLD), ansi(RESET), recipecount, n);
+
+	err = finish(dst, tags, recipes);
+	if (err != EXIT_SUCCESS) return err;
+	for (k = 1; k <= n; ++k) {
+		snprintf(file, sizeof(file), "%s/" FMT_SHARD_FILE, dst, k, n);
+		unlink(file);
+	}
 	return EXIT_SUCCESS;
 }
 
+#if SEARCH_INDEX
+/* times a query over this many runs, once warmed up */
+#define SEARCH_RUNS 100
+
+/* looks `query` up in the search index in `dst`, printing the hits.
+ * fails if there are none. */
+static int
+search(char *dst, char *query)
+{
+	struct search_index index;
+	struct search_hit hits[SEARCH_HITS];
+	char indexfile[PATH_LEN * 2];
+	struct timespec tic, toc;
+	double timetaken;
+	size_t n, i;
+
+	sprintf(indexfile, "%s/%s", dst, SEARCH_INDEX_FILE);
+	if (!search_open(&index, indexfile))
+		die("could not load search index %s.", indexfile);
+	n = search_query(&index, query, hits, SEARCH_HITS);
+	clock_gettime(CLOCK_MONOTONIC, &tic);
+	for (i = 0; i < SEARCH_RUNS; ++i)
+		search_query(&index, query, hits, SEARCH_HITS);
+	clock_gettime(CLOCK_MONOTONIC, &toc);
+	for (i = 0; i < n; ++i)
+		printf("%s\t%s\n", hits[i].url, hits[i].title);
+	timetaken = ( toc.tv_sec -  tic.tv_sec) * 1000000.0
+	          + (toc.tv_nsec - tic.tv_nsec) / 1000.0;
+	logprint("%lu hits in %.1f microseconds (mean of %d queries, %u recipes).\n",
+		n, timetaken / SEARCH_RUNS, SEARCH_RUNS, index.docs);
+	search_close(&index);
+	return n > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
+
 int
 main(int argc, char **argv)
 {
@@ -772,12 +1621,22 @@ main(int argc, char **argv)
 	char *src = (char *)ARTICLES_MARKDOWN;
 	char *dst = (char *)ARTICLES_HTML;
 	char *cachefile = (char *)CACHE_FILE;
+	char *deployed = NULL;
+	char *tracefile = NULL;
+	char *query = NULL;
+	char pixdir[PATH_LEN];
+	char shardcache[PATH_LEN];
+	bool linting = false;
+	bool comparing = false;
+	bool assets = false;
+	bool minify = false;
+	bool merging = false;
 	char *prog = argv[i++];
 
 	for (j = i; i < argc; ++i, j = i) if (argv[i][0] == '-') {
 		switch (argv[i][1]) {
 		case '\0':
-			fputs("output to stdout not implemented.\n", stderr);
+			fputs("use -d - to stream output to stdout.\n", stderr);
 			return EXIT_FAILURE;
 		case 'h':
 			usage(prog);
@@ -788,12 +1647,51 @@ main(int argc, char **argv)
 		case 'd':
 			dst = argv[++i];
 			break;
+		case 'p':
+			pubdir = argv[++i];
+			break;
 		case 'q':
 			verbosity = 0;
 			break;
+		case 'l':
+			linting = true;
+			break;
+		case 'X':
+			comparing = true;
+			break;
+		case 'a':
+			assets = true;
+			break;
+		case 'M':
+			minify = true;
+			break;
 		case 'c':
 			cachefile = argv[++i];
 			break;
+		case 'm':
+			manifestfile = argv[++i];
+			break;
+		case 'D':
+			deployed = argv[++i];
+			break;
+		case 'P':
+			tracefile = argv[++i];
+			break;
+		case 'A':
+			storedir = argv[++i];
+			break;
+		case 'S':
+			if (!parse_shard(argv[++i], &shard, &shards)) {
+				fprintf(stderr, "-S expects a shard as <k>/<n>, e.g. 1/4.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'J':
+			merging = true;
+			break;
+		case 'Q':
+			query = argv[++i];
+			break;
 		case 'C':
 			/* clean build, ignore cache file */
 			/* TODO */
@@ -823,11 +1721,70 @@ main(int argc, char **argv)
 	setlocale(LC_COLLATE, "en_US.UTF-8");
 	setlocale(LC_ALL, "en_US.UTF-8");  /*< for iconv to transliterate */
 
+	/* check sources, instead of building */
+	if (linting) {
+		snprintf(pixdir, sizeof(pixdir), "%s/pix", pubdir);
+		err = lint(src, pixdir, stdout);
+		logprint("%d files failed checks.\n", err);
+		return err ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	/* render recipes with both markdown engines, instead of building */
+	if (comparing) {
+#if BUILTIN_MARKDOWN
+		err = mdcheck(src, stdout, expand_units);
+		return err ? EXIT_FAILURE : EXIT_SUCCESS;
+#else
+		fprintf(stderr, "-X needs BUILTIN_MARKDOWN.\n");
+		return EXIT_FAILURE;
+#endif
+	}
+
+	/* search the built site, instead of building */
+	if (NULL != query) {
+#if SEARCH_INDEX
+		return search(dst, query);
+#else
+		fprintf(stderr, "-Q needs SEARCH_INDEX.\n");
+		return EXIT_FAILURE;
+#endif
+	}
+
+	/* list files to upload, instead of building */
+	if (NULL != deployed) {
+		err = diff_manifest(manifestfile, deployed, stdout);
+		logprint("%d files changed since %s.\n", err, deployed);
+		return EXIT_SUCCESS;
+	}
+
+	/* partials are kept in, and merged from, the destination */
+	if ((shards || merging) && 0 == strcmp(dst, "-")) {
+		fprintf(stderr, "-S and -J need a destination directory.\n");
+		return EXIT_FAILURE;
+	}
+	if (shards) {
+		snprintf(shardcache, sizeof(shardcache), "%s.%u-of-%u",
+			cachefile, shard, shards);
+		cachefile = shardcache;
+	}
+
 	/* start clock on generate() function */
+	if (NULL != tracefile) prof_init(tracefile);
 	clock_gettime(CLOCK_MONOTONIC, &tic);
-	err = generate(src, dst, cachefile);
+	output_init(dst, minify);
+	/* streamed first, so generated files with the same path win */
+	if (assets) output_tree(pubdir);
+#if FINGERPRINT_ASSETS
+	prof_begin(PHASE_ASSETS);
+	fingerprint_assets(pubdir, dst);
+	prof_end(PHASE_ASSETS);
+#endif
+	if (merging) err = merge(dst);
+	else         err = generate(src, dst, cachefile);
 	if (err != EXIT_SUCCESS) return err;
+	output_end();
 	clock_gettime(CLOCK_MONOTONIC, &toc);
+	prof_finish();
 
 	/* fin. */
 	timetaken = ( toc.tv_sec -  tic.tv_sec) * 1000.0
@@ -852,15 +1809,6 @@ die(char *fmt, ...) {
 	exit(errno || EXIT_FAILURE);
 }
 
-char *
-from_rfc2822(const char *fmt, char *dst, size_t n, const char *src)
-{
-	struct tm tm = { 0 };
-	strptime(src, FMT_RFC2822, &tm);
-	strftime(dst, n, fmt, &tm);
-	return dst;
-}
-
 char *
 rfc3339time(char *dst, struct tm *tm)
 {
@@ -880,10 +1828,131 @@ rfc3339time(char *dst, struct tm *tm)
 	return dst;
 }
 
-char *
-to_rfc3339(char *dst, const char *src, const char *fmt)
+/* reads "<epoch> <+hhmm>", as git (see date_formatter) and the cache
+ * write dates, or an rfc 2822 date, as older caches have them.
+ * false, and an unknown date, if it's neither. */
+bool
+parse_gitdate(struct gitdate *date, const char *src)
 {
 	struct tm tm = { 0 };
-	strptime(src, fmt, &tm);
-	return rfc3339time(dst, &tm);
+	long long epoch;
+	unsigned hh, mm;
+	char sign;
+
+	if (4 == sscanf(src, "%lld %c%2u%2u", &epoch, &sign, &hh, &mm)
+	 && ('+' == sign || '-' == sign)) {
+		date->epoch  = epoch;
+		date->offset = (hh * 3600L + mm * 60L) * ('-' == sign ? -1 : 1);
+		return true;
+	}
+	if (NULL != strptime(src, FMT_RFC2822, &tm)) {
+		date->offset = tm.tm_gmtoff;  /* timegm() resets it */
+		date->epoch  = timegm(&tm) - date->offset;
+		return true;
+	}
+	date->epoch = date->offset = 0;
+	return false;
+}
+
+/* writes "<epoch> <+hhmm>" into `dst`, of at least GITDATE_LEN bytes */
+char *
+format_gitdate(char *dst, const struct gitdate *date)
+{
+	long off = date->offset < 0 ? -date->offset : date->offset;
+
+	sprintf(dst, "%lld %c%02ld%02ld", (long long)date->epoch,
+		date->offset < 0 ? '-' : '+', off / 3600 % 100, off / 60 % 60);
+	return dst;
+}
+
+/* the date as it was where it was committed, for strftime() */
+struct tm *
+gitdate_tm(const struct gitdate *date, struct tm *tm)
+{
+	time_t local = date->epoch + date->offset;
+
+	gmtime_r(&local, tm);
+	tm->tm_gmtoff = date->offset;
+	return tm;
+}
+
+/* 64-bit FNV-1a, chain calls by passing the previous hash as `seed`.
+ * start a new hash with HASH_SEED. */
+uint64_t
+hash_bytes(const void *src, size_t n, uint64_t seed)
+{
+	const unsigned char *byte = src;
+	while (n--) {
+		seed ^= *byte++;
+		seed *= 0x100000001b3ULL;
+	}
+	return seed;
+}
+
+/* hash of a whole file's contents, or 0 if it can't be read. */
+uint64_t
+hash_file(const char *path)
+{
+	FILE *f;
+	char buf[1 << 13];
+	size_t n;
+	uint64_t h = HASH_SEED;
+
+	f = fopen(path, "r");
+	if (NULL == f) return 0;
+	while (0 < (n = fread(buf, 1, sizeof(buf), f)))
+		h = hash_bytes(buf, n, h);
+	fclose(f);
+	return h;
+}
+
+/* allocates memory, must be freed,
+ * or returns NULL if the file can't be read.
+ * contents are NUL terminated, `size` (if given) excludes the NUL. */
+char *
+read_file(const char *path, size_t *size)
+{
+	FILE *f;
+	char *data;
+	long len;
+
+	f = fopen(path, "r");
+	if (NULL == f) return NULL;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	data = malloc(len + 1);
+	if (NULL == data) die("could not allocate memory for %s.", path);
+	if (len < 0 || (size_t)len != fread(data, 1, len, f)) {
+		free(data);
+		data = NULL;
+	} else {
+		data[len] = '\0';
+		if (NULL != size) *size = len;
+	}
+	fclose(f);
+	return data;
+}
+
+/* writes under a temporary name, then renames into place, so
+ * concurrent readers only ever see a missing or complete file. */
+bool
+write_atomic(const char *path, const void *data, size_t size)
+{
+	FILE *f;
+	char tmp[PATH_LEN * 3];
+
+	snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+	f = fopen(tmp, "w");
+	if (NULL == f) return false;
+	if (size != fwrite(data, 1, size, f)) {
+		fclose(f);
+		unlink(tmp);
+		return false;
+	}
+	if (0 != fclose(f) || 0 != rename(tmp, path)) {
+		unlink(tmp);
+		return false;
+	}
+	return true;
 }
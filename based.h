@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef __USE_XOPEN
 #define __USE_XOPEN
@@ -40,9 +41,30 @@ struct recipelist {
 	struct recipelist *next;
 };
 
+/* a git date, and the utc offset it was committed at */
+struct gitdate {
+	time_t epoch;  /* 0 if unknown */
+	long offset;   /* seconds east of utc */
+};
+
+/* "<epoch> <+hhmm>", see format_gitdate() */
+#define GITDATE_LEN 32
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+/* ansi() escape codes */
+#define BOLD 1
+#define RESET 0
+
 void die(char *, ...);
-char *from_rfc2822(const char *, char *, size_t, const char *);
+char *ansi(int);
 char *rfc3339time(char *, struct tm *);
-char *to_rfc3339(char *, const char *, const char *);
+bool parse_gitdate(struct gitdate *, const char *);
+char *format_gitdate(char *, const struct gitdate *);
+struct tm *gitdate_tm(const struct gitdate *, struct tm *);
+uint64_t hash_bytes(const void *, size_t, uint64_t);
+uint64_t hash_file(const char *);
+char *read_file(const char *, size_t *);
+bool write_atomic(const char *, const void *, size_t);
 
 #endif
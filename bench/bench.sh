@@ -0,0 +1,49 @@
+#!/bin/sh
+# builds synthetic corpora of the given sizes, and times a cold build,
+# a warm (fully cached) build and a build with a single file touched.
+# usage: bench/bench.sh <based-binary> <corpus-dir> <size>...
+set -eu
+
+BASED="$(realpath "$1")"
+DIR="$2"
+shift 2
+ROOT="$(pwd)"
+
+# run a build, reporting wall time, throughput and peak rss.
+# the timings come from the build's own profile (-P).
+run() {
+	label="$1"
+	count="$2"
+	"$BASED" -s src -d blog -p data -c .buildcache -m .manifest -q -P "$label.json"
+	sed -n 's/.*"total":{"wall_ms":\([0-9.]*\),"cpu_ms":[0-9.]*,"peak_rss_kb":\([0-9]*\)}.*/\1 \2/p' \
+		"$label.json" | {
+		read -r ms rss
+		awk -v n="$count" -v l="$label" -v ms="$ms" -v rss="$rss" 'BEGIN {
+			printf "%8d  %-8s %12.1f ms %12.0f recipes/s %10d KiB\n",
+				n, l, ms, n / (ms / 1000), rss
+		}'
+	}
+}
+
+printf "%8s  %-8s %15s %22s %14s\n" recipes build time throughput "peak rss"
+for n in "$@"; do
+	corpus="$DIR/$n"
+	if [ ! -d "$corpus/src" ]; then
+		mkdir -p "$corpus/src" "$corpus/data"
+		awk -v count="$n" -v out="$corpus/src" -f bench/gencorpus.awk src/*.md
+		cp index.md "$corpus/"
+		# one commit, so git integration has history to look up
+		(cd "$corpus" && git init -q && git add src index.md \
+			&& git -c user.name=bench -c user.email=bench@localhost \
+			       commit -q -m "synthetic corpus")
+	fi
+	cd "$corpus"
+	rm -rf blog .buildcache
+	mkdir blog
+	run cold "$n"
+	run warm "$n"
+	sleep 1  # cache compares mtimes in whole seconds
+	touch "src/$(ls src | head -n 1)"
+	run touched "$n"
+	cd "$ROOT"
+done
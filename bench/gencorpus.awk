@@ -0,0 +1,89 @@
+#!/usr/bin/awk -f
+# generates a synthetic recipe corpus, modelled on the real one.
+# usage: awk -v count=N -v out=DIR [-v seed=S] -f gencorpus.awk src/*.md
+#
+# tags are drawn with the same frequencies as in the given recipes,
+# and titles are built from words of the real (unicode) titles.
+# a portable park-miller generator is used instead of rand(), so the
+# same corpus is produced by every awk.
+
+function rnd() {
+	seed = (seed * 16807) % 2147483647
+	return seed / 2147483647
+}
+function pick(n) { return int(rnd() * n) + 1 }
+
+function pick_tag(    r, i) {
+	r = rnd() * tagtotal
+	for (i = 1; i < ntags; ++i)
+		if (r < tagcum[i]) break
+	return tagname[i]
+}
+
+function qty(    m) {
+	m = pick(20) * 25
+	if (rnd() < 0.5)
+		return "{" m "g," sprintf("%.2g", m / 240) " cups}"
+	return "{" m "ml," sprintf("%.2g", m / 15) " tbsp}"
+}
+
+FNR == 1 && /^# / {
+	n = split(substr($0, 3), w, " ")
+	for (i = 1; i <= n; ++i)
+		if (length(w[i]) > 2 && length(w[i]) < 14) words[++nwords] = w[i]
+}
+/^;tags: / {
+	for (i = 2; i <= NF; ++i) {
+		if (!($i in tagfreq)) tagorder[++ntags] = $i
+		++tagfreq[$i]
+	}
+}
+/^- / && length($0) < 40 { ingredients[++ningredients] = substr($0, 3) }
+
+END {
+	if (seed == "") seed = 42
+	if (count == "" || out == "") {
+		print "usage: awk -v count=N -v out=DIR -f gencorpus.awk src/*.md" > "/dev/stderr"
+		exit 1
+	}
+	for (i = 1; i <= ntags; ++i) {
+		tagtotal += tagfreq[tagorder[i]]
+		tagcum[i] = tagtotal
+		tagname[i] = tagorder[i]
+	}
+	for (r = 1; r <= count; ++r) {
+		file = sprintf("%s/recipe-%06d.md", out, r)
+
+		title = words[pick(nwords)]
+		n = pick(3)
+		for (i = 1; i <= n; ++i) title = title " " words[pick(nwords)]
+		printf "# %s\n\n", title > file
+		print "A synthetic recipe, generated for benchmarking.\n" > file
+
+		print "## Ingredients\n" > file
+		n = 3 + pick(10)
+		for (i = 1; i <= n; ++i) {
+			if (rnd() < 0.5) printf "- %s %s\n", qty(), ingredients[pick(ningredients)] > file
+			else printf "- %s\n", ingredients[pick(ningredients)] > file
+		}
+
+		print "\n## Directions\n" > file
+		n = 2 + pick(7)
+		for (i = 1; i <= n; ++i)
+			printf "%d. Cook the %s for %d minutes.\n", i, words[pick(nwords)], pick(40) > file
+
+		print "\n## Contribution\n\n- Synthetic\n" > file
+
+		split("", seen)
+		tags = ""
+		n = 1 + pick(4)
+		for (i = 1; i <= n; ++i) {
+			t = pick_tag()
+			if (t in seen) continue
+			seen[t] = 1
+			tags = tags " " t
+		}
+		printf ";tags:%s\n", tags > file
+		close(file)
+	}
+}
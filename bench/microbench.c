@@ -0,0 +1,536 @@
+/* micro-benchmarks of the hot helpers, each run on its own over the
+ * recipes in src/. every benchmark is a pass over all recipes, repeated
+ * until a sample takes long enough to time, for a number of samples.
+ * the median ns/op of each is compared to a baseline file, and any
+ * benchmark slower than its baseline by more than the allowed slack
+ * fails the run.
+ *
+ * many of the helpers are static, so based.c and rss.c are compiled
+ * into this file (with based's main renamed), and linked with the
+ * objects of the other files.
+ *
+ * usage: microbench [-s <src>] [-b <baseline>] [-t <percent>] [-r <samples>] [-w]
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <math.h>
+
+#define main based_main
+#include "based.c"
+#undef main
+#include "rss.c"
+
+/* a sample runs for at least this long */
+#define SAMPLE_NS 20e6
+#define MAX_BENCHES 16
+
+#ifdef __GLIBC__
+/* every allocation goes through these, libc's own included */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static size_t allocations = 0;
+
+void *malloc(size_t n) { ++allocations; return __libc_malloc(n); }
+void *calloc(size_t n, size_t m) { ++allocations; return __libc_calloc(n, m); }
+void *realloc(void *p, size_t n) { ++allocations; return __libc_realloc(p, n); }
+void free(void *p) { __libc_free(p); }
+#define ALLOCATIONS allocations
+#else
+#define ALLOCATIONS 0  /* not counted */
+#endif
+
+/* a recipe of src/, as the helpers see it */
+struct input {
+	struct md meta;   /* title & tags, and made-up git metadata */
+	char tagstring[TAG_COUNT * TAG_NAME_LEN];
+	char *html;       /* the source, its headings as html */
+};
+
+static struct input *inputs = NULL;
+static size_t ninputs = 0;
+static struct dirent **names = NULL, **shuffled = NULL, **sorting = NULL;
+static int nnames = 0;
+static struct pageindex paginator = { 0 };
+static char cachefile[] = "/tmp/microbench-cache-XXXXXX";
+static char dumpfile[]  = "/tmp/microbench-dump-XXXXXX";
+static char logfile[]   = "/tmp/microbench-log-XXXXXX";
+/* scratch output of the emitters */
+static char emitted[1 << 20];
+static FILE *emitter = NULL;
+
+/* a benchmark runs its helper over every input once,
+ * returning how many times it ran, and adding the input bytes */
+struct bench {
+	const char *name;
+	size_t (*pass)(size_t *);
+};
+
+struct result {
+	double ns, spread, mbps, allocs;
+	double baseline;  /* ns/op, 0 if none */
+};
+
+static size_t
+bench_xmlencode(size_t *bytes)
+{
+	static char dst[TITLE_LEN * 6];
+	size_t i;
+
+	for (i = 0; i < ninputs; ++i) {
+		xmlencode(dst, inputs[i].meta.title);
+		*bytes += strlen(inputs[i].meta.title);
+	}
+	return ninputs;
+}
+
+static size_t
+bench_expand_units(size_t *bytes)
+{
+	size_t i;
+
+	for (i = 0; i < ninputs; ++i) {
+		free(expand_units(inputs[i].html));
+		*bytes += strlen(inputs[i].html);
+	}
+	return ninputs;
+}
+
+static size_t
+bench_alphord(size_t *bytes)
+{
+	size_t i;
+
+	for (i = 0; i < ninputs; ++i) {
+		(void)alphord(inputs[i].meta.title);  /* iconv, not optimised out */
+		*bytes += strlen(inputs[i].meta.title);
+	}
+	return ninputs;
+}
+
+static size_t
+bench_string_from_tags(size_t *bytes)
+{
+	static char dst[TAG_COUNT * TAG_NAME_LEN];
+	size_t i, built = 0;
+
+	for (i = 0; i < ninputs; ++i) {
+		/* string_from_tags() needs a tag, untagged recipes aren't counted */
+		if (inputs[i].meta.tags[0][0] == '\0') continue;
+		string_from_tags(dst, inputs[i].meta.tags);
+		*bytes += strlen(dst);
+		++built;
+	}
+	return built;
+}
+
+static size_t
+bench_tags_from_string(size_t *bytes)
+{
+	static char tags[TAG_COUNT][TAG_NAME_LEN];
+	size_t i;
+
+	for (i = 0; i < ninputs; ++i) {
+		memset(tags, 0, sizeof(tags));
+		tags_from_string(tags, inputs[i].tagstring);
+		*bytes += strlen(inputs[i].tagstring);
+	}
+	return ninputs;
+}
+
+#if GIT_INTEGRATION
+static size_t
+bench_parse_cache(size_t *bytes)
+{
+	struct cache c = { 0 };
+	size_t size;
+
+	init_cache(&c, cachefile);
+	parse_cache(&c);
+	size = ftell(c.file);
+	fclose(c.file);
+	free(c.entries);
+	free(c.sums);
+	free(c.fresh);
+	free(c.index);
+	*bytes += size;
+	return c.size;
+}
+
+/* a full write of the cache, into a file started over every pass */
+static size_t
+bench_dump_cache(size_t *bytes)
+{
+	struct cache c = { 0 };
+	struct stat st;
+	size_t i;
+
+	unlink(dumpfile);
+	init_cache(&c, dumpfile);
+	for (i = 0; i < ninputs; ++i)
+		keep_cache(&c, &inputs[i].meta);
+	dump_cache(&c);  /* closes and frees it */
+	if (0 == stat(dumpfile, &st)) *bytes += st.st_size;
+	return ninputs;
+}
+
+/* a build's parse then dump with one recipe changed, appending its
+ * record to the log, which is compacted now and then */
+static size_t
+bench_update_cache(size_t *bytes)
+{
+	static time_t pass = 0;
+	struct cache c = { 0 };
+	struct md changed;
+	struct stat before, after;
+	size_t i;
+
+	if (0 != stat(logfile, &before)) die("could not stat %s.", logfile);
+	init_cache(&c, logfile);
+	parse_cache(&c);
+	changed = inputs[0].meta;
+	changed.mtime = ++pass;
+	store_cache(&c, &changed);
+	for (i = 1; i < ninputs; ++i)
+		keep_cache(&c, &inputs[i].meta);
+	dump_cache(&c);
+	if (0 != stat(logfile, &after)) die("could not stat %s.", logfile);
+	/* appended to, or rewritten when compacted */
+	*bytes += after.st_size >= before.st_size
+		? after.st_size - before.st_size : after.st_size;
+	return ninputs;
+}
+#endif
+
+static int
+slugcmp_(const void *a, const void *b)
+{
+	return slugsort((const struct dirent **)a, (const struct dirent **)b);
+}
+
+static size_t
+bench_slugsort(size_t *bytes)
+{
+	int i;
+
+	memcpy(sorting, shuffled, nnames * sizeof(*sorting));
+	qsort(sorting, nnames, sizeof(*sorting), slugcmp_);
+	for (i = 0; i < nnames; ++i)
+		*bytes += strlen(names[i]->d_name);
+	return nnames;
+}
+
+/* FMT_HTML_PAGINATE_* */
+static size_t
+bench_page_body(size_t *bytes)
+{
+	unsigned page;
+
+	for (page = 1; page <= paginator.pages; ++page) {
+		rewind(emitter);
+		write_page_body(emitter, "", page, &paginator);
+		*bytes += ftell(emitter);
+	}
+	return paginator.pages;
+}
+
+/* FMT_HTML_INDEX_LIST_*, as on tag pages */
+static size_t
+bench_list_entries(size_t *bytes)
+{
+	struct recipelist *recipe;
+	size_t n = 0;
+
+	rewind(emitter);
+	fprintf(emitter, FMT_HTML_INDEX_LIST_START);
+	for (recipe = paginator.recipes[0]; recipe != NULL; recipe = recipe->next, ++n)
+		fprintf(emitter, FMT_HTML_INDEX_LIST_ENTRY, recipe->url, recipe->title);
+	fprintf(emitter, FMT_HTML_INDEX_LIST_END);
+	*bytes += ftell(emitter);
+	return n;
+}
+
+static const struct bench benches[] = {
+	{ "xmlencode",        bench_xmlencode },
+	{ "expand_units",     bench_expand_units },
+	{ "alphord",          bench_alphord },
+	{ "string_from_tags", bench_string_from_tags },
+	{ "tags_from_string", bench_tags_from_string },
+#if GIT_INTEGRATION
+	{ "parse_cache",      bench_parse_cache },
+	{ "dump_cache",       bench_dump_cache },
+	{ "update_cache",     bench_update_cache },
+#endif
+	{ "slugsort",         bench_slugsort },
+	{ "page_body",        bench_page_body },
+	{ "list_entries",     bench_list_entries },
+};
+#define NBENCHES (sizeof(benches) / sizeof(*benches))
+
+/* "## Heading" lines become "<h2>Heading</h2>", as expand_units()
+ * looks for the ingredients and contribution sections by them */
+static char *
+htmlish(char *text)
+{
+	char *html, *line, *end, *out;
+
+	html = out = malloc(strlen(text) * 2 + 1);
+	if (NULL == html) die("could not allocate memory for input.");
+	for (line = text; *line != '\0'; line = end) {
+		end = strchr(line, '\n');
+		end = NULL == end ? line + strlen(line) : end + 1;
+		if (0 == strncmp(line, "## ", 3)) {
+			out += sprintf(out, "<h2>%.*s</h2>\n",
+				(int)(end - line - 3 - (end[-1] == '\n')), line + 3);
+		} else {
+			memcpy(out, line, end - line);
+			out += end - line;
+		}
+	}
+	*out = '\0';
+	return html;
+}
+
+static int
+mdfilter(const struct dirent *entry)
+{
+	size_t len = strlen(entry->d_name);
+	return entry->d_name[0] != '.' && len > 3
+	    && 0 == strcmp(entry->d_name + len - 3, ".md");
+}
+
+static void
+load_inputs(char *src)
+{
+	struct recipelist *list = NULL;
+	struct cache c = { 0 };
+	struct input *in;
+	char path[PATH_LEN * 2];
+	char *text;
+	int i, j, fd;
+
+	nnames = scandir(src, &names, mdfilter, alphasort);
+	if (nnames <= 0) die("no recipes in %s.", src);
+	if ((size_t)nnames > MAX_RECIPES) nnames = MAX_RECIPES;
+	inputs   = calloc(nnames, sizeof(*inputs));
+	shuffled = calloc(nnames, sizeof(*shuffled));
+	sorting  = calloc(nnames, sizeof(*sorting));
+	if (NULL == inputs || NULL == shuffled || NULL == sorting)
+		die("could not allocate memory for %d inputs.", nnames);
+	for (i = 0; i < nnames; ++i) {
+		in = &inputs[ninputs];
+		sprintf(path, "%s/%s", src, names[i]->d_name);
+		if (!mdmeta(path, &in->meta)) continue;
+		text = read_file(path, NULL);
+		if (NULL == text) continue;
+		in->html = htmlish(text);
+		free(text);
+		snprintf(in->meta.slug, sizeof(in->meta.slug), "%.*s",
+			(int)strlen(names[i]->d_name) - 3, names[i]->d_name);
+		if (in->meta.tags[0][0] != '\0')
+			string_from_tags(in->tagstring, in->meta.tags);
+#if GIT_INTEGRATION
+		in->meta.mtime = 1600000000 + i;
+		strcpy(in->meta.author, "Based Cook");
+		parse_gitdate(&in->meta.added,    "1615719600 +0100");
+		parse_gitdate(&in->meta.modified, "1656952200 +0200");
+#endif
+		insert_recipe(&list, &in->meta, in->meta.slug);
+		++ninputs;
+	}
+	/* the same shuffle every run, for slugsort to put right */
+	memcpy(shuffled, names, nnames * sizeof(*shuffled));
+	for (srand(1), i = nnames - 1; i > 0; --i) {
+		j = rand() % (i + 1);
+		sorting[0] = shuffled[i]; shuffled[i] = shuffled[j]; shuffled[j] = sorting[0];
+	}
+
+	paginator.recipes = calloc(recipecount + 1, sizeof(*paginator.recipes));
+	if (NULL == paginator.recipes) die("could not allocate paginator.");
+	for (; list != NULL; list = list->next)
+		paginator.recipes[paginator.count++] = list;
+	index_pages(&paginator);
+	emitter = fmemopen(emitted, sizeof(emitted), "w");
+	if (NULL == emitter) die("could not open emitter buffer.");
+
+	/* a cache file to parse, one to dump into, and a log to update */
+	if (-1 == (fd = mkstemp(cachefile))) die("could not create %s.", cachefile);
+	close(fd);
+	if (-1 == (fd = mkstemp(dumpfile))) die("could not create %s.", dumpfile);
+	close(fd);
+	if (-1 == (fd = mkstemp(logfile))) die("could not create %s.", logfile);
+	close(fd);
+#if GIT_INTEGRATION
+	init_cache(&c, cachefile);
+	for (i = 0; (size_t)i < ninputs; ++i)
+		keep_cache(&c, &inputs[i].meta);
+	dump_cache(&c);
+	init_cache(&c, logfile);
+	for (i = 0; (size_t)i < ninputs; ++i)
+		keep_cache(&c, &inputs[i].meta);
+	dump_cache(&c);
+#else
+	(void)c;
+#endif
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+doublesort(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* median ns/op over `samples`, their median absolute deviation from it
+ * as a percentage, throughput and allocations per op */
+static void
+run_bench(const struct bench *b, int samples, struct result *r)
+{
+	double *ns, start, taken, deviation[64];
+	size_t ops, bytes, passes, p, allocs;
+	int s;
+
+	/* warm up, finding how many passes fill a sample */
+	for (passes = 1;; passes *= 2) {
+		start = now_ns();
+		for (ops = bytes = p = 0; p < passes; ++p) ops += b->pass(&bytes);
+		taken = now_ns() - start;
+		if (taken >= SAMPLE_NS / 4 || passes >= (1u << 24)) break;
+	}
+	passes = ceil(passes * SAMPLE_NS / (taken > 1 ? taken : 1));
+	if (passes < 1) passes = 1;
+
+	ns = calloc(samples, sizeof(*ns));
+	if (NULL == ns) die("could not allocate samples.");
+	allocs = ALLOCATIONS;
+	for (s = 0; s < samples; ++s) {
+		start = now_ns();
+		for (ops = bytes = p = 0; p < passes; ++p) ops += b->pass(&bytes);
+		taken = now_ns() - start;
+		ns[s] = ops ? taken / ops : 0;
+	}
+	r->allocs = ops ? (double)(ALLOCATIONS - allocs) / ((double)ops * samples) : 0;
+	r->mbps = taken > 0 ? bytes / taken * 1e3 : 0;  /* bytes/ns = GB/s */
+	qsort(ns, samples, sizeof(*ns), doublesort);
+	r->ns = ns[samples / 2];
+	for (s = 0; s < samples; ++s) deviation[s] = fabs(ns[s] - r->ns);
+	qsort(deviation, samples, sizeof(*deviation), doublesort);
+	r->spread = r->ns > 0 ? deviation[samples / 2] / r->ns * 100 : 0;
+	free(ns);
+}
+
+/* Baseline file format, one line per benchmark:
+ *	<name> <ns-per-op>\n
+ */
+static void
+read_baseline(char *file, struct result *results)
+{
+	FILE *f;
+	char name[64];
+	double ns;
+	size_t i;
+
+	f = fopen(file, "r");
+	if (NULL == f) return;
+	while (2 == fscanf(f, "%63s %lf", name, &ns))
+		for (i = 0; i < NBENCHES; ++i)
+			if (0 == strcmp(name, benches[i].name)) results[i].baseline = ns;
+	fclose(f);
+}
+
+static void
+write_baseline(char *file, struct result *results)
+{
+	FILE *f;
+	size_t i;
+
+	f = fopen(file, "w");
+	if (NULL == f) die("could not write baseline %s.", file);
+	for (i = 0; i < NBENCHES; ++i)
+		fprintf(f, "%s %.2f\n", benches[i].name, results[i].ns);
+	fclose(f);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct result results[MAX_BENCHES] = { { 0 } };
+	char *src = (char *)ARTICLES_MARKDOWN;
+	char *baseline = "./bench/microbench.baseline";
+	double slack = 10, change;
+	int samples = 15, regressions = 0, i;
+	bool record = false;
+	size_t b;
+
+	for (i = 1; i < argc; ++i) {
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0'
+		 || (argv[i][1] != 'w' && i + 1 == argc)) {
+			fprintf(stderr, "usage: %s [-s <src>] [-b <baseline>] [-t <percent>] "
+			                "[-r <samples>] [-w]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		switch (argv[i][1]) {
+		case 's': src = argv[++i]; break;
+		case 'b': baseline = argv[++i]; break;
+		case 't': slack = atof(argv[++i]); break;
+		case 'r': samples = atoi(argv[++i]); break;
+		case 'w': record = true; break;
+		}
+	}
+	if (samples < 1) samples = 1;
+	if (samples > 64) samples = 64;
+
+	setlocale(LC_COLLATE, "en_US.UTF-8");
+	setlocale(LC_ALL, "en_US.UTF-8");  /*< for iconv to transliterate */
+	load_inputs(src);
+	read_baseline(baseline, results);
+	if (0 != access(baseline, F_OK)) record = true;  /* first run */
+
+	printf("%-18s %10s %6s %10s %10s %10s %8s\n",
+		"benchmark", "ns/op", "±%", "MB/s", "allocs/op", "baseline", "change");
+	for (b = 0; b < NBENCHES; ++b) {
+		run_bench(&benches[b], samples, &results[b]);
+		printf("%-18s %10.1f %6.1f %10.1f %10.2f",
+			benches[b].name, results[b].ns, results[b].spread,
+			results[b].mbps, results[b].allocs);
+		if (results[b].baseline > 0) {
+			change = (results[b].ns / results[b].baseline - 1) * 100;
+			printf(" %10.1f %+7.1f%%", results[b].baseline, change);
+			if (!record && change > slack) {
+				printf("  REGRESSION");
+				++regressions;
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	unlink(cachefile);
+	unlink(dumpfile);
+	unlink(logfile);
+	if (record) {
+		write_baseline(baseline, results);
+		printf("recorded baseline %s.\n", baseline);
+		return EXIT_SUCCESS;
+	}
+	if (regressions > 0) {
+		printf("%d benchmarks more than %.0f%% slower than %s.\n",
+			regressions, slack, baseline);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -11,38 +11,42 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <inttypes.h>
 
-/* Build cache file format:
+/* Build cache file format, a log of records, each followed by
+ *	#<fnv1a-64-hex of the record>\n
+ * a record being either a head
+ *	@<head-commit>\n
+ * a recipe
  *	<slug>:\n
  *	\t<modified-epoch>\n
  *	\t<title>\n
  *	\t<tags>\n
  *	\t<author-name>\n
- *	\t<rfc2822-added-date>\n
- *	\t<rfc2822-modified-date>\n
- * Format is repeated though the file for each recipe.
+ *	\t<added-epoch> <+hhmm>\n
+ *	\t<modified-epoch> <+hhmm>\n
+ * or a recipe's deletion
+ *	-<slug>\n
+ * records are only ever appended, the last one for a recipe (or the
+ * last head) wins. the head commit is what the git metadata was last
+ * brought up to date with.
+ * the log is read up to the first record whose checksum doesn't match,
+ * which is where a crash stopped writing it. caches from before the log
+ * (no checksums), or with rfc 2822 dates, are still read, and rewritten.
  */
 
-static const char SCAN_CACHE_ENTRY[] = {
-	"%[^:]%*[^\n]%*c" /* 1 |            slug */
-	"\t%lu%*c"        /* 2 |           epoch */
-	"\t%[^\n]%*c"     /* 3 |           title */
-	"\t%[^\n]%*c"     /* 4 |            tags */
-	"\t%[^\n]%*c"     /* 5 |          author */
-	"\t%[^\n]%*c"     /* 6 | rfc-2822 A-date */
-	"\t%[^\n]%*c"     /* 7 | rfc-2822 M-date */
-};
-
-
 static const char FMT_CACHE_ENTRY[] = {
 	"%s:\n"      /*            slug */
 	"\t%lu\n"    /*           epoch */
 	"\t%s\n"     /*           title */
 	"\t%s\n"     /*            tags */
 	"\t%s\n"     /*          author */
-	"\t%s\n"     /* rfc-2822 A-date */
-	"\t%s\n"     /* rfc-2822 M-date */
+	"\t%s\n"     /*          A-date */
+	"\t%s\n"     /*          M-date */
 };
+static const char FMT_CACHE_HEAD[]   = "@%s\n";
+static const char FMT_CACHE_DELETE[] = "-%s\n";
+static const char FMT_CACHE_SUM[]    = "#%016" PRIx64 "\n";
 
 /* build cache populates `struct md` recipe entries with everything
  * except the html.
@@ -50,13 +54,24 @@ static const char FMT_CACHE_ENTRY[] = {
  * the RSS and Atom feeds, so source files must still be read and parsed.
  */
 
-/* recipe slugs should be added alphabetically with scandir.
- * this is necessary for concurrent traversal of the directory
- * listing along with the cache entries.
- * this avoids having to implement a binary search or a hash-
- * table to find cache entries.
+/* the cache entries and the directory listing are both in slug order,
+ * so they are walked together as a merge-join:
+ *	join_cache() steps the cursor past entries with slugs sorting
+ *	before the recipe, those files were deleted (or renamed),
+ *	and returns the entry with a matching slug, if any.
+ *	keep_cache() or store_cache() then appends the valid entry
+ *	to the index, which dump_cache() compares with the log, appending
+ *	what changed.
+ * every entry is visited once, and only pointers are moved.
  */
 
+/* a recipe record of the log, in the order it was logged */
+struct record {
+	struct md entry;  /* just the slug, for a deletion */
+	uint64_t sum;     /* of the recipe's record, 0 for a deletion */
+	size_t seq;
+};
+
 void
 init_cache(struct cache *c, char *filename)
 {
@@ -71,133 +86,336 @@ init_cache(struct cache *c, char *filename)
 	strcpy(c->filename, filename);
 
 	c->entries = calloc(MAX_RECIPES, sizeof(struct md));
-	if (NULL == c->entries) die("failed to allocate cache.");
-	c->size = 0;
+	c->sums    = calloc(MAX_RECIPES, sizeof(uint64_t));
+	c->fresh   = calloc(MAX_RECIPES, sizeof(struct md));
+	c->index   = calloc(MAX_RECIPES, sizeof(struct md *));
+	if (NULL == c->entries || NULL == c->sums
+	 || NULL == c->fresh   || NULL == c->index)
+		die("failed to allocate cache.");
+	c->size = c->cursor = 0;
+	c->logged = c->records = 0;
+	c->compact = false;
+	c->freshcount = 0;
 	c->count = 0;
 }
 
+/* a recipe's record, returning its length */
+static size_t
+format_entry(char *dst, size_t n, struct md *entry)
+{
+	char tags[TAG_COUNT * TAG_NAME_LEN] = { 0 };  /*< space separated */
+	char adate[GITDATE_LEN], mdate[GITDATE_LEN];
+
+	if (entry->tags[0][0] != '\0') string_from_tags(tags, entry->tags);
+	return snprintf(dst, n, FMT_CACHE_ENTRY, entry->slug,
+		entry->mtime,
+		entry->title,
+		tags,
+		entry->author,
+		format_gitdate(adate, &entry->added),
+		format_gitdate(mdate, &entry->modified));
+}
+
+static uint64_t
+entry_sum(struct md *entry)
+{
+	char record[sizeof(struct md) + 64];
+	size_t len = format_entry(record, sizeof(record), entry);
+	return hash_bytes(record, len < sizeof(record) ? len : sizeof(record) - 1, HASH_SEED);
+}
+
+static void
+copy_field(char *dst, size_t n, const char *src, size_t len)
+{
+	if (len >= n) len = n - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+/* reads a date field, false if it's an rfc 2822 date */
+static bool
+read_date(struct gitdate *date, const char *src, size_t len)
+{
+	char field[GITDATE_LEN];
+
+	copy_field(field, sizeof(field), src, len);
+	parse_gitdate(date, field);
+	return '\0' == field[0] || ('0' <= field[0] && field[0] <= '9');
+}
+
+/* reads the recipe record at `p` into `entry`, which must be zeroed.
+ * returns the end of the record, or NULL if it's cut short.
+ * `olddates` is set if its dates are in the old rfc 2822 form. */
+static char *
+read_entry(char *p, char *end, struct md *entry, bool *olddates)
+{
+	char tags[TAG_COUNT * TAG_NAME_LEN];  /*< space separated */
+	char *field[7], *nl;
+	size_t len[7];
+	int k;
+
+	for (k = 0; k < 7; ++k) {
+		nl = memchr(p, '\n', end - p);
+		if (NULL == nl) return NULL;
+		if (k > 0 && *p++ != '\t') return NULL;
+		field[k] = p;
+		len[k] = nl - p;
+		p = nl + 1;
+	}
+	if (len[0] == 0 || field[0][len[0] - 1] != ':') return NULL;
+	copy_field(entry->slug,   sizeof(entry->slug),   field[0], len[0] - 1);
+	entry->mtime = strtoul(field[1], NULL, 10);  /* performs implicit cast */
+	copy_field(entry->title,  sizeof(entry->title),  field[2], len[2]);
+	copy_field(tags,          sizeof(tags),          field[3], len[3]);
+	copy_field(entry->author, sizeof(entry->author), field[4], len[4]);
+	if (!read_date(&entry->added,    field[5], len[5])) *olddates = true;
+	if (!read_date(&entry->modified, field[6], len[6])) *olddates = true;
+	tags_from_string(entry->tags, tags);
+	return p;
+}
+
+static int
+recordsort(const void *_a, const void *_b)
+{
+	const struct record *a = _a, *b = _b;
+	int cmp = strcoll(a->entry.slug, b->entry.slug);
+
+	if (cmp != 0) return cmp;
+	return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+/* replays the log into `entries`, in slug order. */
 void
 parse_cache(struct cache *c)
 {
-	char tags[TAG_COUNT * TAG_NAME_LEN] = { 0 };  /*< space separated */
-	long unsigned epoch;
-	int assigns;
-	struct md *entry;
-	/* cache file is first read in entirety, and walked through along with
-	 * the file listing in alphabetical (slug) order. as soon as a file is
-	 * missing form the cache (a new file) we insert_cache() it into that
-	 * location with the newly populated recipe (struct md), and offset all
-	 * other caches. walking may continue as previous.
-	 */
+	struct record *log = NULL, *r;
+	size_t capacity = 0, n = 0, i;
+	char *data, *p, *end, *body, *nl, *sumend;
+	char logged[COMMIT_LEN] = { 0 };
+	uint64_t sum;
+	bool legacy = false, olddates = false;
+	long size;
 
 	c->size = 0;
-	while (1) {
-		entry = &c->entries[c->size];
-		assigns = fscanf(c->file, SCAN_CACHE_ENTRY, entry->slug,
-			&epoch,
-			entry->title,
-			tags,
-			entry->author,
-			entry->adate,
-			entry->mdate);
-		/* a cache entry has 7 assignments */
-		if (7 != assigns) {
-			if (EOF == assigns) {
-				if (ferror(c->file)) die("failed to read cache.");
-			} else {
-				fprintf(stderr,
-					"corrupted cache file (%s). "
-					"missing %d variables in entry number %lu.\n",
-					c->filename, 7 - assigns, c->count + 1);
-				exit(EXIT_FAILURE);
-			}
-			break;  /* file finished */
+	c->head[0] = '\0';
+	fseek(c->file, 0, SEEK_END);
+	size = ftell(c->file);
+	if (size < 0) die("failed to read cache.");
+	rewind(c->file);
+	data = malloc(size + 1);
+	if (NULL == data) die("failed to allocate cache.");
+	if ((size_t)size != fread(data, 1, size, c->file)) die("failed to read cache.");
+	data[size] = '\0';
+
+	for (p = data, end = data + size; p < end; ++c->records) {
+		if (n == capacity) {
+			capacity = capacity ? capacity * 2 : MAX_RECIPES;
+			log = realloc(log, capacity * sizeof(*log));
+			if (NULL == log) die("failed to allocate cache.");
+		}
+		r = &log[n];
+		memset(r, 0, sizeof(*r));
+		body = p;
+		nl = memchr(p, '\n', end - p);
+		if (NULL == nl) {
+			p = NULL;
+		} else if (*p == '@') {
+			copy_field(logged, sizeof(logged), p + 1, nl - p - 1);
+			p = nl + 1;
+		} else if (*p == '-' && nl[-1] != ':') {
+			copy_field(r->entry.slug, sizeof(r->entry.slug), p + 1, nl - p - 1);
+			p = nl + 1;
+		} else {
+			p = read_entry(p, end, &r->entry, &olddates);
+		}
+		/* then its checksum, unless the whole file is from before the log.
+		 * a recipe's is kept, to tell if it changed */
+		if (NULL != p) r->sum = hash_bytes(body, p - body, HASH_SEED);
+		if (NULL != p && p < end && *p == '#' && !legacy) {
+			sum = strtoull(p + 1, &sumend, 16);
+			if (*sumend != '\n' || sum != r->sum)
+				p = NULL;
+			else
+				p = sumend + 1;
+		} else if (NULL != p && (legacy || c->records == 0)) {
+			legacy = true;
+		} else {
+			p = NULL;
+		}
+		if (NULL == p) {
+			fprintf(stderr, "cache %s damaged at byte %ld, "
+				"keeping the %lu records before it.\n",
+				c->filename, (long)(body - data), c->records);
+			c->compact = true;
+			break;
+		}
+		if (*body == '@') {
+			strcpy(c->head, logged);
+			continue;
 		}
-		else { ++c->size; }
+		if (*body == '-') r->sum = 0;
+		r->seq = n++;
+	}
+	if (legacy || olddates) c->compact = true;  /* into a log, of epochs */
+	strcpy(c->loggedhead, c->head);
+	free(data);
 
-		/* write in epoch and tags */
-		entry->mtime = epoch;  /* performs implicit cast */
-		tags_from_string(entry->tags, tags);
+	/* the last record of each recipe is current */
+	if (n > 0) qsort(log, n, sizeof(*log), recordsort);
+	for (i = 0; i < n; ++i) {
+		if (i + 1 < n && 0 == strcmp(log[i].entry.slug, log[i + 1].entry.slug))
+			continue;
+		if (log[i].sum == 0) continue;  /* deleted */
+		if (c->size == MAX_RECIPES)
+			die("more than %d recipes in cache %s.", MAX_RECIPES, c->filename);
+		c->entries[c->size] = log[i].entry;
+		c->sums[c->size++] = log[i].sum;
 	}
+	c->logged = c->size;
+	free(log);
 }
 
-struct md *
-next_cache(struct cache *c)
+static int
+slugcmp(const void *slug, const void *entry)
 {
-	++c->count;
-	if (c->count - 1 >= c->size)
-		return NULL;
-	return &c->entries[c->count - 1];
+	return strcoll(slug, ((struct md *)entry)->slug);
 }
 
+/* random access to parsed entries, which are in slug order */
 struct md *
-insert_cache(struct cache *c, struct md *entry)
+find_cache(struct cache *c, char *slug)
 {
-	/* insert above entry */
-	size_t tail;
-	struct md *blank;
+	return bsearch(slug, c->entries, c->size, sizeof(struct md), slugcmp);
+}
 
-	blank = c->entries + c->count - 1;
-	tail = c->size - c->count + 1;
+struct md *
+join_cache(struct cache *c, char *slug)
+{
+	int cmp;
 
-	/* if new entry comes after cached entry in the alphabet,
-	 * the cached entry must be a deleted file, and should
-	 * be itself deleted from the cache. */
-	if (blank->title[0] != '\0' && 0 < strcoll(entry->slug, blank->slug)) {
-		memcpy(blank, entry, sizeof(struct md));
-		return blank;  /* entry overwritten */
+	for (; c->cursor < c->size; ++c->cursor) {
+		cmp = strcoll(c->entries[c->cursor].slug, slug);
+		if (cmp > 0) break;  /* new file, entry belongs to a later recipe */
+		if (cmp == 0 && 0 == strcmp(c->entries[c->cursor].slug, slug))
+			return &c->entries[c->cursor++];
+		/* cmp < 0: no longer in the listing, dropped from the cache */
 	}
+	return NULL;
+}
+
+/* cached entry is still valid */
+void
+keep_cache(struct cache *c, struct md *entry)
+{
+	c->index[c->count++] = entry;
+}
 
-	/* offset tail of array leaving a blank entry above */
-	memmove(blank + 1, blank, tail * sizeof(struct md));
-	/* fill in blank */
-	memcpy(blank, entry, sizeof(struct md));
+/* new or modified recipe, copied since `entry` belongs to the parser */
+void
+store_cache(struct cache *c, struct md *entry)
+{
+	struct md *copy = &c->fresh[c->freshcount++];
+	memcpy(copy, entry, sizeof(struct md));
+	copy->html = NULL;
+	c->index[c->count++] = copy;
+}
 
-	++c->size;
+static void
+log_record(FILE *f, const char *record, size_t len)
+{
+	fwrite(record, 1, len, f);
+	fprintf(f, FMT_CACHE_SUM, hash_bytes(record, len, HASH_SEED));
+}
 
-	return blank;
+static void
+log_entry(FILE *f, struct md *entry)
+{
+	char record[sizeof(struct md) + 64];
+	size_t len = format_entry(record, sizeof(record), entry);
+	log_record(f, record, len < sizeof(record) ? len : sizeof(record) - 1);
 }
 
-struct md *
-update_cache(struct cache *c, struct md *entry)
+static void
+log_head(FILE *f, char *head)
 {
-	struct md *current = c->entries + c->count - 1;
-	if (0 != strcmp(entry->slug, current->slug)) {
-		fprintf(stderr, "Tried to update a cache with non-matching filename.\n");
-		fprintf(stderr, "\t%s != %s\n", current->slug, entry->slug);
-		exit(EXIT_FAILURE);
-	}
-	/* overwrite */
-	memcpy(current, entry, sizeof(struct md));
-	return current;
+	char record[COMMIT_LEN + 4];
+	if (head[0] != '\0')
+		log_record(f, record, sprintf(record, FMT_CACHE_HEAD, head));
 }
 
+/* appends the entries of the index which are new or changed, and the
+ * deletion of those no longer in it, to the log. the log is rewritten
+ * with just the index instead, when it holds more than
+ * CACHE_COMPACTION times as many records, or couldn't be read whole.
+ */
 void
 dump_cache(struct cache *c)
 {
-	char tags[TAG_COUNT * TAG_NAME_LEN] = { 0 };  /*< space separated */
-	size_t i;
+	char record[SLUG_LEN + 4];
+	char *data;
+	size_t size, i, appended = 0;
 	struct md *entry;
+	bool *kept;
+	FILE *f;
 
-	/* overwrite cache */
-	ftruncate(fileno(c->file), 0);
-	rewind(c->file);
-	for (i = 0; i < c->size; ++i) {
-		entry = &c->entries[i];
-
-		string_from_tags(tags, entry->tags);
-
-		fprintf(c->file, FMT_CACHE_ENTRY, entry->slug,
-			entry->mtime,
-			entry->title,
-			tags,
-			entry->author,
-			entry->adate,
-			entry->mdate);
+	f = open_memstream(&data, &size);
+	kept = calloc(c->size + 1, sizeof(bool));
+	if (NULL == f || NULL == kept) die("failed to allocate cache.");
+	/* history was rewritten, and the cache emptied */
+	if (c->size < c->logged) c->compact = true;
+
+	if (!c->compact) {
+		if (0 != strcmp(c->head, c->loggedhead)) {
+			log_head(f, c->head);
+			++appended;
+		}
+		for (i = 0; i < c->count; ++i) {
+			entry = find_cache(c, c->index[i]->slug);
+			if (NULL != entry) {
+				kept[entry - c->entries] = true;
+				if (c->sums[entry - c->entries] == entry_sum(c->index[i]))
+					continue;
+			}
+			log_entry(f, c->index[i]);
+			++appended;
+		}
+		for (i = 0; i < c->size; ++i) {
+			if (kept[i]) continue;
+			log_record(f, record, snprintf(record, sizeof(record),
+				FMT_CACHE_DELETE, c->entries[i].slug));
+			++appended;
+		}
+		c->compact = c->records + appended > CACHE_COMPACTION * (c->count + 1);
+	}
+	if (c->compact) {
+		/* start over, with the index alone */
+		fclose(f);
+		free(data);
+		f = open_memstream(&data, &size);
+		if (NULL == f) die("failed to allocate cache.");
+		log_head(f, c->head);
+		for (i = 0; i < c->count; ++i)
+			log_entry(f, c->index[i]);
+	}
+	fflush(f);
+
+	if (c->compact) {
+		if (!write_atomic(c->filename, data, size))
+			die("failed to write cache %s.", c->filename);
+	} else if (size > 0) {
+		if (0 != fseek(c->file, 0, SEEK_END)
+		 || size != fwrite(data, 1, size, c->file))
+			die("failed to append to cache %s.", c->filename);
 	}
 
+	fclose(f);
+	free(data);
+	free(kept);
 	fclose(c->file);
 	free(c->entries);
+	free(c->sums);
+	free(c->fresh);
+	free(c->index);
 }
 
 #endif  /* GIT_INTEGRATION */
@@ -1,16 +1,35 @@
 #include "config.h"
 #include "md.h"
+#include <stdint.h>
+#include <stdbool.h>
 
 struct cache {
 	FILE *file;
 	char filename[PATH_LEN];
-	size_t size, count;
+	/* commit the cached git metadata reflects, empty if unknown */
+	char head[COMMIT_LEN];
+	/* the head as logged, a new one is appended */
+	char loggedhead[COMMIT_LEN];
+	/* entries replayed from the cache log, and the merge cursor */
+	size_t size, cursor;
 	struct md *entries;
+	/* checksums of the entries' records, unchanged ones aren't logged again */
+	uint64_t *sums;
+	size_t logged;   /* entries replayed */
+	size_t records;  /* records in the log, replaced ones included */
+	bool compact;    /* rewrite the log, rather than append to it */
+	/* newly generated recipes, copied out of the parser */
+	size_t freshcount;
+	struct md *fresh;
+	/* entries to be written back, in slug order */
+	size_t count;
+	struct md **index;
 };
 
 void init_cache(struct cache *, char *);
 void parse_cache(struct cache *);
-struct md *next_cache(struct cache *);
-struct md *insert_cache(struct cache *, struct md *);
-struct md *update_cache(struct cache *, struct md *);
+struct md *find_cache(struct cache *, char *);
+struct md *join_cache(struct cache *, char *);
+void keep_cache(struct cache *, struct md *);
+void store_cache(struct cache *, struct md *);
 void dump_cache(struct cache *);
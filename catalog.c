@@ -0,0 +1,375 @@
+/* a catalog of every recipe, for apps that would otherwise scrape
+ * every page: its slug, title, tags (as ids into the tag list), dates,
+ * author, images, and where its <main> is in its page, for fetching
+ * just the recipe with a range request.
+ * catalog.json has it all, minified. catalog.bin has the same for
+ * mmap: fixed size records, an index of them sorted by slug to binary
+ * search, and one table of strings.
+ * a page is only read back for its images and offsets when it was
+ * written by this build, any other recipe's come from the previous
+ * catalog.bin.
+ */
+#include "config.h"
+
+#if CATALOG
+
+#include "catalog.h"
+#include "output.h"
+#include "prof.h"
+
+/* Binary catalog format, little endian:
+ *	"BCAT" <version> <recipes> <tags> <lists> <strings-size> 0 0
+ *	<recipes> x record, in slug order as listed
+ *	<recipes> x <record-offset>, sorted by strcmp() of the slugs
+ *	<tags> x <name>, a tag's id is its position in this table
+ *	<lists> x <tag-id or image>
+ *	<strings-size> bytes of strings
+ * a record is
+ *	<added> <updated> <slug> <title> <author> <tags> <tag-count>
+ *	<images> <image-count> <html-offset> <html-length> 0
+ * dates are 64 bit seconds since the epoch, every other number is
+ * 32 bit. strings (names, slugs, titles, authors and images) are
+ * offsets into the strings, which are each NUL terminated. <tags> and
+ * <images> index the lists. record offsets are from the start of the
+ * file, and records are 8 byte aligned.
+ */
+static const char MAGIC[4] = { 'B', 'C', 'A', 'T' };
+#define VERSION 1
+#define HEADER_SIZE 32
+#define RECORD_SIZE 56
+/* fields of a record, by byte offset */
+enum {
+	R_ADDED = 0, R_UPDATED = 8, R_SLUG = 16, R_TITLE = 20, R_AUTHOR = 24,
+	R_TAGS = 28, R_TAGCOUNT = 32, R_IMAGES = 36, R_IMAGECOUNT = 40,
+	R_OFFSET = 44, R_LENGTH = 48
+};
+
+/* the previous catalog.bin, checked through once it's read */
+static struct {
+	char *data;
+	uint32_t recipes;
+	const unsigned char *index;
+	const unsigned char *lists;
+	const char *strings;
+} previous;
+
+static uint32_t
+get_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8
+	     | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void
+put_le32(unsigned char *p, uint32_t n)
+{
+	p[0] = n;
+	p[1] = n >> 8;
+	p[2] = n >> 16;
+	p[3] = n >> 24;
+}
+
+static void
+put_le64(unsigned char *p, int64_t n)
+{
+	put_le32(p, (uint64_t)n);
+	put_le32(p + 4, (uint64_t)n >> 32);
+}
+
+/* loads `dst`/catalog.bin, ignored unless every offset in it is sound */
+void
+catalog_open(char *dst)
+{
+	char file[PATH_LEN * 2];
+	const unsigned char *p, *rec;
+	uint32_t h[7], i, n, off, lists;
+	size_t size, records;
+
+	memset(&previous, 0, sizeof(previous));
+	if (streaming) return;
+	snprintf(file, sizeof(file), "%s/%s", dst, CATALOG_BIN_FILE);
+	if (NULL == (previous.data = read_file(file, &size))) return;
+	p = (const unsigned char *)previous.data;
+	if (size < HEADER_SIZE || 0 != memcmp(p, MAGIC, sizeof(MAGIC)))
+		goto bad;
+	for (i = 0; i < 7; ++i) h[i] = get_le32(p + 4 + 4 * i);
+	records = (size_t)h[1] * RECORD_SIZE;
+	if (VERSION != h[0] || 0 == h[4] || size != HEADER_SIZE + records
+	    + 4 * ((size_t)h[1] + h[2] + h[3]) + h[4])
+		goto bad;
+	previous.recipes = h[1];
+	previous.index   = p + HEADER_SIZE + records;
+	previous.lists   = previous.index + 4 * ((size_t)h[1] + h[2]);
+	previous.strings = (const char *)previous.lists + 4 * (size_t)h[3];
+	if ('\0' != previous.strings[h[4] - 1]) goto bad;
+	lists = h[3];
+	for (i = 0; i < previous.recipes; ++i) {
+		off = get_le32(previous.index + 4 * i);
+		if (off < HEADER_SIZE || off >= HEADER_SIZE + records
+		 || 0 != (off - HEADER_SIZE) % RECORD_SIZE)
+			goto bad;
+		rec = p + off;
+		if (get_le32(rec + R_SLUG) >= h[4]
+		 || get_le32(rec + R_IMAGES) > lists
+		 || get_le32(rec + R_IMAGECOUNT) > lists - get_le32(rec + R_IMAGES))
+			goto bad;
+		for (n = 0; n < get_le32(rec + R_IMAGECOUNT); ++n)
+			if (get_le32(previous.lists + 4 * (get_le32(rec + R_IMAGES) + n)) >= h[4])
+				goto bad;
+	}
+	return;
+bad:
+	fprintf(stderr, "warning: ignoring malformed %s.\n", file);
+	free(previous.data);
+	memset(&previous, 0, sizeof(previous));
+}
+
+/* copies the images and offsets `slug` had in the previous catalog */
+static bool
+reuse(struct catalogentry *entry, const char *slug)
+{
+	const unsigned char *rec;
+	const char *image;
+	uint32_t lo = 0, hi = previous.recipes, mid, i, n;
+	size_t len = 0;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		rec = (const unsigned char *)previous.data
+		    + get_le32(previous.index + 4 * mid);
+		cmp = strcmp(slug, previous.strings + get_le32(rec + R_SLUG));
+		if (cmp < 0)      hi = mid;
+		else if (cmp > 0) lo = mid + 1;
+		else goto found;
+	}
+	return false;
+found:
+	entry->images[0] = '\0';
+	i = get_le32(rec + R_IMAGES);
+	for (n = get_le32(rec + R_IMAGECOUNT); n > 0; --n, ++i) {
+		image = previous.strings + get_le32(previous.lists + 4 * i);
+		if (len + strlen(image) + 2 > sizeof(entry->images)) break;
+		len += sprintf(entry->images + len, "%s%s", 0 == len ? "" : " ", image);
+	}
+	entry->offset = get_le32(rec + R_OFFSET);
+	entry->length = get_le32(rec + R_LENGTH);
+	return true;
+}
+
+/* reads the images and the offsets of <main> from a written page */
+static void
+scan_page(struct catalogentry *entry, const char *page)
+{
+	char *data, *main, *end, *img, *tagend, *src;
+	size_t len = 0, n;
+
+	entry->images[0] = '\0';
+	entry->offset = entry->length = 0;
+	if (NULL == (data = read_file(page, NULL))) return;
+	main = strstr(data, "<main>");
+	end = NULL != main ? strstr(main, "</main>") : NULL;
+	if (NULL == end) {
+		free(data);
+		return;
+	}
+	end += strlen("</main>");
+	entry->offset = main - data;
+	entry->length = end - main;
+	*end = '\0';
+	for (img = main; NULL != (img = strstr(img, "<img ")); img = tagend) {
+		if (NULL == (tagend = strchr(img, '>'))) break;
+		src = strstr(img, " src=\"");
+		if (NULL == src || src > tagend) continue;
+		src += strlen(" src=\"");
+		n = strcspn(src, "\"");
+		if (len + n + 2 > sizeof(entry->images)) break;
+		len += sprintf(entry->images + len, "%s%.*s",
+		               0 == len ? "" : " ", (int)n, src);
+	}
+	free(data);
+}
+
+/* notes what the catalog has on the recipe `slug`, by `author`, with
+ * the page `page`. `written` if the page was written by this build. */
+void
+catalog_note(struct catalogentry *entry, const char *slug,
+             const char *author, const char *page, bool written)
+{
+	snprintf(entry->author, sizeof(entry->author), "%s", author);
+	if (!written && reuse(entry, slug)) return;
+	if (streaming) {
+		/* nothing to read back, a stream has no pages on disk */
+		entry->images[0] = '\0';
+		entry->offset = entry->length = 0;
+		return;
+	}
+	scan_page(entry, page);
+}
+
+static uint32_t
+put_string(FILE *strs, const char *s)
+{
+	uint32_t off = ftell(strs);
+	fwrite(s, 1, strlen(s) + 1, strs);
+	return off;
+}
+
+static void
+put_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; '\0' != *s; ++s) {
+		if ('"' == *s || '\\' == *s) fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+		else fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static const char *sortslugs;
+static size_t sortstride;
+
+static int
+slugcmp(const void *a, const void *b)
+{
+	return strcmp(sortslugs + *(const uint32_t *)a * sortstride,
+	              sortslugs + *(const uint32_t *)b * sortstride);
+}
+
+/* writes the catalog of the `count` recipes in `recipes`, with their
+ * feed `entries` and catalog `entries`, all in the same order. */
+void
+write_catalog(char *dst, struct taglist *tags, struct recipelist *recipes,
+              struct feedentry *feeds, struct catalogentry *entries, size_t count)
+{
+	char file[PATH_LEN * 2], *strbuf = NULL, *image, *next;
+	char images[CATALOG_IMAGES_LEN];
+	const char **tagnames, **authornames;
+	struct taglist *tag;
+	unsigned char *records, *p, header[HEADER_SIZE] = { 0 };
+	uint32_t *order, *authoroff, *lists, ntags, nlists = 0, nauthors = 0;
+	uint32_t ids[TAG_COUNT], nids, nimages;
+	size_t strsize, i, j, t;
+	FILE *f, *json, *strs;
+
+	for (ntags = 0, tag = tags; NULL != tag; tag = tag->next) ++ntags;
+	tagnames    = malloc((ntags + 1) * sizeof(*tagnames));
+	authornames = malloc((count + 1) * sizeof(*authornames));
+	authoroff   = malloc((count + 1) * sizeof(*authoroff));
+	order       = malloc((count + 1) * sizeof(*order));
+	records     = calloc(count + 1, RECORD_SIZE);
+	lists = malloc((ntags + count * (TAG_COUNT + CATALOG_IMAGES_LEN / 2) + 1)
+	               * sizeof(*lists));
+	strs = open_memstream(&strbuf, &strsize);
+	if (NULL == tagnames || NULL == authornames || NULL == authoroff
+	 || NULL == order || NULL == records || NULL == lists || NULL == strs)
+		die("could not allocate the catalog.");
+	put_string(strs, "");  /* offset 0, for empty strings */
+
+	sprintf(file, "%s/%s", dst, CATALOG_JSON_FILE);
+	json = output_open(file);
+	if (NULL == json) die("failed to open %s for writing.", file);
+	/* tag names lead the lists, as the tag table */
+	fprintf(json, "{\"tags\":[");
+	for (t = 0, tag = tags; NULL != tag; tag = tag->next, ++t) {
+		tagnames[t] = tag->name;
+		lists[nlists++] = put_string(strs, tag->name);
+		fprintf(json, "%s", 0 == t ? "" : ",");
+		put_json_string(json, tag->name);
+	}
+	fprintf(json, "],\"recipes\":[");
+
+	for (i = 0; i < count; ++i) {
+		p = records + i * RECORD_SIZE;
+		order[i] = i;
+		/* tags, by id */
+		for (nids = 0; nids < TAG_COUNT && '\0' != recipes[i].tags[nids][0]; ++nids) {
+			for (t = 0; t < ntags && 0 != strcmp(tagnames[t], recipes[i].tags[nids]); ++t);
+			ids[nids] = t;
+		}
+		/* authors are few, they're stored once each */
+		for (j = 0; j < nauthors && 0 != strcmp(authornames[j], entries[i].author); ++j);
+		if (j == nauthors) {
+			authornames[nauthors] = entries[i].author;
+			authoroff[nauthors++] = '\0' == entries[i].author[0]
+				? 0 : put_string(strs, entries[i].author);
+		}
+
+		put_le64(p + R_ADDED,   feeds[i].added.epoch);
+		put_le64(p + R_UPDATED, feeds[i].updated.epoch);
+		put_le32(p + R_SLUG,   put_string(strs, feeds[i].slug));
+		put_le32(p + R_TITLE,  put_string(strs, recipes[i].title));
+		put_le32(p + R_AUTHOR, authoroff[j]);
+		put_le32(p + R_TAGS, nlists - ntags);
+		put_le32(p + R_TAGCOUNT, nids);
+		for (t = 0; t < nids; ++t) lists[nlists++] = ids[t];
+		put_le32(p + R_OFFSET, entries[i].offset);
+		put_le32(p + R_LENGTH, entries[i].length);
+
+		fprintf(json, "%s{\"slug\":", 0 == i ? "" : ",");
+		put_json_string(json, feeds[i].slug);
+		fprintf(json, ",\"title\":");
+		put_json_string(json, recipes[i].title);
+		fprintf(json, ",\"tags\":[");
+		for (t = 0; t < nids; ++t)
+			fprintf(json, "%s%u", 0 == t ? "" : ",", ids[t]);
+		fprintf(json, "],\"added\":%lld,\"updated\":%lld,\"author\":",
+		        (long long)feeds[i].added.epoch, (long long)feeds[i].updated.epoch);
+		put_json_string(json, entries[i].author);
+		fprintf(json, ",\"images\":[");
+
+		put_le32(p + R_IMAGES, nlists - ntags);
+		strcpy(images, entries[i].images);
+		for (nimages = 0, image = images; '\0' != *image; image = next, ++nimages) {
+			next = image + strcspn(image, " ");
+			if ('\0' != *next) *next++ = '\0';
+			lists[nlists++] = put_string(strs, image);
+			fprintf(json, "%s", 0 == nimages ? "" : ",");
+			put_json_string(json, image);
+		}
+		put_le32(p + R_IMAGECOUNT, nimages);
+		fprintf(json, "],\"html\":[%u,%u]}", entries[i].offset, entries[i].length);
+	}
+	fprintf(json, "]}\n");
+	prof_bytes(PHASE_CATALOG, output_close(json));
+	fflush(strs);
+
+	/* the index, by byte order of the slugs for any reader's strcmp() */
+	sortslugs = feeds[0].slug;
+	sortstride = sizeof(*feeds);
+	qsort(order, count, sizeof(*order), slugcmp);
+	for (i = 0; i < count; ++i)
+		put_le32((unsigned char *)&order[i], HEADER_SIZE + order[i] * RECORD_SIZE);
+	for (i = 0; i < nlists; ++i)
+		put_le32((unsigned char *)&lists[i], lists[i]);
+
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	put_le32(header + 4,  VERSION);
+	put_le32(header + 8,  count);
+	put_le32(header + 12, ntags);
+	put_le32(header + 16, nlists - ntags);
+	put_le32(header + 20, strsize);
+	sprintf(file, "%s/%s", dst, CATALOG_BIN_FILE);
+	f = output_open(file);
+	if (NULL == f) die("failed to open %s for writing.", file);
+	fwrite(header, 1, sizeof(header), f);
+	fwrite(records, RECORD_SIZE, count, f);
+	fwrite(order, sizeof(*order), count, f);
+	fwrite(lists, sizeof(*lists), nlists, f);
+	fwrite(strbuf, 1, strsize, f);
+	prof_bytes(PHASE_CATALOG, output_close(f));
+
+	fclose(strs);
+	free(strbuf);
+	free(tagnames);
+	free(authornames);
+	free(authoroff);
+	free(order);
+	free(records);
+	free(lists);
+	free(previous.data);
+	memset(&previous, 0, sizeof(previous));
+}
+
+#endif
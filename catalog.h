@@ -0,0 +1,26 @@
+/* catalog.json & catalog.bin: every recipe's metadata in one fetch */
+#ifndef _CATALOG_H
+#define _CATALOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "based.h"
+#include "rss.h"
+
+/* longest image list kept for a recipe, space separated */
+#define CATALOG_IMAGES_LEN 256
+
+/* what the catalog has on a recipe besides its list entry and dates */
+struct catalogentry {
+	char author[32];
+	char images[CATALOG_IMAGES_LEN];  /* page relative, space separated */
+	uint32_t offset, length;          /* of <main> in the recipe's page */
+};
+
+void catalog_open(char *);
+void catalog_note(struct catalogentry *, const char *, const char *, const char *, bool);
+void write_catalog(char *, struct taglist *, struct recipelist *,
+                   struct feedentry *, struct catalogentry *, size_t);
+
+#endif
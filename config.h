@@ -7,8 +7,96 @@
  */
 #define GIT_INTEGRATION 1
 
-/* fmt: unsigned int page_number */
-#define FMT_PAGE_FILE "page-%u.html"
+/* enabling the image pipeline reads the dimensions of every image a
+ * recipe references (for width/height and lazy-loading hints), and
+ * generates downscaled variants at IMAGE_WIDTHS for a srcset.
+ * variants are produced with IMAGE_RESIZE_PATH (cwebp), and are cached
+ * in the destination directory by content hash of the source image.
+ */
+#define IMAGE_PIPELINE 1
+
+/* write the first paginator page straight into index.html, instead of
+ * embedding page-1.html in an iframe. the other pages remain reachable
+ * through its page links, as stand-alone documents. */
+#define INLINE_FIRST_PAGE 1
+
+/* render recipes with the built-in markdown engine (render.c), which
+ * expands {metric,imperial} units as it goes. recipes using markdown it
+ * doesn't know are still rendered by discount, as is index.md.
+ * `based -X` checks that both engines agree on every recipe. */
+#define BUILTIN_MARKDOWN 1
+
+/* list the recipes most alike each recipe (by their tags) at the
+ * end of its page, how many, 0 for none. see related.c */
+#define RELATED_RECIPES 5
+
+/* write a trigram search index of recipe titles & tags, for fuzzy
+ * lookups (based -Q) and server-side search. see search.c */
+#define SEARCH_INDEX 1
+/* most hits a search returns */
+#define SEARCH_HITS 10
+
+/* the build cache is a log, appended to with the recipes that changed.
+ * it's rewritten with just the current ones once it holds this many
+ * times as many records. see cache.c */
+#define CACHE_COMPACTION 2
+
+/* write sitemap.xml, and a headers file giving every deployed file a
+ * strong etag (its content hash) and, for generated pages, the git
+ * date they last changed as last-modified. see sitemap.c */
+#define SITEMAP 1
+
+/* write catalog.json and catalog.bin, every recipe's slug, title, tags,
+ * dates, author, images and html offsets, for apps to fetch instead of
+ * scraping pages. see catalog.c */
+#define CATALOG 1
+
+/* list the recipes newest first, by date added in recent.html and by
+ * date last edited in updated.html, paginated by RECIPES_PER_PAGE.
+ * the dates are from git, see GIT_INTEGRATION. */
+#define DATE_PAGES 1
+
+/* copy the files at the top of the public directory, and the favicon,
+ * into the destination under names carrying their content hash
+ * (style.<hash>.css), and link those from every page. the headers file
+ * (written with SITEMAP, and also the last member of a `-d -` tarball)
+ * marks them immutable, so browsers never ask for them twice.
+ * see assets.c */
+#define FINGERPRINT_ASSETS 1
+
+/* write each tag's newest FEED_ENTRIES recipes (by date added) into
+ * @<tag>.rss & @<tag>.atom, linked from its tag page. a tag's feeds are
+ * only rewritten when their entries changed. */
+#define TAG_FEEDS 1
+
+/* read recipe sources ahead of rendering them, in batches submitted
+ * through io_uring (scan.c). off, or where io_uring isn't available,
+ * each source is stat'ed and read as it is rendered. */
+#define BATCHED_IO 1
+
+/* partial result of a sharded build (-S), kept in the destination
+ * directory until merged (-J). hidden, so it's never deployed.
+ * fmt: unsigned int shard, unsigned int shards */
+#define FMT_SHARD_FILE ".shard-%u-of-%u"
+
+/* paginator pages, the main one's have no prefix, a tag's `@<tag>-'.
+ * fmt: char *prefix, unsigned int page_number */
+#define FMT_PAGE_FILE "%spage-%u.html"
+/* recipes by date, the first page of each is `<name>.html', with any
+ * further pages named by FMT_PAGE_FILE with `<name>-' as prefix. */
+#define RECENT_PAGE  "recent"
+#define UPDATED_PAGE "updated"
+/* RFC 5005 archive documents, numbered oldest first.
+ * fmt: unsigned int archive_number */
+#define FMT_RSS_ARCHIVE_FILE  "rss-archive-%u.xml"
+#define FMT_ATOM_ARCHIVE_FILE "atom-archive-%u.xml"
+/* a tag's feeds, with TAG_FEEDS. fmt: char *tag */
+#define FMT_TAG_RSS_FILE  "@%s.rss"
+#define FMT_TAG_ATOM_FILE "@%s.atom"
+
+/* feeds embed only the first paragraph of each recipe, instead of
+ * the whole recipe html. */
+#define FEED_SUMMARY_ONLY 0
 
 static const char FMT_RFC2822[] = "%a, %d %b %Y %T %z";
 /* general formatting variables, all html is contained here */
@@ -20,9 +108,32 @@ static const char INDEX_MARKDOWN[]    = "./index.md";
 static const char ARTICLES_MARKDOWN[] = "./src";
 static const char ARTICLES_HTML[]     = "./blog";
 static const char CACHE_FILE[] = "./.buildcache";
+static const char PUBLIC_DIR[] = "./data";
+static const char MANIFEST_FILE[] = "./.manifest";
+static const char SEARCH_INDEX_FILE[] = "search.idx";
+static const char SITEMAP_FILE[] = "sitemap.xml";
+static const char HEADERS_FILE[] = "_headers";
+static const char CATALOG_JSON_FILE[] = "catalog.json";
+static const char CATALOG_BIN_FILE[]  = "catalog.bin";
+/* the recipes' date order as of the last build, see dates.c. kept in
+ * the destination directory, hidden so it's never deployed. */
+static const char DATE_INDEX_FILE[] = ".dateindex";
+/* what each tag's feeds were last written with, see rss.c */
+static const char TAG_FEEDS_FILE[] = ".tagfeeds";
+/* the asset names pages were last written with, kept next to the build
+ * cache. pages are all rewritten when they change. */
+static const char ASSETS_RECORD_SUFFIX[] = ".assets";
+static const char IMAGE_RESIZE_PATH[] = "/usr/bin/cwebp";
+/* downscaled image widths (px), in increasing order. */
+static const unsigned IMAGE_WIDTHS[] = { 300, 600 };
+/* rendered image width, must agree with `img` in style.css */
+static const char IMAGE_SIZES[] = "(max-width: 632px) 100vw, 600px";
 static const char RSS_FILE[]  = "rss.xml";
 static const char ATOM_FILE[] = "atom.xml";
 static const unsigned RECIPES_PER_PAGE = 50;
+/* newest recipes (by date added) in rss.xml & atom.xml, older recipes
+ * are paged into archive documents of this many entries. */
+static const unsigned FEED_ENTRIES = 20;
 static const char DESCRIPTION[] = {
 	"Only Based cooking. "
 	"No ads, no tracking, nothing but based cooking."
@@ -34,8 +145,13 @@ static const char FAVICON[] = {
 	"<text y=%221em%22 font-size=%2280%22>🍲</text>"
 	"</svg>"
 };
+/* the favicon as a file of its own, with FINGERPRINT_ASSETS */
+static const char FAVICON_FILE[] = "favicon.svg";
+/* in the public directory */
+static const char STYLE_SHEET[]      = "style.css";
+static const char PAGE_STYLE_SHEET[] = "page.css";
 
-/* fmt: char *page_title; char *desc; char *favicon */
+/* fmt: char *page_title; char *desc; char *favicon; char *style_sheet */
 static const char FMT_HTML_HEAD[] = {
 	"<!DOCTYPE html>\n"
 	"<html lang=\"en\">\n"
@@ -45,11 +161,12 @@ static const char FMT_HTML_HEAD[] = {
 	"	<title>%s</title>\n"
 	"	<meta name=\"description\" content=\"%s\">\n"
 	"	<link rel=\"icon\" href=\"%s\">\n"
-    "	<link rel=\"stylesheet\" href=\"./style.css\">\n"
+	"	<link rel=\"stylesheet\" href=\"./%s\">\n"
 };
 
+/* fmt: char *style_sheet */
 static const char FMT_HTML_PAGINATE_HEAD[] = {
-	"	<link rel=\"stylesheet\" href=\"./page.css\">\n"
+	"	<link rel=\"stylesheet\" href=\"./%s\">\n"
 };
 
 /* fmt: char *title */
@@ -66,11 +183,45 @@ static const char FMT_HTML_INDEX_HEADER[] = {
 	"	<p><i>Tags:\n"
 };
 
+/* links to the recipes by date, on the index */
+static const char HTML_INDEX_DATES[] = {
+	"	<p align=\"center\"><a href=\"./" RECENT_PAGE ".html\">Recently added</a> · "
+	"<a href=\"./" UPDATED_PAGE ".html\">Recently edited</a></p>\n"
+};
+
+/* fmt: char *heading */
+static const char FMT_HTML_DATES_HEADER[] = {
+	"	<h2>%s</h2>\n"
+	"	<ul id=\"artlist\">\n"
+};
+
+/* fmt: char *url; char *title; char *date */
+static const char FMT_HTML_DATES_ENTRY[] = {
+	"		<li>\n"
+	"			<a href=\"%s\">%s</a> <i>%s</i>\n"
+	"		</li>\n"
+};
+
 /* fmt: char *tag */
 static const char FMT_HTML_TAG_HEADER[] = {
 	"	<p><i>Filtering recipes tagged: <b>%s</b>\n"
 };
 
+/* a tag page's and its feeds' title. fmt: char *tag; char *page_title */
+static const char FMT_TAG_TITLE[] = "Recipes tagged %s – %s";
+
+/* fmt: char *tag; char *tag */
+static const char FMT_HTML_TAG_FEEDS_HEAD[] = {
+	"	<link rel=\"alternate\" type=\"application/rss+xml\" href=\"./" FMT_TAG_RSS_FILE "\">\n"
+	"	<link rel=\"alternate\" type=\"application/atom+xml\" href=\"./" FMT_TAG_ATOM_FILE "\">\n"
+};
+
+/* fmt: char *tag; char *tag */
+static const char FMT_HTML_TAG_FEEDS[] = {
+	"		(<a href=\"./" FMT_TAG_RSS_FILE "\">RSS</a>, "
+	"<a href=\"./" FMT_TAG_ATOM_FILE "\">atom</a>)\n"
+};
+
 static const char FMT_HTML_ARTICLE_HEADER[] = {
 	"	<main>\n"
 };
@@ -94,7 +245,7 @@ static const char FMT_HTML_INDEX_LIST_ENTRY[] = {
 	"		</li>\n"
 };
 
-/* fmt: unsigned int start_page */
+/* fmt: char *prefix, unsigned int start_page */
 static const char FMT_HTML_INDEX_PAGINATOR[] = {
 	"	</i></p>\n"             /* close off tags list */
 	"	<h2>Recipes</h2>\n"
@@ -107,11 +258,19 @@ static const char FMT_HTML_INDEX_PAGINATOR[] = {
 	"	</iframe>\n"
 };
 
+static const char FMT_HTML_INDEX_PAGES_START[] = {
+	"	</i></p>\n"             /* close off tags list */
+	"	<h2>Recipes</h2>\n"
+	"	<section id=\"recipes\">\n"
+};
+static const char FMT_HTML_INDEX_PAGES_END[] = {
+	"	</section>\n"
+};
 
 static const char FMT_HTML_PAGINATE_BAR_START[] = {
 	"	<div id=\"bar\">\n"
 };
-/* fmt: unsigned int page_number; char letter */
+/* fmt: char *prefix, unsigned int page_number; char letter */
 static const char FMT_HTML_PAGINATE_BAR_LINK[] = {
 	"		<a href=\"./" FMT_PAGE_FILE "\">[%c]</a>\n"
 };
@@ -145,7 +304,7 @@ static const char FMT_HTML_PAGINATE_PAGE_LINKS_END[] = {
 	"	</div>\n"
 };
 
-/* fmt: unsigned int page_number, page_number */
+/* fmt: char *prefix, unsigned int page_number, page_number */
 static const char FMT_HTML_PAGINATE_PAGE_LINK[] = {
 	"		<a href=\"./" FMT_PAGE_FILE "\">[%u]</a>\n"
 };
@@ -158,31 +317,40 @@ static const char FMT_HTML_PAGINATE_BUTTONS_END[] = {
 	"	</div>\n"
 };
 
-/* fmt: unsigned int page_number, page_number */
+/* fmt: char *prefix, unsigned int page_number, page_number */
 static const char FMT_HTML_PAGINATE_CURRENT_PAGE[] = {
 	"		<a id=\"thispage\" href=\"./" FMT_PAGE_FILE "\">[%u]</a>\n"
 };
 
-/* fmt: unsigned int page_number */
+/* fmt: char *prefix, unsigned int page_number */
 static const char FMT_HTML_PAGINATE_FIRST_BUTTON[] = {
 	"		<a href=\"./" FMT_PAGE_FILE "\"><button>&lt;&lt;</button></a>\n"
 };
 
-/* fmt: unsigned int page_number */
+/* fmt: char *prefix, unsigned int page_number */
 static const char FMT_HTML_PAGINATE_BACK_BUTTON[] = {
 	"		<a href=\"./" FMT_PAGE_FILE "\"><button>&lt;</button></a>\n"
 };
 
-/* fmt: unsigned int page_number */
+/* fmt: char *prefix, unsigned int page_number */
 static const char FMT_HTML_PAGINATE_NEXT_BUTTON[] = {
 	"		<a href=\"./" FMT_PAGE_FILE "\"><button>&gt;</button></a>\n"
 };
 
-/* fmt: unsigned int page_number */
+/* fmt: char *prefix, unsigned int page_number */
 static const char FMT_HTML_PAGINATE_LAST_BUTTON[] = {
 	"		<a href=\"./" FMT_PAGE_FILE "\"><button>&gt;&gt;</button></a>\n"
 };
 
+/* {metric,imperial} units sections, each closed by "</details>" */
+static const char HTML_UNITS_METRIC[] = {
+	"<details class=\"units\" id=\"metric\">"
+	"<summary>Metric Units</summary>\n"
+};
+static const char HTML_UNITS_IMPERIAL[] = {
+	"<details class=\"units\" id=\"imperial\" open>"
+	"<summary>US Customary Units</summary>\n"
+};
 static const char FMT_HTML_ARTICLE_END[] = {
 	"	<p><i>Recipe tags:\n"
 };
@@ -194,6 +362,17 @@ static const char FMT_HTML_ARTICLE_FOOTER[] = {
 	"	<p><i>Recipe posted on: %s, last edited on: %s, written by: %s</i></p>\n"
 };
 
+static const char FMT_HTML_RELATED_START[] = {
+	"	<p><i>Related recipes:\n"
+};
+/* fmt: char *slug; char *title */
+static const char FMT_HTML_RELATED_ENTRY[] = {
+	"		<a href=\"./%s.html\">%s</a>"
+};
+static const char FMT_HTML_RELATED_END[] = {
+	"\n	</i></p>\n"
+};
+
 static const char FMT_HTML_FOOTER[] = {
 	"	<footer>\n"
     "		<hr />\n"
@@ -213,12 +392,19 @@ static const char FMT_HTML_FOOTER[] = {
 
 #define PATH_LEN 256
 #define SLUG_LEN 128
+/* hex commit id, long enough for sha-256 repositories */
+#define COMMIT_LEN 65
 /* currently we have 249 recipes
- * increase MAX_RECIPES if we exceed that. */
+ * increase MAX_RECIPES if we exceed that.
+ * (may be overridden with -D, as `make bench` does.) */
+#ifndef MAX_RECIPES
 #define MAX_RECIPES 400
+#endif
 /* currently we have 129 (!) tags.
  * increase MAX_TAGS if we exceed that. */
+#ifndef MAX_TAGS
 #define MAX_TAGS 200
+#endif
 /* TITLE_LEN: maximum length (bytes) for a recipe title. */
 #define TITLE_LEN 64
 /* TAG_COUNT: maximum number of tags on one recipe.
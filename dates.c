@@ -0,0 +1,190 @@
+/* the recipes newest first, by date added (the feeds, recent.html)
+ * and by date last edited (updated.html).
+ * both orders are kept in the destination. the next build leaves every
+ * recipe whose date didn't change where it was, sorts just the new and
+ * changed ones, and merges the two, rather than sorting everything.
+ */
+#include "config.h"
+#include "dates.h"
+#include "output.h"
+
+/* Date index file format, a line per recipe in each order:
+ *	A<added-epoch> <slug>\n		newest added first, then
+ *	M<modified-epoch> <slug>\n	newest edited first
+ */
+static const char FMT_DATE_LINE[] = "%c%lld %s\n";
+
+struct dated {
+	time_t epoch;
+	const char *slug;
+	size_t i;  /* position in the feed entries */
+};
+
+/* newest first, ties broken by slug to keep documents reproducible */
+static int
+datedcmp(const void *_a, const void *_b)
+{
+	const struct dated *a = _a, *b = _b;
+	if (a->epoch != b->epoch)
+		return a->epoch < b->epoch ? 1 : -1;
+	return strcmp(a->slug, b->slug);
+}
+
+/* the feed entries by slug, open addressed */
+struct slugtable {
+	struct feedentry *entries;
+	size_t count, mask;
+	size_t *slots;  /* position + 1, 0 when empty */
+};
+
+static size_t
+slot(struct slugtable *t, const char *slug)
+{
+	return hash_bytes(slug, strlen(slug), HASH_SEED) & t->mask;
+}
+
+static void
+table_init(struct slugtable *t, struct feedentry *entries, size_t count)
+{
+	size_t size = 16, i, s;
+
+	while (size < 2 * count) size *= 2;
+	t->entries = entries;
+	t->count = count;
+	t->mask = size - 1;
+	t->slots = calloc(size, sizeof(*t->slots));
+	if (NULL == t->slots) die("could not allocate the date index.");
+	for (i = 0; i < count; ++i) {
+		for (s = slot(t, entries[i].slug); 0 != t->slots[s]; s = (s + 1) & t->mask);
+		t->slots[s] = i + 1;
+	}
+}
+
+/* position of `slug` in the entries, or their count if it's not there */
+static size_t
+table_find(struct slugtable *t, const char *slug)
+{
+	size_t s;
+
+	for (s = slot(t, slug); 0 != t->slots[s]; s = (s + 1) & t->mask)
+		if (0 == strcmp(t->entries[t->slots[s] - 1].slug, slug))
+			return t->slots[s] - 1;
+	return t->count;
+}
+
+static time_t
+date_of(struct feedentry *entry, bool edited)
+{
+	return edited ? entry->updated.epoch : entry->added.epoch;
+}
+
+/* merges the previous order `prev` with the entries that aren't in it,
+ * or whose date changed, into `order`. returns how many those were. */
+static size_t
+merge_order(size_t *order, struct dated *prev, size_t nprev,
+            struct slugtable *t, bool edited)
+{
+	struct dated *kept, *fresh, d;
+	bool *seen;
+	size_t nkept = 0, nfresh = 0, a, b, i, j;
+
+	kept  = malloc((t->count + 1) * sizeof(*kept));
+	fresh = malloc((t->count + 1) * sizeof(*fresh));
+	seen  = calloc(t->count + 1, sizeof(*seen));
+	if (NULL == kept || NULL == fresh || NULL == seen)
+		die("could not allocate the date index.");
+	for (j = 0; j < nprev; ++j) {
+		i = table_find(t, prev[j].slug);
+		if (i == t->count || seen[i] || date_of(&t->entries[i], edited) != prev[j].epoch)
+			continue;
+		d = (struct dated){ prev[j].epoch, t->entries[i].slug, i };
+		/* a file out of order is only trusted up to there */
+		if (nkept > 0 && datedcmp(&kept[nkept - 1], &d) >= 0) continue;
+		kept[nkept++] = d;
+		seen[i] = true;
+	}
+	for (i = 0; i < t->count; ++i)
+		if (!seen[i])
+			fresh[nfresh++] = (struct dated){
+				date_of(&t->entries[i], edited), t->entries[i].slug, i };
+	qsort(fresh, nfresh, sizeof(*fresh), datedcmp);
+
+	for (a = b = j = 0; j < t->count; ++j) {
+		if (b == nfresh || (a < nkept && datedcmp(&kept[a], &fresh[b]) < 0))
+			order[j] = kept[a++].i;
+		else
+			order[j] = fresh[b++].i;
+	}
+	free(kept);
+	free(fresh);
+	free(seen);
+	return nfresh;
+}
+
+/* orders the `count` feed `entries` by date, starting from the orders
+ * saved in `dst` by the last build, and saves the new ones. */
+void
+date_index(struct dateindex *ix, char *dst, struct feedentry *entries, size_t count)
+{
+	char file[PATH_LEN * 2], *data = NULL, *p, *nl, *sep, *buf = NULL;
+	struct dated *prev[2];
+	size_t nprev[2] = { 0, 0 }, lines = 0, size, i, k;
+	struct slugtable t;
+	FILE *f;
+	int which;
+
+	ix->count = count;
+	ix->added   = malloc((count + 1) * sizeof(*ix->added));
+	ix->updated = malloc((count + 1) * sizeof(*ix->updated));
+
+	/* the last build's orders, a stream has none */
+	snprintf(file, sizeof(file), "%s/%s", dst, DATE_INDEX_FILE);
+	if (!streaming) data = read_file(file, NULL);
+	for (p = data; NULL != p && NULL != (p = strchr(p, '\n')); ++p) ++lines;
+	prev[0] = malloc((lines + 1) * sizeof(**prev));
+	prev[1] = malloc((lines + 1) * sizeof(**prev));
+	if (NULL == ix->added || NULL == ix->updated || NULL == prev[0] || NULL == prev[1])
+		die("could not allocate the date index.");
+	for (p = data; NULL != p && '\0' != *p; p = nl + 1) {
+		if (NULL == (nl = strchr(p, '\n'))) break;
+		*nl = '\0';
+		which = 'A' == *p ? 0 : 'M' == *p ? 1 : -1;
+		if (-1 == which || NULL == (sep = strchr(p, ' ')))
+			continue;
+		*sep = '\0';
+		prev[which][nprev[which]++] = (struct dated){
+			strtoll(p + 1, NULL, 10), sep + 1, 0 };
+	}
+
+	table_init(&t, entries, count);
+	ix->moved[0] = merge_order(ix->added,   prev[0], nprev[0], &t, false);
+	ix->moved[1] = merge_order(ix->updated, prev[1], nprev[1], &t, true);
+	free(t.slots);
+	free(prev[0]);
+	free(prev[1]);
+	free(data);
+	if (streaming) return;
+
+	f = open_memstream(&buf, &size);
+	if (NULL == f) die("could not allocate the date index.");
+	for (i = 0; i < count; ++i) {
+		k = ix->added[i];
+		fprintf(f, FMT_DATE_LINE, 'A', (long long)entries[k].added.epoch, entries[k].slug);
+	}
+	for (i = 0; i < count; ++i) {
+		k = ix->updated[i];
+		fprintf(f, FMT_DATE_LINE, 'M', (long long)entries[k].updated.epoch, entries[k].slug);
+	}
+	fclose(f);
+	if (!write_atomic(file, buf, size)) die("failed to write %s.", file);
+	free(buf);
+}
+
+void
+date_index_free(struct dateindex *ix)
+{
+	free(ix->added);
+	free(ix->updated);
+	ix->added = ix->updated = NULL;
+	ix->count = 0;
+}
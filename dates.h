@@ -0,0 +1,22 @@
+/* recipes in date order, kept from one build to the next */
+#ifndef _DATES_H
+#define _DATES_H
+
+#include <stddef.h>
+#include "config.h"
+#include "based.h"
+#include "rss.h"
+
+/* positions in the feed entries, newest first */
+struct dateindex {
+	size_t *added;    /* by date added */
+	size_t *updated;  /* by date last edited */
+	size_t count;
+	/* of each order, entries sorted in rather than kept in place */
+	size_t moved[2];
+};
+
+void date_index(struct dateindex *, char *, struct feedentry *, size_t);
+void date_index_free(struct dateindex *);
+
+#endif
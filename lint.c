@@ -0,0 +1,291 @@
+/* recipe & picture linter, the same rules as the pull-request checks
+ * (.github/workflows/scripts/check-files.sh), without a process per file.
+ */
+#include "config.h"
+#include "lint.h"
+#include "based.h"
+
+#include <ctype.h>
+#include <strings.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define LINE_LENGTH 1024
+#define TAGS_PREFIX ";tags:"
+#define MIN_TAGS 2
+#define MAX_TAGS_PER_RECIPE 5
+#define PIX_SIZE_LIMIT 150000
+
+/* diagnostics are gcc-style, one per line:
+ *	<path>:<line>: <message>
+ * or, for problems with the file as a whole:
+ *	<path>: <message>
+ */
+static void
+report(FILE *out, char *path, unsigned line, char *fmt, ...)
+{
+	va_list args;
+	if (line) fprintf(out, "%s:%u: ", path, line);
+	else fprintf(out, "%s: ", path);
+	va_start(args, fmt);
+	vfprintf(out, fmt, args);
+	va_end(args);
+	fputc('\n', out);
+}
+
+/* names must be lower case, with words separated by hyphens. */
+static bool
+lint_name(FILE *out, char *path, char *dir, char *name)
+{
+	char should[PATH_LEN];
+	size_t i;
+
+	for (i = 0; name[i] != '\0' && i < sizeof(should) - 1; ++i) {
+		should[i] = tolower((unsigned char)name[i]);
+		if (should[i] == '_' || should[i] == ' ') should[i] = '-';
+	}
+	should[i] = '\0';
+	if (0 == strcmp(should, name)) return true;
+	report(out, path, 0, "should be named %s/%s.", dir, should);
+	return false;
+}
+
+/* `{metric,imperial}` syntax must be balanced on each line,
+ * otherwise expand_units() can't split the ingredients. */
+static bool
+lint_units(FILE *out, char *path, unsigned lineno, char *line)
+{
+	enum { OUTSIDE, METRIC, IMPERIAL } state = OUTSIDE;
+	for (; *line != '\0' && *line != '\n'; ++line) {
+		switch (*line) {
+		case '{':
+			if (state != OUTSIDE) goto bad;
+			state = METRIC;
+			break;
+		case ',':
+			if (state == METRIC) state = IMPERIAL;
+			break;
+		case '}':
+			if (state != IMPERIAL) goto bad;
+			state = OUTSIDE;
+			break;
+		}
+	}
+	if (state == OUTSIDE) return true;
+bad:
+	report(out, path, lineno, "unbalanced {metric,imperial} units syntax.");
+	return false;
+}
+
+static bool
+lint_tags(FILE *out, char *path, unsigned lineno, char *line)
+{
+	char *tag;
+	unsigned count = 0;
+	bool ok = true, invalid = false;
+
+	line[strcspn(line, "\n")] = '\0';
+	for (tag = strtok(line + sizeof(TAGS_PREFIX) - 1, " "); tag != NULL;
+	     tag = strtok(NULL, " ")) {
+		++count;
+		if (tag[strspn(tag, "abcdefghijklmnopqrstuvwxyz-")] != '\0')
+			invalid = true;
+	}
+	if (invalid) {
+		report(out, path, lineno, "Recipe has invalid tags. Tags must be "
+			"separated by spaces and contain only lowercase letters or hyphens (-)");
+		ok = false;
+	}
+	if (count < MIN_TAGS) {
+		report(out, path, lineno, "Recipe only has %u tags. Add some more.", count);
+		ok = false;
+	} else if (count > MAX_TAGS_PER_RECIPE) {
+		report(out, path, lineno, "Recipe has %u tags which is too many. "
+			"Remove some tags.", count);
+		ok = false;
+	}
+	return ok;
+}
+
+static bool
+lint_recipe(FILE *out, char *path)
+{
+	FILE *f;
+	char line[LINE_LENGTH], last[LINE_LENGTH] = { 0 };
+	unsigned lineno = 0, empty = 0;
+	bool ok = true, title = false, ingredients = false, directions = false;
+	bool units = false, blanks = false;
+
+	f = fopen(path, "r");
+	if (NULL == f) {
+		report(out, path, 0, "could not be read.");
+		return false;
+	}
+	while (NULL != fgets(line, sizeof(line), f)) {
+		++lineno;
+		if (lineno == 1 && 0 == strncmp(line, "# ", 2)) title = true;
+		if (0 == strcmp(line, "## Ingredients\n")) ingredients = units = true;
+		else if (0 == strcmp(line, "## Directions\n")) directions = true;
+		else if (0 == strncmp(line, "## Contrib", 10)) units = false;
+		else if (units) ok &= lint_units(out, path, lineno, line);
+
+		if (line[0] == '\n') {
+			if (++empty == 2 && !blanks) {
+				report(out, path, lineno, "Recipe has at least 2 consecutive empty lines.");
+				blanks = true;
+				ok = false;
+			}
+		} else {
+			empty = 0;
+		}
+		strcpy(last, line);
+	}
+	fclose(f);
+
+	if (!title) {
+		report(out, path, 1, "Recipe does not have a properly formatted title on the first line.");
+		ok = false;
+	}
+	if (0 != strncmp(last, TAGS_PREFIX " ", sizeof(TAGS_PREFIX))) {
+		report(out, path, lineno, "Recipe does not have a properly formatted tags on the last line.");
+		ok = false;
+	} else {
+		ok &= lint_tags(out, path, lineno, last);
+	}
+	if (!ingredients) {
+		report(out, path, 0, "Recipe does not have an ingredients list.");
+		ok = false;
+	}
+	if (!directions) {
+		report(out, path, 0, "Recipe does not have a directions section.");
+		ok = false;
+	}
+	return ok;
+}
+
+static bool
+lint_picture(FILE *out, char *path)
+{
+	struct stat st;
+	if (0 != stat(path, &st)) {
+		report(out, path, 0, "could not be read.");
+		return false;
+	}
+	if (st.st_size > PIX_SIZE_LIMIT) {
+		report(out, path, 0, "File is bigger than specified %d limit",
+			PIX_SIZE_LIMIT);
+		return false;
+	}
+	return true;
+}
+
+static bool
+lint_file(FILE *out, struct lintfile *file)
+{
+	char path[PATH_LEN * 2];
+	char *ext = strrchr(file->name, '.');
+	bool ok;
+
+	sprintf(path, "%s/%s", file->dir, file->name);
+	ok = lint_name(out, path, file->dir, file->name);
+	if (file->recipe) {
+		if (NULL != ext && 0 == strcmp(ext, ".md"))
+			ok &= lint_recipe(out, path);
+	} else if (NULL != ext && 0 == strcasecmp(ext, ".webp")) {
+		ok &= lint_picture(out, path);
+	}
+	return ok;
+}
+
+static size_t
+list_files(struct lintfile **files, size_t count, char *dir, bool recipe)
+{
+	struct dirent **names;
+	int n, i;
+
+	n = scandir(dir, &names, NULL, alphasort);
+	if (-1 == n) die("could not open directory: %s.", dir);
+	*files = realloc(*files, (count + n) * sizeof(struct lintfile));
+	if (NULL == *files) die("could not allocate file list.");
+	for (i = 0; i < n; ++i) {
+		if (names[i]->d_name[0] != '.') {
+			(*files)[count].dir = dir;
+			(*files)[count].recipe = recipe;
+			snprintf((*files)[count].name, PATH_LEN, "%s", names[i]->d_name);
+			++count;
+		}
+		free(names[i]);
+	}
+	free(names);
+	return count;
+}
+
+/* lints every recipe in `srcdir` and picture in `pixdir`.
+ * files are split into one contiguous chunk per cpu, each checked by
+ * a forked worker, and the diagnostics are collected in file order.
+ * returns the number of files with problems.
+ */
+int
+lint(char *srcdir, char *pixdir, FILE *out)
+{
+	struct lintfile *files = NULL;
+	size_t count, i, from, to;
+	long workers, w;
+	int (*pipes)[2], status, failed = 0;
+	pid_t *pids;
+	FILE *chunk;
+	char buf[1 << 12];
+	ssize_t n;
+
+	count = list_files(&files, 0, srcdir, true);
+	count = list_files(&files, count, pixdir, false);
+
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers < 1) workers = 1;
+	if ((size_t)workers > count) workers = count ? count : 1;
+	pipes = calloc(workers, sizeof(*pipes));
+	pids = calloc(workers, sizeof(*pids));
+	if (NULL == pipes || NULL == pids) die("could not allocate workers.");
+
+	fflush(out);
+	for (w = 0; w < workers; ++w) {
+		if (0 != pipe(pipes[w])) die("pipe failed");
+		pids[w] = fork();
+		if (pids[w] < 0) die("fork() failed");
+		if (pids[w] == 0) {
+			close(pipes[w][0]);
+			chunk = fdopen(pipes[w][1], "w");
+			from = count * w / workers;
+			to = count * (w + 1) / workers;
+			for (status = 0, i = from; i < to; ++i)
+				status += !lint_file(chunk, &files[i]);
+			fclose(chunk);
+			/* exit statuses only hold a byte */
+			_exit(status > 255 ? 255 : status);
+		}
+		close(pipes[w][1]);
+	}
+
+	/* a worker blocked on a full pipe will be drained in its turn */
+	for (w = 0; w < workers; ++w) {
+		while (0 != (n = read(pipes[w][0], buf, sizeof(buf)))) {
+			if (-1 == n) {
+				if (EINTR == errno) continue;
+				die("read failed: %s", strerror(errno));
+			}
+			fwrite(buf, 1, n, out);
+		}
+		close(pipes[w][0]);
+		waitpid(pids[w], &status, 0);
+		if (WIFEXITED(status)) failed += WEXITSTATUS(status);
+		else failed += 1;
+	}
+
+	free(pipes);
+	free(pids);
+	free(files);
+	return failed;
+}
@@ -0,0 +1,17 @@
+/* checking recipes & pictures before they are merged */
+#ifndef _LINT_H
+#define _LINT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "config.h"
+
+struct lintfile {
+	char *dir;
+	char name[PATH_LEN];
+	bool recipe;  /* markdown recipe, otherwise a picture */
+};
+
+int lint(char *, char *, FILE *);
+
+#endif
@@ -0,0 +1,297 @@
+/* deploy manifests, so only changed files need to be uploaded. */
+#include "config.h"
+#include "manifest.h"
+#include "output.h"
+#include "based.h"
+
+#include <inttypes.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Manifest file format, one line per file, sorted by path:
+ *	<fnv1a-64-hex> <size> <path>\n
+ * paths are relative to the site root, which is where the
+ * destination and public directories are both deployed to.
+ */
+static const char FMT_MANIFEST_ENTRY[]  = "%016" PRIx64 " %lu %s\n";
+static const char SCAN_MANIFEST_ENTRY[] = "%16" SCNx64 " %lu %255[^\n]%*c";
+
+struct manifest {
+	struct manifestentry *entries;
+	size_t size, capacity;
+};
+
+/* files streamed so far with `-d -`, standing in for walk_dir() */
+static struct manifest streamed_gen = { 0 }, streamed_pub = { 0 };
+
+static struct manifestentry *
+push_entry(struct manifest *m)
+{
+	if (m->size == m->capacity) {
+		m->capacity = m->capacity ? m->capacity * 2 : 512;
+		m->entries = realloc(m->entries, m->capacity * sizeof(*m->entries));
+		if (NULL == m->entries) die("failed to allocate manifest.");
+	}
+	return &m->entries[m->size++];
+}
+
+/* recursively hash every file under `root`/`dir`, skipping dotfiles.
+ * scandir() with alphasort() gives us entries in path order. */
+static void
+walk_dir(struct manifest *m, char *root, char *dir)
+{
+	struct dirent **files;
+	struct manifestentry *entry;
+	struct stat st;
+	char path[PATH_LEN * 3], rel[PATH_LEN * 2];
+	int n, i;
+
+	sprintf(path, "%s/%s", root, dir);
+	n = scandir(path, &files, NULL, alphasort);
+	if (-1 == n) return;
+	for (i = 0; i < n; ++i) {
+		if (files[i]->d_name[0] != '.') {
+			if (dir[0] == '\0') sprintf(rel, "%s", files[i]->d_name);
+			else sprintf(rel, "%s/%s", dir, files[i]->d_name);
+			if (strlen(rel) >= PATH_LEN) die("path too long for manifest: %s", rel);
+			sprintf(path, "%s/%s", root, rel);
+			if (0 != stat(path, &st)) {
+				/* vanished, or a dangling link */
+			} else if (S_ISDIR(st.st_mode)) {
+				walk_dir(m, root, rel);
+			} else if (S_ISREG(st.st_mode)) {
+				entry = push_entry(m);
+				strcpy(entry->path, rel);
+				entry->size = st.st_size;
+				entry->hash = hash_file(path);
+			}
+		}
+		free(files[i]);
+	}
+	free(files);
+}
+
+static int
+pathsort(const void *a, const void *b)
+{
+	return strcmp(((struct manifestentry *)a)->path,
+	              ((struct manifestentry *)b)->path);
+}
+
+static void
+read_manifest(struct manifest *m, char *file)
+{
+	FILE *f;
+	struct manifestentry *entry;
+
+	f = fopen(file, "r");
+	if (NULL == f) return;  /* no manifest, everything is new */
+	while (1) {
+		entry = push_entry(m);
+		if (3 != fscanf(f, SCAN_MANIFEST_ENTRY,
+				&entry->hash, &entry->size, entry->path)) {
+			--m->size;
+			break;
+		}
+	}
+	if (ferror(f)) die("failed to read manifest %s.", file);
+	fclose(f);
+	/* cheap, manifests are written sorted already */
+	qsort(m->entries, m->size, sizeof(*m->entries), pathsort);
+}
+
+/* Headers file format, for every file but itself:
+ *	/<path>\n
+ *	  ETag: "<fnv1a-64-hex>"\n
+ *	  Last-Modified: <http-date>\n
+ *	  Cache-Control: public, max-age=31536000, immutable\n
+ * the third line only if the file's date is known, the last only for
+ * files named after their content (<stem>.<8-hex>.<ext>, fingerprinted
+ * assets and resized pictures). servers and cdns (netlify, cloudflare
+ * pages) load it to answer conditional requests.
+ */
+static const char FMT_HEADERS_PATH[] = "/%s\n";
+static const char FMT_HEADERS_ETAG[] = "  ETag: \"%016" PRIx64 "\"\n";
+static const char FMT_HEADERS_DATE[] = "  Last-Modified: %s\n";
+static const char FMT_HTTP_DATE[]    = "%a, %d %b %Y %H:%M:%S GMT";
+static const char HEADERS_IMMUTABLE[] = "  Cache-Control: public, max-age=31536000, immutable\n";
+
+/* whether `path` ends in .<8 hex digits>.<ext>, a content hash */
+static bool
+fingerprinted(const char *path)
+{
+	const char *ext = strrchr(path, '.'), *p;
+
+	if (NULL == ext || ext - path < 9 || '.' != ext[-9]) return false;
+	for (p = ext - 8; p < ext; ++p)
+		if (!isxdigit((unsigned char)*p) || isupper((unsigned char)*p))
+			return false;
+	return NULL == strchr(ext, '/');
+}
+
+static void
+write_headers(FILE *f, struct manifestentry *e, time_t lastmod)
+{
+	char date[32];
+
+	fprintf(f, FMT_HEADERS_PATH, e->path);
+	fprintf(f, FMT_HEADERS_ETAG, e->hash);
+	if (lastmod != 0) {
+		strftime(date, sizeof(date), FMT_HTTP_DATE, gmtime(&lastmod));
+		fprintf(f, FMT_HEADERS_DATE, date);
+	}
+	if (fingerprinted(e->path)) fputs(HEADERS_IMMUTABLE, f);
+}
+
+/* merges the path sorted `gen` and `pub` into `site`, the generated
+ * file winning when both hold the same path. given `headers`, also
+ * writes the headers of every file but HEADERS_FILE to it.
+ */
+static void
+merge_site(struct manifest *site, struct manifest *gen, struct manifest *pub,
+           FILE *headers, time_t (*lastmod)(const char *))
+{
+	struct manifestentry *e;
+	size_t a, b;
+	int cmp;
+
+	for (a = b = 0; a < gen->size || b < pub->size;) {
+		if (a == gen->size) cmp = 1;
+		else if (b == pub->size) cmp = -1;
+		else cmp = strcmp(gen->entries[a].path, pub->entries[b].path);
+		if (cmp == 0) ++b;  /* public file shadowed by generated file */
+		e = cmp <= 0 ? &gen->entries[a++] : &pub->entries[b++];
+		if (NULL != headers) {
+			if (0 == strcmp(e->path, HEADERS_FILE)) continue;  /* rewritten */
+			write_headers(headers, e, cmp <= 0 ? lastmod(e->path) : 0);
+		}
+		*push_entry(site) = *e;
+	}
+}
+
+/* hashes all generated files in `dst` and static files in `pubdir`.
+ * when both directories hold the same path, the generated file wins.
+ * given `lastmod`, which dates generated files, also writes
+ * `dst`/HEADERS_FILE, and lists it in the manifest.
+ */
+void
+write_manifest(char *file, char *dst, char *pubdir, time_t (*lastmod)(const char *))
+{
+	FILE *f, *headers = NULL;
+	struct manifest gen = { 0 }, pub = { 0 }, site = { 0 };
+	struct manifestentry *e;
+	struct stat st;
+	char headerfile[PATH_LEN * 2];
+	size_t a;
+
+	walk_dir(&gen, dst, "");
+	walk_dir(&pub, pubdir, "");
+	qsort(gen.entries, gen.size, sizeof(*gen.entries), pathsort);
+	qsort(pub.entries, pub.size, sizeof(*pub.entries), pathsort);
+
+	if (NULL != lastmod) {
+		sprintf(headerfile, "%s/%s", dst, HEADERS_FILE);
+		headers = fopen(headerfile, "w");
+		if (NULL == headers) die("failed to open %s for writing.", headerfile);
+	}
+	merge_site(&site, &gen, &pub, headers, lastmod);
+	if (NULL != headers) {
+		fclose(headers);
+		if (0 != stat(headerfile, &st)) die("failed to stat %s.", headerfile);
+		e = push_entry(&site);
+		strcpy(e->path, HEADERS_FILE);
+		e->size = st.st_size;
+		e->hash = hash_file(headerfile);
+		qsort(site.entries, site.size, sizeof(*site.entries), pathsort);
+	}
+
+	f = fopen(file, "w");
+	if (NULL == f) die("failed to open manifest %s for writing.", file);
+	for (a = 0; a < site.size; ++a)
+		fprintf(f, FMT_MANIFEST_ENTRY, site.entries[a].hash,
+			site.entries[a].size, site.entries[a].path);
+	fclose(f);
+	free(gen.entries);
+	free(pub.entries);
+	free(site.entries);
+}
+
+/* records a member of the tar stream, `generated` unless copied
+ * from the public directory. dotfiles are left out, as on disk.
+ */
+void
+manifest_record(char *path, size_t size, uint64_t hash, bool generated)
+{
+	struct manifestentry *e;
+
+	if (path[0] == '.' || NULL != strstr(path, "/.")) return;
+	if (strlen(path) >= PATH_LEN) die("path too long for manifest: %s", path);
+	e = push_entry(generated ? &streamed_gen : &streamed_pub);
+	strcpy(e->path, path);
+	e->size = size;
+	e->hash = hash;
+}
+
+/* streams `dst`/HEADERS_FILE for the members recorded so far, as
+ * write_manifest() writes it for a directory. a stream has no
+ * manifest to diff against, so none is written.
+ */
+void
+stream_headers(char *dst, time_t (*lastmod)(const char *))
+{
+	struct manifest site = { 0 };
+	char headerfile[PATH_LEN * 2];
+	FILE *f;
+
+	qsort(streamed_gen.entries, streamed_gen.size, sizeof(*streamed_gen.entries), pathsort);
+	qsort(streamed_pub.entries, streamed_pub.size, sizeof(*streamed_pub.entries), pathsort);
+	sprintf(headerfile, "%s/%s", dst, HEADERS_FILE);
+	f = output_open(headerfile);
+	if (NULL == f) die("failed to open %s for writing.", headerfile);
+	merge_site(&site, &streamed_gen, &streamed_pub, f, lastmod);
+	output_close(f);
+	free(site.entries);
+	free(streamed_gen.entries);
+	free(streamed_pub.entries);
+	memset(&streamed_gen, 0, sizeof(streamed_gen));
+	memset(&streamed_pub, 0, sizeof(streamed_pub));
+}
+
+/* prints the path of every file in the `current` manifest which is new
+ * or differs from the `previous` manifest, one per line, to `out`.
+ * files that disappeared are reported on stderr.
+ * returns the number of changed files.
+ */
+int
+diff_manifest(char *current, char *previous, FILE *out)
+{
+	struct manifest now = { 0 }, old = { 0 };
+	size_t a, b;
+	int cmp, changed = 0;
+
+	read_manifest(&now, current);
+	read_manifest(&old, previous);
+	for (a = b = 0; a < now.size || b < old.size;) {
+		if (a == now.size) cmp = 1;
+		else if (b == old.size) cmp = -1;
+		else cmp = strcmp(now.entries[a].path, old.entries[b].path);
+		if (cmp > 0) {
+			fprintf(stderr, "removed: %s\n", old.entries[b].path);
+			++b;
+			continue;
+		}
+		if (cmp < 0
+		 || now.entries[a].hash != old.entries[b].hash
+		 || now.entries[a].size != old.entries[b].size) {
+			fprintf(out, "%s\n", now.entries[a].path);
+			++changed;
+		}
+		++a;
+		if (cmp == 0) ++b;
+	}
+	free(now.entries);
+	free(old.entries);
+	return changed;
+}
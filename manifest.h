@@ -0,0 +1,22 @@
+/* deploy manifest: path, size & content hash of every output */
+#ifndef _MANIFEST_H
+#define _MANIFEST_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "config.h"
+
+struct manifestentry {
+	char path[PATH_LEN];  /* relative to the deployed site root */
+	long unsigned size;
+	uint64_t hash;
+};
+
+void write_manifest(char *, char *, char *, time_t (*)(const char *));
+int diff_manifest(char *, char *, FILE *);
+void manifest_record(char *, size_t, uint64_t, bool);
+void stream_headers(char *, time_t (*)(const char *));
+
+#endif
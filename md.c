@@ -1,9 +1,13 @@
 /* parse md files. */
-#include "md.h"
 #include "config.h"
+#include "md.h"
 #include "based.h"
+#include "prof.h"
+#include "render.h"
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
 /*
  * libmarkdown parser, also provides the `markdown` command.
  * you probably have this installed already. see `man 3 markdown`.
@@ -19,13 +23,71 @@
 
 struct md _parsed_md = { 0 };
 MMIOT *_mmio = NULL;
+bool _builtin = false;
 
-struct md *
-mdparse(char *srcdir, char *slug)
+#if BUILTIN_MARKDOWN
+/* html from the built-in engine, reused from one recipe to the next */
+static char *htmlbuf = NULL;
+static size_t htmlsize = 0;
+
+static void
+grow_html(size_t size)
+{
+	htmlbuf = realloc(htmlbuf, size);
+	if (NULL == htmlbuf) die("could not allocate memory for recipe.");
+	htmlsize = size;
+}
+
+/* renders `text`, or the file `src` if it's NULL.
+ * returns false if the recipe has to be rendered by discount. */
+static bool
+builtin(char *src, char *slug, char *text, size_t len, int flags)
+{
+	char *own = NULL;
+	long n;
+
+	memset(&_parsed_md, 0, sizeof(_parsed_md));
+	strcpy(_parsed_md.slug, slug);
+	if (NULL == text) text = own = read_file(src, &len);
+	if (NULL == text) die("file was moved.");
+	if (htmlsize < 2 * len + FILE_BUF_SIZE) grow_html(2 * len + FILE_BUF_SIZE);
+
+	prof_begin(PHASE_COMPILE);
+	while (0 <= (n = render_recipe(&_parsed_md, text, len, htmlbuf, htmlsize, flags))
+	    && (size_t)n >= htmlsize)
+		grow_html(n + 1);
+	prof_end(PHASE_COMPILE);
+	free(own);
+	if (n < 0) return false;
+	_parsed_md.html = htmlbuf;
+	return true;
+}
+#endif
+
+/* renders `text`, or the file `src` if it's NULL. */
+/* copies the tags of a `;tags: ` line into `tags`. */
+static void
+parse_tags(char (*tags)[TAG_NAME_LEN], char *linbuf)
 {
-	FILE *f;
-	char src[PATH_LEN];
 	int i, tag_start, tag = 0;
+
+	for (i = sizeof(TAGS_PREFIX) - 1, tag_start = i;
+	     linbuf[i] != '\n' && linbuf[i] != '\0'; ++i) {
+		if (linbuf[i + 1] == ' '
+		 || linbuf[i + 1] == '\n'
+		 || linbuf[i + 1] == '\0') {
+			/* technically all Unix files should end in a linefeed */
+			/* but apparently we can't rely on that fact. */
+			memcpy(tags[tag++], linbuf + tag_start, i - tag_start + 1);
+			tag_start = i + 2;
+		}
+	}
+}
+
+static void
+discount(char *src, char *slug, char *text, size_t len)
+{
+	FILE *f;
 	char linbuf[LINE_LENGTH] = { '\0' };
 	size_t linlen = 0;
 	int    doclen = 0;
@@ -36,9 +98,9 @@ mdparse(char *srcdir, char *slug)
 	 */
 	memset(&_parsed_md, 0, sizeof(_parsed_md));
 
-	/* open source file */
-	sprintf(src, "%s/%s.md", srcdir, slug);
-	f = fopen(src, "r");
+	/* open source file, or the text already read */
+	if (NULL != text) f = fmemopen(text, len ? len : 1, "r");
+	else              f = fopen(src, "r");
 	if (NULL == f) die("file was moved.");
 
 	strcpy(_parsed_md.slug, slug);
@@ -49,17 +111,7 @@ mdparse(char *srcdir, char *slug)
 		linlen = strlen(linbuf);
 		/* parse tags, excluding them from the markdown */
 		if (0 == strncmp(linbuf, TAGS_PREFIX, sizeof(TAGS_PREFIX) - 1)) {
-			for (i = sizeof(TAGS_PREFIX) - 1, tag_start = i;
-			     linbuf[i] != '\n' && linbuf[i] != '\0'; ++i) {
-				if (linbuf[i + 1] == ' '
-				 || linbuf[i + 1] == '\n'
-				 || linbuf[i + 1] == '\0') {
-					/* technically all Unix files should end in a linefeed */
-					/* but apparently we can't rely on that fact. */
-					memcpy(_parsed_md.tags[tag++], linbuf + tag_start, i - tag_start + 1);
-					tag_start = i + 2;
-				}
-			}
+			parse_tags(_parsed_md.tags, linbuf);
 		} else {
 			/* copy the #/<h1> header title */
 			if (0 == strncmp("# ", linbuf, 2) && _parsed_md.title[0] == '\0')
@@ -80,13 +132,30 @@ mdparse(char *srcdir, char *slug)
 		fprintf(stderr, "  %s\n", strerror(errno));
 		exit(1);
 	}
+	prof_begin(PHASE_COMPILE);
 	mkd_compile(_mmio, mkd_flags);
 	doclen = mkd_document(_mmio, &_parsed_md.html);
+	prof_end(PHASE_COMPILE);
 	if (_parsed_md.html == NULL) {
 		fprintf(stderr, "error generating markdown file. (%d):\n", errno);
 		fprintf(stderr, "  %s\n", strerror(errno));
 		exit(1);
 	}
+}
+
+/* `text` is the recipe's source, when it has been read already. */
+struct md *
+mdparse(char *srcdir, char *slug, char *text, size_t len)
+{
+	char src[PATH_LEN];
+
+	sprintf(src, "%s/%s.md", srcdir, slug);
+	_mmio = NULL;
+	_builtin = false;
+#if BUILTIN_MARKDOWN
+	_builtin = builtin(src, slug, text, len, RENDER_UNITS);
+#endif
+	if (!_builtin) discount(src, slug, text, len);
 
 	/* check metadata */
 	if (_parsed_md.title[0] == '\0')
@@ -95,6 +164,171 @@ mdparse(char *srcdir, char *slug)
 	return &_parsed_md;
 }
 
+/* reads only the title and tags of a recipe into `meta`, without
+ * rendering it. returns false if `src` can't be read. */
+bool
+mdmeta(char *src, struct md *meta)
+{
+	FILE *f;
+	char linbuf[LINE_LENGTH];
+	char *end;
+
+	f = fopen(src, "r");
+	if (NULL == f) return false;
+	while (NULL != fgets(linbuf, sizeof(linbuf), f)) {
+		if (0 == strncmp(linbuf, TAGS_PREFIX, sizeof(TAGS_PREFIX) - 1)) {
+			parse_tags(meta->tags, linbuf);
+		} else if (0 == strncmp("# ", linbuf, 2) && meta->title[0] == '\0') {
+			end = strchr(linbuf, '\n');
+			if (NULL == end) end = linbuf + strlen(linbuf);
+			if (end - linbuf - 2 >= (long)sizeof(meta->title))
+				end = linbuf + 2 + sizeof(meta->title) - 1;
+			memcpy(meta->title, linbuf + 2, end - linbuf - 2);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+/* frees what the last mdparse() allocated, `html` included. */
+void
+mdrelease(void)
+{
+	if (NULL != _mmio) mkd_cleanup(_mmio);
+	_mmio = NULL;
+	_parsed_md.html = NULL;
+}
+
+#if BUILTIN_MARKDOWN
+/* tags whitespace around which doesn't change how the html renders */
+static const char *BLOCK_TAGS[] = {
+	"p", "ul", "ol", "li", "h1", "h2", "h3", "h4", "h5", "h6",
+	"pre", "hr", "br", "details", "summary",
+};
+
+static bool
+is_block(const char *tag)
+{
+	size_t i, n;
+
+	if ('/' == *tag) ++tag;
+	for (n = 0; isalnum((unsigned char)tag[n]); ++n) ;
+	for (i = 0; i < sizeof(BLOCK_TAGS) / sizeof(*BLOCK_TAGS); ++i)
+		if (n == strlen(BLOCK_TAGS[i]) && 0 == strncmp(tag, BLOCK_TAGS[i], n))
+			return true;
+	return false;
+}
+
+/* collapses whitespace, dropping it around block tags. */
+static void
+normalize(char *html)
+{
+	char *r, *w;
+	bool block = true;  /* last thing written was a block tag */
+
+	for (r = w = html; '\0' != *r; ) {
+		if (isspace((unsigned char)*r)) {
+			while (isspace((unsigned char)*r)) ++r;
+			if (!block && '\0' != *r && !('<' == *r && is_block(r + 1)))
+				*w++ = ' ';
+		} else if ('<' == *r) {
+			block = is_block(r + 1);
+			while ('\0' != *r && '>' != *r) *w++ = *r++;
+			if ('\0' != *r) *w++ = *r++;
+		} else {
+			block = false;
+			*w++ = *r++;
+		}
+	}
+	*w = '\0';
+}
+
+/* whether `mine` and `theirs` render the same, once normalized,
+ * reporting where they first differ if not. */
+static bool
+same_html(FILE *out, char *src, const char *what, char *mine, char *theirs)
+{
+	char *a, *b;
+
+	normalize(mine);
+	normalize(theirs);
+	for (a = mine, b = theirs; '\0' != *a && *a == *b; ++a, ++b) ;
+	if (*a == *b) return true;
+	fprintf(out, "%s: %s differs at byte %ld:\n", src, what, (long)(a - mine));
+	fprintf(out, "  built-in: %.72s\n", a);
+	fprintf(out, "  discount: %.72s\n", b);
+	return false;
+}
+
+/* renders every recipe in `srcdir` with both engines, and reports
+ * where their titles, tags or html (but for whitespace) differ.
+ * each is compared twice: as rendered, and with {metric,imperial}
+ * units expanded, by the built-in engine itself and by `expand`
+ * (expand_units()) from discount's html, as pages are written.
+ * returns the number of recipes that differ.
+ */
+int
+mdcheck(char *srcdir, FILE *out, char *(*expand)(char *))
+{
+	struct dirent **names;
+	struct md mine, other;
+	char src[PATH_LEN * 2], *html, *units, *expanded;
+	int n, i, differ = 0, fallback = 0;
+	size_t len;
+
+	n = scandir(srcdir, &names, NULL, alphasort);
+	if (-1 == n) die("could not open source directory: %s.", srcdir);
+	for (i = 0; i < n; free(names[i++])) {
+		len = strlen(names[i]->d_name);
+		if ('.' == names[i]->d_name[0] || len < 4
+		 || 0 != strcmp(names[i]->d_name + len - 3, ".md"))
+			continue;
+		names[i]->d_name[len - 3] = '\0';
+		snprintf(src, sizeof(src), "%s/%s.md", srcdir, names[i]->d_name);
+
+		if (!builtin(src, names[i]->d_name, NULL, 0, 0)) {
+			fprintf(out, "%s: needs discount.\n", src);
+			++fallback;
+			continue;
+		}
+		mine = _parsed_md;
+		html = strdup(htmlbuf);
+		if (NULL == html) die("could not allocate memory for recipe.");
+		discount(src, names[i]->d_name, NULL, 0);
+		other = _parsed_md;  /* its html is freed by mdrelease() */
+		/* before it's normalized, units are expanded line by line */
+		expanded = expand(other.html);
+		units = NULL;
+		if (builtin(src, names[i]->d_name, NULL, 0, RENDER_UNITS))
+			units = strdup(htmlbuf);
+
+		if (0 != strcmp(mine.title, other.title)) {
+			fprintf(out, "%s: title differs: \"%s\" (built-in), \"%s\" (discount).\n",
+				src, mine.title, other.title);
+			++differ;
+		} else if (0 != memcmp(mine.tags, other.tags, sizeof(mine.tags))) {
+			fprintf(out, "%s: tags differ.\n", src);
+			++differ;
+		} else if (!same_html(out, src, "html", html, other.html)) {
+			++differ;
+		} else if (NULL == units) {
+			fprintf(out, "%s: needs discount to expand units.\n", src);
+			++differ;
+		} else if (!same_html(out, src, "html with units", units,
+		                      NULL != expanded ? expanded : other.html)) {
+			++differ;
+		}
+		free(html);
+		free(units);
+		free(expanded);
+		mdrelease();
+	}
+	free(names);
+	fprintf(out, "%d recipes differ, %d need discount.\n", differ, fallback);
+	return differ;
+}
+#endif
+
 void
 string_from_tags(char *dst, char (*tags)[TAG_NAME_LEN])
 {
@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 #ifndef __USE_XOPEN
 #define __USE_XOPEN
@@ -12,17 +13,18 @@
 
 #include <mkdio.h>
 #include "config.h"
+#include "based.h"
 
 struct md {
 	char title[TITLE_LEN];
 	char tags[TAG_COUNT][TAG_NAME_LEN];
 	char slug[SLUG_LEN];
-	char *html;          /* article content, must be freed! */
+	char *html;          /* article content, see mdrelease() */
 #if GIT_INTEGRATION
 	time_t mtime;        /* source file last modifed time */
 	char author[32];     /*    first commit git user.name */
-	char adate[32];      /*    --diff-filter=A (rfc-2822) */
-	char mdate[32];      /*    --diff-filter=M (rfc-2822) */
+	struct gitdate added;     /* --diff-filter=A */
+	struct gitdate modified;  /* --diff-filter=M */
 #endif
 };
 
@@ -33,6 +35,9 @@ struct md {
  */
 extern struct md _parsed_md;
 extern MMIOT *_mmio;
+/* set when `_parsed_md.html` comes from the built-in engine,
+ * with {metric,imperial} units already expanded. */
+extern bool _builtin;
 
 /* add `MKD_NOPANTS` to disable 'smartypants'?
  * (e.g. 1/4 -> ¼, "it's" -> "it’s", &c.).
@@ -43,7 +48,10 @@ static const int mkd_flags = 0
 	| MKD_AUTOLINK | MKD_FENCEDCODE
 	;
 
-struct md *mdparse(char *, char *);
+struct md *mdparse(char *, char *, char *, size_t);
+void mdrelease(void);
+bool mdmeta(char *, struct md *);
+int mdcheck(char *, FILE *, char *(*)(char *));
 
 void string_from_tags(char *, char (*)[TAG_NAME_LEN]);
 void tags_from_string(char (*)[TAG_NAME_LEN], char *);
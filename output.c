@@ -0,0 +1,288 @@
+/* tar stream output, so builds can be piped straight into a
+ * compressor or uploader without an intermediate directory,
+ * and html minification. */
+#include "config.h"
+#include "output.h"
+#include "manifest.h"
+#include "based.h"
+
+#include <ctype.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define TAR_BLOCK 512
+
+bool streaming = false;
+bool minifying = false;
+
+/* elements whose whitespace is significant */
+static const char *VERBATIM[] = { "pre", "textarea", "script", "style" };
+
+/* files being rendered in memory, streamed once closed */
+struct pending {
+	FILE *f;
+	char *buf;
+	size_t size;
+	char name[PATH_LEN];
+	char path[PATH_LEN * 2];
+	struct pending *next;
+};
+
+/* open_memstream() holds on to &buf and &size, so these can't move */
+static struct pending *pending = NULL;
+/* every member gets the same mtime, so identical builds give
+ * identical archives. taken from $SOURCE_DATE_EPOCH, or 0. */
+static long unsigned mtime = 0;
+
+/* ustar header, see tar(5) */
+struct tarheader {
+	char name[100], mode[8], uid[8], gid[8], size[12], mtime[12];
+	char chksum[8], typeflag, linkname[100], magic[6], version[2];
+	char uname[32], gname[32], devmajor[8], devminor[8], prefix[155];
+	char pad[12];
+};
+
+/* streams a member, recorded for the headers file as `generated`
+ * unless copied from the public directory. */
+static void
+tar_member(char *name, char *data, size_t size, bool generated)
+{
+	static const char zeros[TAR_BLOCK] = { 0 };
+	struct tarheader h;
+	unsigned char *b = (unsigned char *)&h;
+	unsigned sum = 0;
+	size_t len = strlen(name), split, i;
+
+	memset(&h, 0, sizeof(h));
+	if (len <= sizeof(h.name)) {
+		memcpy(h.name, name, len);
+	} else {
+		/* long names are split on a '/' into prefix & name */
+		for (split = len - sizeof(h.name) - 1; split < len && name[split] != '/'; ++split);
+		if (split >= len || split > sizeof(h.prefix))
+			die("path too long for tar stream: %s", name);
+		memcpy(h.prefix, name, split);
+		memcpy(h.name, name + split + 1, len - split - 1);
+	}
+	sprintf(h.mode,  "%07o", 0644);
+	sprintf(h.uid,   "%07o", 0);
+	sprintf(h.gid,   "%07o", 0);
+	sprintf(h.size,  "%011lo", (long unsigned)size);
+	sprintf(h.mtime, "%011lo", mtime);
+	h.typeflag = '0';
+	memcpy(h.magic, "ustar", 6);
+	memcpy(h.version, "00", 2);
+	memset(h.chksum, ' ', sizeof(h.chksum));
+	for (i = 0; i < sizeof(h); ++i) sum += b[i];
+	sprintf(h.chksum, "%06o", sum);
+
+	fwrite(&h, sizeof(h), 1, stdout);
+	fwrite(data, 1, size, stdout);
+	fwrite(zeros, 1, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK, stdout);
+	if (ferror(stdout)) die("failed to write tar stream.");
+	manifest_record(name, size, hash_bytes(data, size, HASH_SEED), generated);
+}
+
+/* member names are relative to the destination directory */
+static char *
+member_name(char *path)
+{
+	size_t n = sizeof(STREAM_DIR) - 1;
+	if (0 == strncmp(path, STREAM_DIR, n) && path[n] == '/')
+		return path + n + 1;
+	return path;
+}
+
+/* does `p` (just past "<" or "</") start the tag `name`? */
+static bool
+tag_is(const char *p, const char *end, const char *name)
+{
+	size_t n = strlen(name);
+	return (size_t)(end - p) > n && 0 == strncasecmp(p, name, n)
+	    && (p[n] == '>' || p[n] == '/' || isspace((unsigned char)p[n]));
+}
+
+/* collapses every run of whitespace to a single newline (if the run
+ * had one) or space, except in quoted attribute values and verbatim
+ * elements such as <pre>. a single pass, in place.
+ * returns the minified size.
+ */
+static size_t
+minify_html(char *html, size_t size)
+{
+	const char *opening = NULL, *verbatim = NULL;
+	char quote = '\0', c;
+	bool intag = false, newline;
+	size_t i, o, k;
+
+	for (i = o = 0; i < size;) {
+		c = html[i];
+		if (NULL != verbatim) {
+			/* copied as is, up to the element's end tag */
+			if (c == '<' && i + 1 < size && html[i + 1] == '/'
+			 && tag_is(html + i + 2, html + size, verbatim))
+				verbatim = NULL;
+			else {
+				html[o++] = html[i++];
+				continue;
+			}
+		}
+		if (quote != '\0') {
+			if (c == quote) quote = '\0';
+			html[o++] = html[i++];
+			continue;
+		}
+		if (isspace((unsigned char)c)) {
+			for (newline = false; i < size && isspace((unsigned char)html[i]); ++i)
+				newline |= html[i] == '\n';
+			html[o++] = newline ? '\n' : ' ';
+			continue;
+		}
+		if (intag) {
+			if (c == '"' || c == '\'') {
+				quote = c;
+			} else if (c == '>') {
+				intag = false;
+				verbatim = opening;
+				opening = NULL;
+			}
+		} else if (c == '<') {
+			intag = true;
+			for (k = 0; k < sizeof(VERBATIM) / sizeof(*VERBATIM); ++k)
+				if (tag_is(html + i + 1, html + size, VERBATIM[k]))
+					opening = VERBATIM[k];
+		}
+		html[o++] = html[i++];
+	}
+	return o;
+}
+
+static bool
+is_html(char *name)
+{
+	char *ext = strrchr(name, '.');
+	return NULL != ext && 0 == strcmp(ext, ".html");
+}
+
+void
+output_init(char *dst, bool minify)
+{
+	char *epoch;
+
+	minifying = minify;
+	streaming = 0 == strcmp(dst, STREAM_DIR);
+	if (!streaming) return;
+	epoch = getenv("SOURCE_DATE_EPOCH");
+	if (NULL != epoch) mtime = strtoul(epoch, NULL, 10);
+}
+
+/* opens `path` for writing, which is only streamed (or minified
+ * and written) when closed. */
+FILE *
+output_open(char *path)
+{
+	struct pending *p;
+
+	if (!streaming && !(minifying && is_html(path)))
+		return fopen(path, "w");
+	p = calloc(1, sizeof(*p));
+	if (NULL == p) die("could not allocate output.");
+	snprintf(p->name, sizeof(p->name), "%s", member_name(path));
+	snprintf(p->path, sizeof(p->path), "%s", path);
+	p->f = open_memstream(&p->buf, &p->size);
+	if (NULL == p->f) die("could not allocate output.");
+	p->next = pending;
+	pending = p;
+	return p->f;
+}
+
+/* closes a file from output_open(), returning the bytes written. */
+long
+output_close(FILE *f)
+{
+	struct pending *p, **link;
+	long written;
+	FILE *out;
+
+	for (link = &pending; *link != NULL && (*link)->f != f; link = &(*link)->next);
+	if (NULL == (p = *link)) {
+		/* written directly */
+		written = ftell(f);
+		fclose(f);
+		return written;
+	}
+	fclose(f);
+	if (minifying && is_html(p->name))
+		p->size = minify_html(p->buf, p->size);
+	written = p->size;
+	if (streaming) {
+		tar_member(p->name, p->buf, p->size, true);
+	} else {
+		out = fopen(p->path, "w");
+		if (NULL == out) die("failed to open %s for writing.", p->path);
+		fwrite(p->buf, 1, p->size, out);
+		if (0 != fclose(out)) die("failed to write %s.", p->path);
+	}
+	*link = p->next;
+	free(p->buf);
+	free(p);
+	return written;
+}
+
+static void
+tree_walk(char *root, char *dir)
+{
+	struct dirent **files;
+	struct stat st;
+	char path[PATH_LEN * 3], rel[PATH_LEN * 2];
+	char *data;
+	FILE *f;
+	int n, i;
+
+	sprintf(path, "%s/%s", root, dir);
+	n = scandir(path, &files, NULL, alphasort);
+	if (-1 == n) die("could not open directory: %s.", path);
+	for (i = 0; i < n; ++i) {
+		if (files[i]->d_name[0] == '.') goto next;
+		if (dir[0] == '\0') sprintf(rel, "%s", files[i]->d_name);
+		else sprintf(rel, "%s/%s", dir, files[i]->d_name);
+		sprintf(path, "%s/%s", root, rel);
+		if (0 != stat(path, &st)) goto next;
+		if (S_ISDIR(st.st_mode)) {
+			tree_walk(root, rel);
+		} else if (S_ISREG(st.st_mode)) {
+			data = malloc(st.st_size + 1);
+			f = fopen(path, "r");
+			if (NULL == data || NULL == f) die("could not read %s.", path);
+			if ((size_t)st.st_size != fread(data, 1, st.st_size, f))
+				die("could not read %s.", path);
+			fclose(f);
+			tar_member(rel, data, st.st_size, false);
+			free(data);
+		}
+next:
+		free(files[i]);
+	}
+	free(files);
+}
+
+/* streams every file under `root`, in path order, skipping dotfiles. */
+void
+output_tree(char *root)
+{
+	if (streaming) tree_walk(root, "");
+}
+
+/* ends the archive with two empty blocks. */
+void
+output_end(void)
+{
+	static const char zeros[TAR_BLOCK * 2] = { 0 };
+
+	if (!streaming) return;
+	if (NULL != pending) die("%s was never closed.", pending->name);
+	fwrite(zeros, 1, sizeof(zeros), stdout);
+	if (0 != fflush(stdout)) die("failed to write tar stream.");
+}
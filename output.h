@@ -0,0 +1,22 @@
+/* output files, either written to the destination directory
+ * or, with `-d -`, streamed to stdout as a tar archive.
+ * html files are minified with `-M`. */
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* destination directory name which selects streaming */
+#define STREAM_DIR "-"
+
+extern bool streaming;
+extern bool minifying;
+
+void output_init(char *, bool);
+FILE *output_open(char *);
+long output_close(FILE *);
+void output_tree(char *);
+void output_end(void);
+
+#endif
@@ -0,0 +1,301 @@
+/* image pipeline for recipe pictures. */
+#include "config.h"
+
+#if IMAGE_PIPELINE
+
+#include "pix.h"
+#include "based.h"
+#include "output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define IMAGE_WIDTH_COUNT (sizeof(IMAGE_WIDTHS) / sizeof(IMAGE_WIDTHS[0]))
+/* upper bound on the bytes we add to a single <img> tag */
+#define IMG_ATTR_LEN (IMAGE_WIDTH_COUNT * (PATH_LEN + 48) + PATH_LEN + 128)
+
+#define SRCSET " srcset=\""
+
+/* resized pictures shared between builds, or NULL */
+char *pixstore = NULL;
+
+struct pix {
+	unsigned width, height;
+	char srcset[IMG_ATTR_LEN];
+};
+
+static uint32_t le16(unsigned char *b) { return b[0] | b[1] << 8; }
+static uint32_t le24(unsigned char *b) { return b[0] | b[1] << 8 | b[2] << 16; }
+static uint32_t be32(unsigned char *b)
+{
+	return (uint32_t)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+/* reads image dimensions from a png or webp header.
+ * returns false when the format is not recognised. */
+static bool
+image_size(char *path, unsigned *width, unsigned *height)
+{
+	FILE *f;
+	unsigned char h[32] = { 0 };
+	uint32_t bits;
+
+	f = fopen(path, "r");
+	if (NULL == f) return false;
+	fread(h, 1, sizeof(h), f);
+	fclose(f);
+
+	if (0 == memcmp(h, "\x89PNG", 4) && 0 == memcmp(h + 12, "IHDR", 4)) {
+		*width  = be32(h + 16);
+		*height = be32(h + 20);
+		return true;
+	}
+	if (0 != memcmp(h, "RIFF", 4) || 0 != memcmp(h + 8, "WEBP", 4))
+		return false;
+	if (0 == memcmp(h + 12, "VP8 ", 4)) {
+		/* lossy: 3 byte frame tag, 3 byte start code, 14 bit dimensions */
+		*width  = le16(h + 26) & 0x3fff;
+		*height = le16(h + 28) & 0x3fff;
+	} else if (0 == memcmp(h + 12, "VP8L", 4)) {
+		/* lossless: 1 byte signature, 14 bit (width - 1), (height - 1) */
+		bits = le16(h + 21) | (uint32_t)le16(h + 23) << 16;
+		*width  = (bits & 0x3fff) + 1;
+		*height = (bits >> 14 & 0x3fff) + 1;
+	} else if (0 == memcmp(h + 12, "VP8X", 4)) {
+		/* extended: 4 byte flags, 24 bit (width - 1), (height - 1) */
+		*width  = le24(h + 24) + 1;
+		*height = le24(h + 27) + 1;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/* allocates memory, must be freed,
+ * or returns NULL if cwebp failed.
+ * cwebp writes the resized picture to a pipe, so it can go to the
+ * destination, a tar stream, or the artifact store alike. */
+static char *
+resize_image(char *src, unsigned width, size_t *size)
+{
+	pid_t pid;
+	int status, link[2];
+	char w[12], *image = NULL;
+	size_t n;
+	FILE *in, *out;
+	char buf[1 << 12];
+	char *args[] = {
+		"cwebp", "-quiet", "-resize", w, "0", src, "-o", "-",
+		(char *)0
+	};
+
+	sprintf(w, "%u", width);
+	if (0 != pipe(link)) die("pipe failed");
+	pid = fork();
+	if (pid == 0) {
+		dup2(link[1], fileno(stdout));
+		close(link[0]); close(link[1]);
+		execv(IMAGE_RESIZE_PATH, args);
+		exit(1);
+	} else if (pid < 0) {
+		die("fork() failed");
+	}
+	close(link[1]);
+	in = fdopen(link[0], "r");
+	out = open_memstream(&image, size);
+	if (NULL == in || NULL == out) die("could not read resized %s.", src);
+	while (0 < (n = fread(buf, 1, sizeof(buf), in)))
+		fwrite(buf, 1, n, out);
+	fclose(in);
+	fclose(out);
+	if (-1 == waitpid(pid, &status, 0)
+	 || !WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+		free(image);
+		return NULL;
+	}
+	return image;
+}
+
+/* makes sure `variant` of `src` exists in `dst` (or is streamed),
+ * taking it from the artifact store when it has been made before. */
+static bool
+make_variant(char *src, char *dst, char *variant, unsigned width)
+{
+	char out[PATH_LEN * 2], stored[PATH_LEN * 2];
+	char *image = NULL;
+	size_t size;
+	FILE *f;
+
+	sprintf(out, "%s/%s", dst, variant);
+	if (!streaming && 0 == access(out, F_OK))
+		return true;
+	if (NULL != pixstore) {
+		sprintf(stored, "%s/%s", pixstore, strrchr(variant, '/') + 1);
+		image = read_file(stored, &size);
+	}
+	if (NULL == image) {
+		image = resize_image(src, width, &size);
+		if (NULL == image) return false;
+		if (NULL != pixstore && !write_atomic(stored, image, size))
+			fprintf(stderr, "warning: can't write %s.\n", stored);
+	}
+	f = output_open(out);
+	if (NULL == f) die("failed to open %s for writing.", out);
+	fwrite(image, 1, size, f);
+	output_close(f);
+	free(image);
+	return true;
+}
+
+/* reads dimensions and makes sure each downscaled variant of
+ * `url` (relative to the public directory) exists in `dst`.
+ * variants are named <stem>-<width>w.<hash>.webp, so an existing file
+ * is always up to date and never has to be regenerated.
+ */
+static bool
+pix_info(struct pix *info, char *url, char *pubdir, char *dst)
+{
+	static int can_resize = -1;
+	char src[PATH_LEN * 2], out[PATH_LEN * 2], variant[PATH_LEN + 32];
+	char stem[PATH_LEN], *ext;
+	uint64_t hash;
+	size_t i, ofs;
+
+	sprintf(src, "%s/%s", pubdir, url);
+	if (!image_size(src, &info->width, &info->height))
+		return false;
+	info->srcset[0] = '\0';
+
+	if (-1 == can_resize)
+		can_resize = 0 == access(IMAGE_RESIZE_PATH, X_OK);
+	if (!can_resize)
+		return true;
+
+	hash = hash_file(src);
+	ext = strrchr(url, '.');
+	snprintf(stem, sizeof(stem), "%.*s", (int)(ext - url), url);
+	/* variants live alongside the html, in <dst>/pix/ */
+	sprintf(out, "%s/%.*s", dst, (int)(strrchr(url, '/') - url), url);
+	if (!streaming) mkdir(out, 0755);
+
+	for (ofs = i = 0; i < IMAGE_WIDTH_COUNT; ++i) {
+		if (IMAGE_WIDTHS[i] >= info->width) break;
+		snprintf(variant, sizeof(variant), "%s-%uw.%08lx.webp",
+			stem, IMAGE_WIDTHS[i], (unsigned long)(hash & 0xffffffff));
+		if (!make_variant(src, dst, variant, IMAGE_WIDTHS[i])) {
+			fprintf(stderr, "warning: failed to resize %s to %upx.\n",
+				src, IMAGE_WIDTHS[i]);
+			break;
+		}
+		ofs += sprintf(info->srcset + ofs, "%s %uw, ", variant, IMAGE_WIDTHS[i]);
+	}
+	if (ofs > 0)  /* full size is always the largest candidate */
+		sprintf(info->srcset + ofs, "%s %uw", url, info->width);
+	return true;
+}
+
+static size_t
+count_images(char *html)
+{
+	size_t n = 0;
+	while (NULL != (html = strstr(html, "<img ")))
+		++n, ++html;
+	return n;
+}
+
+/* allocates memory, must be freed,
+ * or returns NULL when the html has no images.
+ * adds width/height, srcset and loading="lazy" to each local
+ * .webp/.png <img> emitted by discount.
+ */
+char *
+expand_images(char *html, char *pubdir, char *dst)
+{
+	char *expanded, *tag, *end, *src, *ext;
+	char url[PATH_LEN];
+	size_t i, n, len;
+	struct pix info;
+
+	n = count_images(html);
+	if (0 == n) return NULL;
+	expanded = calloc(strlen(html) + n * IMG_ATTR_LEN + 1, 1);
+	if (NULL == expanded)
+		die("could not allocate memory for recipe.");
+
+	i = 0;
+	while (NULL != (tag = strstr(html, "<img "))) {
+		end = strchr(tag, '>');
+		if (NULL == end) break;
+		/* copy everything up to the end of the tag, excluding `/>' */
+		len = end - html;
+		if (end[-1] == '/') --len;
+		while (len > 0 && html[len - 1] == ' ') --len;
+		memcpy(expanded + i, html, len);
+		i += len;
+
+		src = strstr(tag, "src=\"");
+		url[0] = '\0';
+		if (NULL != src && src < end) {
+			src += 5;
+			len = strcspn(src, "\"");
+			if (len < sizeof(url) && NULL == memchr(src, ':', len) && src[0] != '/')
+				sprintf(url, "%.*s", (int)len, src);
+		}
+		ext = strrchr(url, '.');
+		if (NULL != ext && NULL != strchr(url, '/')
+		 && (0 == strcmp(ext, ".webp") || 0 == strcmp(ext, ".png"))
+		 && pix_info(&info, url, pubdir, dst)) {
+			i += sprintf(expanded + i, " width=\"%u\" height=\"%u\"",
+				info.width, info.height);
+			if (info.srcset[0] != '\0')
+				i += sprintf(expanded + i, " srcset=\"%s\" sizes=\"%s\"",
+					info.srcset, IMAGE_SIZES);
+		}
+		i += sprintf(expanded + i, " loading=\"lazy\" />");
+		html = end + 1;
+	}
+	i += sprintf(expanded + i, "%s", html);
+	expanded[i] = '\0';
+
+	return expanded;
+}
+
+/* makes sure the variants in each srcset of an already rendered page
+ * exist in `dst`, for pages taken from the artifact store. */
+void
+restore_images(char *html, char *pubdir, char *dst)
+{
+	char set[IMG_ATTR_LEN], src[PATH_LEN * 2], dir[PATH_LEN * 2];
+	char *start, *end, *tok, *urls[IMAGE_WIDTH_COUNT + 1];
+	unsigned widths[IMAGE_WIDTH_COUNT + 1];
+	size_t n, i;
+
+	for (start = html; NULL != (start = strstr(start, SRCSET)); start = end) {
+		start += sizeof(SRCSET) - 1;
+		end = strchr(start, '"');
+		if (NULL == end || (size_t)(end - start) >= sizeof(set)) break;
+		sprintf(set, "%.*s", (int)(end - start), start);
+		/* "<variant> <width>w, ..., <original> <width>w" */
+		for (n = 0, tok = strtok(set, ", "); NULL != tok && n <= IMAGE_WIDTH_COUNT;
+		     tok = strtok(NULL, ", ")) {
+			urls[n] = tok;
+			if (NULL == (tok = strtok(NULL, ", "))) break;
+			widths[n++] = strtoul(tok, NULL, 10);
+		}
+		if (n < 2 || NULL == strrchr(urls[0], '/')) continue;
+		sprintf(src, "%s/%s", pubdir, urls[n - 1]);
+		sprintf(dir, "%s/%.*s", dst, (int)(strrchr(urls[0], '/') - urls[0]), urls[0]);
+		if (!streaming) mkdir(dir, 0755);
+		for (i = 0; i + 1 < n; ++i)
+			if (!make_variant(src, dst, urls[i], widths[i]))
+				fprintf(stderr, "warning: failed to resize %s to %upx.\n",
+					src, widths[i]);
+	}
+}
+
+#endif  /* IMAGE_PIPELINE */
@@ -0,0 +1,12 @@
+/* image dimensions, responsive variants & lazy-loading hints */
+#ifndef _PIX_H
+#define _PIX_H
+
+#include "config.h"
+
+extern char *pixstore;
+
+char *expand_images(char *, char *, char *);
+void restore_images(char *, char *, char *);
+
+#endif
@@ -0,0 +1,181 @@
+/* build profiling: wall/cpu time, call counts and bytes written per
+ * phase of generate(), written as a chrome trace (chrome://tracing,
+ * or ui.perfetto.dev), with a summary of phases and the slowest recipes
+ * in the same json object.
+ */
+#include "config.h"
+#include "prof.h"
+#include "based.h"
+
+#include <time.h>
+#include <sys/resource.h>
+
+/* number of slowest recipes listed in the report */
+#define PROF_OUTLIERS 10
+
+struct phasestat {
+	double wall, cpu;         /* accumulated milliseconds */
+	double wall0, cpu0;       /* start of the current call */
+	unsigned long calls;
+	long bytes;
+};
+
+struct recipestat {
+	char slug[SLUG_LEN];
+	double wall;
+	long bytes;
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+	[PHASE_ASSETS]      = "assets",
+	[PHASE_CACHE_PARSE] = "cache parse",
+	[PHASE_SCANDIR]     = "scandir",
+	[PHASE_RELATED]     = "related",
+	[PHASE_MDPARSE]     = "mdparse",
+	[PHASE_COMPILE]     = "discount compile",
+	[PHASE_UNITS]       = "expand_units",
+	[PHASE_IMAGES]      = "expand_images",
+	[PHASE_GIT]         = "git",
+	[PHASE_WRITE]       = "write recipe",
+	[PHASE_DATES]       = "date index",
+	[PHASE_FEEDS]       = "feeds",
+	[PHASE_PAGES]       = "paginator",
+	[PHASE_TAGS]        = "tag files",
+	[PHASE_SEARCH]      = "search index",
+	[PHASE_SITEMAP]     = "sitemap",
+	[PHASE_CATALOG]     = "catalog",
+	[PHASE_CACHE_DUMP]  = "cache dump",
+	[PHASE_MANIFEST]    = "manifest",
+	[PHASE_RECIPE]      = "recipe",
+};
+
+bool profiling = false;
+static FILE *trace = NULL;
+static bool first_event = true;
+static double epoch;
+static struct phasestat phases[PHASE_COUNT];
+static struct recipestat recipes[MAX_RECIPES];
+static size_t recipes_seen = 0;
+
+static double
+now(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void
+prof_init(char *file)
+{
+	trace = fopen(file, "w");
+	if (NULL == trace) die("failed to open %s for writing.", file);
+	profiling = true;
+	epoch = now(CLOCK_MONOTONIC);
+	fprintf(trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+}
+
+void
+prof_begin(enum phase p)
+{
+	if (!profiling) return;
+	phases[p].wall0 = now(CLOCK_MONOTONIC);
+	phases[p].cpu0  = now(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/* chrome trace "complete" event, timestamps in microseconds */
+static void
+emit(const char *name, double start, double dur, char *recipe)
+{
+	fprintf(trace, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+		"\"ts\":%.1f,\"dur\":%.1f",
+		first_event ? "" : ",", name,
+		(start - epoch) * 1000.0, dur * 1000.0);
+	if (NULL != recipe)
+		fprintf(trace, ",\"args\":{\"recipe\":\"%s\"}", recipe);
+	fputc('}', trace);
+	first_event = false;
+}
+
+static double
+finish(enum phase p)
+{
+	struct phasestat *s = &phases[p];
+	double wall = now(CLOCK_MONOTONIC) - s->wall0;
+	s->cpu += now(CLOCK_PROCESS_CPUTIME_ID) - s->cpu0;
+	s->wall += wall;
+	++s->calls;
+	return wall;
+}
+
+void
+prof_end(enum phase p)
+{
+	double wall;
+	if (!profiling) return;
+	wall = finish(p);
+	emit(phase_names[p], phases[p].wall0, wall, NULL);
+}
+
+void
+prof_end_recipe(char *slug, long bytes)
+{
+	struct recipestat *r;
+	if (!profiling) return;
+	r = &recipes[recipes_seen++];
+	r->wall = finish(PHASE_RECIPE);
+	r->bytes = bytes;
+	phases[PHASE_RECIPE].bytes += bytes;
+	strncpy(r->slug, slug, SLUG_LEN - 1);
+	emit(phase_names[PHASE_RECIPE], phases[PHASE_RECIPE].wall0, r->wall, slug);
+}
+
+void
+prof_bytes(enum phase p, long bytes)
+{
+	if (profiling) phases[p].bytes += bytes;
+}
+
+static int
+slowest(const void *a, const void *b)
+{
+	double d = ((struct recipestat *)b)->wall - ((struct recipestat *)a)->wall;
+	return (d > 0) - (d < 0);
+}
+
+void
+prof_finish(void)
+{
+	size_t i;
+	double mean = 0;
+	struct rusage usage;
+
+	if (!profiling) return;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(trace, "\n],\n\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,"
+		"\"peak_rss_kb\":%ld},\n",
+		now(CLOCK_MONOTONIC) - epoch, now(CLOCK_PROCESS_CPUTIME_ID),
+		usage.ru_maxrss);
+
+	fprintf(trace, "\"phases\":{");
+	for (i = 0; i < PHASE_COUNT; ++i)
+		fprintf(trace, "%s\n\t\"%s\":{\"calls\":%lu,\"wall_ms\":%.3f,"
+			"\"cpu_ms\":%.3f,\"bytes\":%ld}",
+			i ? "," : "", phase_names[i], phases[i].calls,
+			phases[i].wall, phases[i].cpu, phases[i].bytes);
+	fprintf(trace, "\n},\n");
+
+	for (i = 0; i < recipes_seen; ++i)
+		mean += recipes[i].wall / recipes_seen;
+	qsort(recipes, recipes_seen, sizeof(struct recipestat), slowest);
+	fprintf(trace, "\"recipes\":{\"count\":%lu,\"mean_ms\":%.3f,\"slowest\":[",
+		recipes_seen, mean);
+	for (i = 0; i < recipes_seen && i < PROF_OUTLIERS; ++i)
+		fprintf(trace, "%s\n\t{\"recipe\":\"%s\",\"wall_ms\":%.3f,\"bytes\":%ld}",
+			i ? "," : "", recipes[i].slug, recipes[i].wall, recipes[i].bytes);
+	fprintf(trace, "\n]}}\n");
+
+	fclose(trace);
+	trace = NULL;
+	profiling = false;
+}
@@ -0,0 +1,41 @@
+/* per-phase build profiler, emitting a chrome trace */
+#ifndef _PROF_H
+#define _PROF_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+enum phase {
+	PHASE_ASSETS,      /* fingerprinted assets */
+	PHASE_CACHE_PARSE,
+	PHASE_SCANDIR,
+	PHASE_RELATED,     /* related recipes, ranked before any page */
+	PHASE_MDPARSE,
+	PHASE_COMPILE,     /* markdown engine, nested in mdparse */
+	PHASE_UNITS,       /* expand_units() */
+	PHASE_IMAGES,      /* expand_images() */
+	PHASE_GIT,         /* git log forks */
+	PHASE_WRITE,       /* recipe html files */
+	PHASE_DATES,       /* date index */
+	PHASE_FEEDS,
+	PHASE_PAGES,       /* paginator & index */
+	PHASE_TAGS,        /* @tag files */
+	PHASE_SEARCH,      /* search index */
+	PHASE_SITEMAP,
+	PHASE_CATALOG,     /* catalog.json & catalog.bin */
+	PHASE_CACHE_DUMP,
+	PHASE_MANIFEST,
+	PHASE_RECIPE,      /* everything done for a single recipe */
+	PHASE_COUNT
+};
+
+extern bool profiling;
+
+void prof_init(char *);
+void prof_begin(enum phase);
+void prof_end(enum phase);
+void prof_end_recipe(char *, long);
+void prof_bytes(enum phase, long);
+void prof_finish(void);
+
+#endif
@@ -0,0 +1,384 @@
+/* related recipes.
+ * every recipe is scored against those it shares a tag with, by
+ * weighted jaccard similarity of their tag sets: rare tags say more
+ * about a recipe than common ones, so each tag weighs 1/log2(1 + df),
+ * df being how many recipes have it. tag sets are bitsets, the shared
+ * tags of a pair are the AND of theirs.
+ * the best RELATED_RECIPES of each are kept, in a file next to the
+ * build cache. a recipe's list is only recomputed when it, or a recipe
+ * sharing a tag with it, has a tag that gained or lost recipes (which
+ * changes its weight), or whose recipes' titles or tags changed.
+ */
+#include "config.h"
+
+#if RELATED_RECIPES
+
+#include "related.h"
+#include "based.h"
+
+#include <math.h>
+#include <inttypes.h>
+
+/* Related file format:
+ *	#<tag> <members-hash>\n
+ * for every tag, followed by
+ *	<slug> <title-and-tags-hash>: <related-slug> ...\n
+ * for every recipe.
+ */
+static const char FMT_RELATED_TAG[]  = "#%s %016" PRIx64 "\n";
+static const char SCAN_RELATED_TAG[] = "#%29s %16" SCNx64;
+static const char FMT_RELATED_HEAD[]  = "%s %016" PRIx64 ":";
+static const char SCAN_RELATED_HEAD[] = "%127s %16" SCNx64 ":%n";
+
+#define NONE ((size_t)-1)
+
+struct item {
+	char slug[SLUG_LEN];
+	char title[TITLE_LEN];
+	unsigned tags[TAG_COUNT];
+	unsigned ntags;
+	uint64_t sig;      /* hash of title & tags */
+	double weight;     /* of its tags */
+	size_t rel[RELATED_RECIPES];
+	unsigned nrel;
+	double score[RELATED_RECIPES];
+	/* as of the last build */
+	bool known;
+	uint64_t oldsig;
+	size_t old[RELATED_RECIPES];
+	unsigned nold;
+	bool changed;      /* its list renders differently than last build */
+	char *html;
+};
+
+struct tag {
+	char name[TAG_NAME_LEN];
+	size_t df;
+	double weight;
+	uint64_t members, oldmembers;
+	bool hot;          /* its recipes, or their weights, changed */
+	bool stale;        /* related lists of its recipes need recomputing */
+	size_t first;      /* into `postings` */
+};
+
+static struct item *items = NULL;
+static size_t count = 0, capacity = 0;
+static struct tag *tags = NULL;
+static size_t ntags = 0, tagcapacity = 0;
+/* tag numbers + 1 by name hash, 0 for empty */
+static unsigned *table = NULL;
+static size_t tablesize = 0;
+static bool built = false;
+
+static unsigned
+tag_number(const char *name, bool add)
+{
+	size_t i, j;
+	uint64_t h;
+
+	if (add && 2 * (ntags + 1) > tablesize) {
+		free(table);
+		tablesize = tablesize ? 2 * tablesize : 256;
+		table = calloc(tablesize, sizeof(*table));
+		if (NULL == table) die("could not allocate tag table.");
+		for (j = 0; j < ntags; ++j) {
+			h = hash_bytes(tags[j].name, strlen(tags[j].name), HASH_SEED);
+			for (i = h & (tablesize - 1); 0 != table[i]; i = (i + 1) & (tablesize - 1)) ;
+			table[i] = j + 1;
+		}
+	}
+	if (0 == tablesize) return 0;
+	h = hash_bytes(name, strlen(name), HASH_SEED);
+	for (i = h & (tablesize - 1); 0 != table[i]; i = (i + 1) & (tablesize - 1))
+		if (0 == strcmp(tags[table[i] - 1].name, name))
+			return table[i];
+	if (!add) return 0;
+	if (ntags == tagcapacity) {
+		tagcapacity = tagcapacity ? 2 * tagcapacity : 256;
+		tags = realloc(tags, tagcapacity * sizeof(*tags));
+		if (NULL == tags) die("could not allocate tag list.");
+	}
+	memset(&tags[ntags], 0, sizeof(*tags));
+	strcpy(tags[ntags].name, name);
+	table[i] = ++ntags;
+	return ntags;
+}
+
+/* adds a recipe, by its slug, title and tags. */
+void
+related_add(struct md *meta)
+{
+	struct item *item;
+	char (*tag)[TAG_NAME_LEN];
+
+	if (count == capacity) {
+		capacity = capacity ? 2 * capacity : MAX_RECIPES;
+		items = realloc(items, capacity * sizeof(*items));
+		if (NULL == items) die("could not allocate related recipes.");
+	}
+	item = &items[count++];
+	memset(item, 0, sizeof(*item));
+	strcpy(item->slug, meta->slug);
+	strcpy(item->title, meta->title);
+	item->sig = hash_bytes(meta->title, strlen(meta->title) + 1, HASH_SEED);
+	for (tag = &meta->tags[0]; tag < &meta->tags[TAG_COUNT]
+	     && (*tag)[0] != '\0'; ++tag) {
+		item->tags[item->ntags++] = tag_number(*tag, true) - 1;
+		item->sig = hash_bytes(*tag, strlen(*tag) + 1, item->sig);
+	}
+}
+
+static int
+itemcmp(const void *a, const void *b)
+{
+	return strcmp(((const struct item *)a)->slug, ((const struct item *)b)->slug);
+}
+
+static size_t
+item_number(const char *slug)
+{
+	struct item key, *item;
+
+	strncpy(key.slug, slug, sizeof(key.slug) - 1);
+	key.slug[sizeof(key.slug) - 1] = '\0';
+	item = bsearch(&key, items, count, sizeof(*items), itemcmp);
+	return NULL == item ? NONE : (size_t)(item - items);
+}
+
+/* what the last build left, tags and recipes that are gone are
+ * simply not looked up. */
+static void
+load(char *file)
+{
+	FILE *f;
+	char line[SLUG_LEN * (RELATED_RECIPES + 1) + 64];
+	char name[TAG_NAME_LEN], slug[SLUG_LEN];
+	uint64_t hash;
+	unsigned t;
+	size_t i;
+	struct item *item;
+	char *rel;
+	int n;
+
+	if (NULL == file || NULL == (f = fopen(file, "r"))) return;
+	while (NULL != fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		if ('#' == line[0]) {
+			if (2 == sscanf(line, SCAN_RELATED_TAG, name, &hash)
+			 && 0 != (t = tag_number(name, false)))
+				tags[t - 1].oldmembers = hash;
+			continue;
+		}
+		if (2 != sscanf(line, SCAN_RELATED_HEAD, slug, &hash, &n)
+		 || NONE == (i = item_number(slug)))
+			continue;
+		item = &items[i];
+		item->known = true;
+		item->oldsig = hash;
+		for (rel = strtok(line + n, " "); NULL != rel && item->nold < RELATED_RECIPES;
+		     rel = strtok(NULL, " "))
+			item->old[item->nold++] = item_number(rel);
+	}
+	fclose(f);
+}
+
+static void
+save(char *file)
+{
+	FILE *f;
+	char *buf = NULL;
+	size_t size, i;
+	unsigned k;
+
+	f = open_memstream(&buf, &size);
+	if (NULL == f) die("could not allocate memory for %s.", file);
+	for (i = 0; i < ntags; ++i)
+		fprintf(f, FMT_RELATED_TAG, tags[i].name, tags[i].members);
+	for (i = 0; i < count; ++i) {
+		fprintf(f, FMT_RELATED_HEAD, items[i].slug, items[i].sig);
+		for (k = 0; k < items[i].nrel; ++k)
+			fprintf(f, " %s", items[items[i].rel[k]].slug);
+		fputc('\n', f);
+	}
+	fclose(f);
+	if (!write_atomic(file, buf, size))
+		fprintf(stderr, "warning: could not write %s.\n", file);
+	free(buf);
+}
+
+/* keeps the best scoring recipes, highest first, ties in slug order */
+static void
+rank(struct item *item, size_t other, double score)
+{
+	unsigned k;
+
+	if (item->nrel == RELATED_RECIPES
+	 && score <= item->score[RELATED_RECIPES - 1])
+		return;
+	if (item->nrel < RELATED_RECIPES) ++item->nrel;
+	for (k = item->nrel - 1; k > 0 && (score > item->score[k - 1]
+	     || (score == item->score[k - 1] && other < item->rel[k - 1])); --k) {
+		item->score[k] = item->score[k - 1];
+		item->rel[k]   = item->rel[k - 1];
+	}
+	item->score[k] = score;
+	item->rel[k]   = other;
+}
+
+/* scores recipe `i` against every recipe sharing a tag with it. */
+static void
+relate(size_t i, uint64_t *bits, size_t words, size_t *postings, size_t *seen)
+{
+	struct item *item = &items[i];
+	uint64_t *a = &bits[i * words], *b, shared;
+	double common;
+	size_t p, s, w;
+	unsigned k;
+
+	item->nrel = 0;
+	for (k = 0; k < item->ntags; ++k) {
+		for (p = tags[item->tags[k]].first;
+		     p < tags[item->tags[k]].first + tags[item->tags[k]].df; ++p) {
+			s = postings[p];
+			if (s == i || seen[s] == i + 1) continue;
+			seen[s] = i + 1;
+			b = &bits[s * words];
+			for (common = 0, w = 0; w < words; ++w)
+				for (shared = a[w] & b[w]; 0 != shared; shared &= shared - 1)
+					common += tags[w * 64 + __builtin_ctzll(shared)].weight;
+			rank(item, s, common / (item->weight + items[s].weight - common));
+		}
+	}
+}
+
+/* ranks the related recipes of everything added, reusing the lists
+ * kept in `file` (if not NULL) where nothing they depend on changed,
+ * and writes them back to it. */
+void
+related_build(char *file)
+{
+	uint64_t *bits;
+	size_t *postings, *seen;
+	size_t words, i, t, p;
+	unsigned k;
+	bool stale;
+
+	qsort(items, count, sizeof(*items), itemcmp);
+	load(file);
+
+	/* tag frequencies, and who has them */
+	for (i = 0; i < count; ++i)
+		for (k = 0; k < items[i].ntags; ++k) {
+			t = items[i].tags[k];
+			++tags[t].df;
+			tags[t].members = hash_bytes(items[i].slug, strlen(items[i].slug) + 1,
+				tags[t].members ? tags[t].members : HASH_SEED);
+		}
+	for (t = 0, i = 0; t < ntags; ++t) {
+		tags[t].first = i;
+		tags[t].weight = 1.0 / log2(1.0 + tags[t].df);
+		tags[t].hot = tags[t].members != tags[t].oldmembers;
+		i += tags[t].df;
+		tags[t].df = 0;  /* counted again while posting */
+	}
+	words = (ntags + 63) / 64;
+	bits = calloc(count * words + 1, sizeof(*bits));
+	postings = malloc((i + 1) * sizeof(*postings));
+	seen = calloc(count + 1, sizeof(*seen));
+	if (NULL == bits || NULL == postings || NULL == seen)
+		die("could not allocate related recipes.");
+	for (i = 0; i < count; ++i) {
+		for (k = 0; k < items[i].ntags; ++k) {
+			t = items[i].tags[k];
+			bits[i * words + t / 64] |= (uint64_t)1 << (t % 64);
+			items[i].weight += tags[t].weight;
+			postings[tags[t].first + tags[t].df++] = i;
+			/* a recipe's title or tags changed */
+			if (!items[i].known || items[i].sig != items[i].oldsig)
+				tags[t].hot = true;
+		}
+	}
+
+	/* a score changes with the weight of either recipe, so every
+	 * recipe sharing a tag with one having a hot tag is rescored */
+	for (t = 0; t < ntags; ++t) {
+		if (!tags[t].hot) continue;
+		for (p = tags[t].first; p < tags[t].first + tags[t].df; ++p)
+			for (k = 0; k < items[postings[p]].ntags; ++k)
+				tags[items[postings[p]].tags[k]].stale = true;
+	}
+
+	for (i = 0; i < count; ++i) {
+		stale = !items[i].known || NULL == file;
+		for (k = 0; !stale && k < items[i].ntags; ++k)
+			stale = tags[items[i].tags[k]].stale;
+		for (k = 0; !stale && k < items[i].nold; ++k)
+			stale = NONE == items[i].old[k];
+		if (stale) {
+			relate(i, bits, words, postings, seen);
+		} else {
+			items[i].nrel = items[i].nold;
+			memcpy(items[i].rel, items[i].old, sizeof(items[i].old));
+		}
+		/* its list, or the title of a recipe on it, changed */
+		items[i].changed = !items[i].known || items[i].nrel != items[i].nold;
+		for (k = 0; k < items[i].nrel && !items[i].changed; ++k)
+			items[i].changed = items[i].rel[k] != items[i].old[k]
+				|| items[items[i].rel[k]].sig != items[items[i].rel[k]].oldsig;
+	}
+	free(bits);
+	free(postings);
+	free(seen);
+	if (NULL != file) save(file);
+	built = true;
+}
+
+/* the related recipes section of a recipe page, empty if it has none. */
+const char *
+related_html(const char *slug)
+{
+	struct item *item;
+	FILE *f;
+	size_t i, size;
+	unsigned k;
+
+	if (!built || NONE == (i = item_number(slug))) return "";
+	item = &items[i];
+	if (0 == item->nrel) return "";
+	if (NULL != item->html) return item->html;
+	f = open_memstream(&item->html, &size);
+	if (NULL == f) die("could not allocate memory for related recipes.");
+	fprintf(f, FMT_HTML_RELATED_START);
+	for (k = 0; k < item->nrel; ++k) {
+		fprintf(f, FMT_HTML_RELATED_ENTRY,
+			items[item->rel[k]].slug, items[item->rel[k]].title);
+		if (k + 1 < item->nrel) fprintf(f, FMT_HTML_TAG_SEP);
+	}
+	fprintf(f, FMT_HTML_RELATED_END);
+	fclose(f);
+	return item->html;
+}
+
+/* the recipe's page needs rewriting, for its related recipes. */
+bool
+related_changed(const char *slug)
+{
+	size_t i = item_number(slug);
+	return NONE != i && items[i].changed;
+}
+
+void
+related_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) free(items[i].html);
+	free(items);
+	free(tags);
+	free(table);
+	items = NULL; tags = NULL; table = NULL;
+	count = capacity = ntags = tagcapacity = tablesize = 0;
+	built = false;
+}
+
+#endif  /* RELATED_RECIPES */
@@ -0,0 +1,15 @@
+/* related recipes, by the tags they share */
+#ifndef _RELATED_H
+#define _RELATED_H
+
+#include <stdbool.h>
+#include "config.h"
+#include "md.h"
+
+void related_add(struct md *);
+void related_build(char *);
+const char *related_html(const char *);
+bool related_changed(const char *);
+void related_free(void);
+
+#endif
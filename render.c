@@ -0,0 +1,901 @@
+/* built-in markdown engine.
+ * renders the markdown recipes are written in (headings, lists,
+ * emphasis, links, images, code and autolinks) in one pass, straight
+ * into the caller's buffer. the block and inline rules follow what
+ * discount does with `mkd_flags`, down to its smartypants, so the two
+ * engines agree over src/ (see `based -X`). anything else, such as block
+ * quotes, html or reference links, makes it give up, and mdparse() hands
+ * the recipe to discount instead.
+ */
+#include "config.h"
+#include "render.h"
+#include "based.h"
+
+#include <ctype.h>
+#include <strings.h>
+
+#define TAGS_PREFIX ";tags: "
+#define TAB_STOP 4
+/* characters a backslash escapes */
+#define ESCAPABLE "\\`*_{}[]()#+-.!><"
+#define LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+enum list { UL = 1, OL };
+
+/* a source line, tabs expanded, as trimmed by the list item it is in. */
+struct line {
+	char *s;
+	int n;    /* length, without the newline */
+	int dle;  /* leading blanks */
+};
+
+/* growable memory, kept from one recipe to the next. */
+struct scratch {
+	char *s;
+	size_t len, cap;
+};
+
+struct render {
+	/* caller's buffer, `len` keeps counting past `size` */
+	char *buf;
+	size_t size, len;
+	int flags;
+	bool failed;
+	/* text being rendered inline, smartypants look around it */
+	const char *from, *to;
+	bool squote, dquote;
+	bool linking;  /* inside a link's text, where urls aren't links */
+	/* {metric,imperial} syntax, only used in the ingredients section */
+	enum { BEFORE, UNITS, AFTER } section;
+	int brace;  /* 0 outside braces, 1 metric, 2 imperial */
+	bool braces;
+};
+
+static struct scratch text, para, metric, imperial;
+static struct line *lines = NULL;
+static size_t linecap = 0;
+
+static const struct {
+	char *pat;     /* `<' & `>': preceded by space, followed by non-word */
+	char *entity;
+	size_t eat;    /* characters replaced by the entity */
+} smarties[] = {
+	{ "'s>",      "&rsquo;",  1 },
+	{ "'t>",      "&rsquo;",  1 },
+	{ "'re>",     "&rsquo;",  1 },
+	{ "'ll>",     "&rsquo;",  1 },
+	{ "'ve>",     "&rsquo;",  1 },
+	{ "'m>",      "&rsquo;",  1 },
+	{ "'d>",      "&rsquo;",  1 },
+	{ "---",      "&mdash;",  3 },
+	{ "--",       "&ndash;",  2 },
+	{ "...",      "&hellip;", 3 },
+	{ ". . .",    "&hellip;", 5 },
+	{ "(c)",      "&copy;",   3 },
+	{ "(r)",      "&reg;",    3 },
+	{ "(tm)",     "&trade;",  4 },
+	{ "<3/4>",    "&frac34;", 3 },
+	{ "<3/4ths>", "&frac34;", 3 },
+	{ "<1/2>",    "&frac12;", 3 },
+	{ "<1/4>",    "&frac14;", 3 },
+	{ "<1/4th>",  "&frac14;", 3 },
+};
+
+static void inlines(struct render *, const char *, size_t);
+static void compile(struct render *, struct line *, size_t, bool, bool);
+
+static void
+append(struct scratch *b, const char *s, size_t n)
+{
+	if (b->len + n > b->cap) {
+		b->cap = 2 * (b->len + n) + 256;
+		b->s = realloc(b->s, b->cap);
+		if (NULL == b->s) die("could not allocate memory for recipe.");
+	}
+	memcpy(b->s + b->len, s, n);
+	b->len += n;
+}
+
+/* splits the ingredients between the metric and imperial sections,
+ * as expand_units() does with discount's html. */
+static void
+units(struct render *r, char c)
+{
+	switch (c) {
+	case '{':
+		if (0 == r->brace) { r->brace = 1; r->braces = true; return; }
+		break;
+	case ',':
+		if (1 == r->brace) { r->brace = 2; return; }
+		break;
+	case '}':
+		if (2 == r->brace) { r->brace = 0; return; }
+		break;
+	case '\n':
+		r->brace = 0;
+		break;
+	}
+	if (2 != r->brace) append(&metric, &c, 1);
+	if (1 != r->brace) append(&imperial, &c, 1);
+}
+
+static void
+out(struct render *r, const char *s, size_t n)
+{
+	size_t i;
+
+	if (UNITS == r->section) {
+		for (i = 0; i < n; ++i) units(r, s[i]);
+		return;
+	}
+	if (r->len < r->size)
+		memcpy(r->buf + r->len, s, r->size - r->len < n ? r->size - r->len : n);
+	r->len += n;
+}
+
+static void
+outs(struct render *r, const char *s)
+{
+	out(r, s, strlen(s));
+}
+
+static void
+outc(struct render *r, char c)
+{
+	out(r, &c, 1);
+}
+
+/* closes the ingredients section, either as it was written,
+ * or split into the two units sections. */
+static void
+end_units(struct render *r)
+{
+	r->section = AFTER;
+	if (!r->braces) {
+		out(r, imperial.s, imperial.len);
+		return;
+	}
+	outs(r, HTML_UNITS_METRIC);
+	out(r, metric.s, metric.len);
+	outs(r, "\n</details>\n");
+	outs(r, HTML_UNITS_IMPERIAL);
+	out(r, imperial.s, imperial.len);
+	outs(r, "\n</details>\n");
+}
+
+/* html escaping for code, and (with quotes) attribute values. */
+static void
+escape(struct render *r, const char *s, size_t n, bool attr)
+{
+	for (; n--; ++s) switch (*s) {
+	case '&': outs(r, "&amp;"); break;
+	case '<': outs(r, "&lt;");  break;
+	case '>': outs(r, "&gt;");  break;
+	case '"':
+		if (attr) { outs(r, "&quot;"); break; }
+		/* fall through */
+	default:
+		outc(r, *s);
+	}
+}
+
+/* urls are written as discount's puturl() writes them,
+ * percent-encoding anything but printable ascii. */
+static void
+url(struct render *r, const char *s, size_t n, bool display)
+{
+	unsigned char c;
+	char hex[4];
+
+	for (; n--; ++s) {
+		c = *s;
+		if ('\\' == c && n > 0) {
+			c = *++s, --n;
+			if (!(ispunct(c) || isspace(c))) outc(r, '\\');
+		}
+		if ('&' == c)      outs(r, "&amp;");
+		else if ('<' == c) outs(r, "&lt;");
+		else if ('"' == c) outs(r, "%22");
+		else if (c < 0x80 && (isalnum(c) || ispunct(c) || (display && isspace(c))))
+			outc(r, c);
+		else {
+			sprintf(hex, "%%%02X", c);
+			outs(r, hex);
+		}
+	}
+}
+
+/* character at `p`, or -1 outside the text being rendered. */
+static int
+at(struct render *r, const char *p)
+{
+	return p >= r->from && p < r->to ? (unsigned char)*p : -1;
+}
+
+static bool
+space(int c)
+{
+	return -1 == c || (c < 0x80 && isspace(c));
+}
+
+static bool
+nonword(int c)
+{
+	return space(c) || (c < 0x80 && ispunct(c));
+}
+
+static bool
+like(struct render *r, const char *p, const char *pat)
+{
+	size_t len, i;
+
+	if ('<' == *pat) {
+		if (!space(at(r, p - 1))) return false;
+		++pat;
+	}
+	len = strlen(pat);
+	if ('>' == pat[len - 1]) {
+		if (!nonword(at(r, p + len - 1))) return false;
+		--len;
+	}
+	for (i = 1; i < len; ++i)
+		if (tolower(at(r, p + i)) != pat[i]) return false;
+	return true;
+}
+
+static bool
+quote(struct render *r, const char *p, bool *open, char *lquo, char *rquo)
+{
+	if (*open && nonword(at(r, p + 1))) {
+		outs(r, rquo);
+		*open = false;
+		return true;
+	}
+	if (!*open && nonword(at(r, p - 1)) && -1 != at(r, p + 1)) {
+		outs(r, lquo);
+		*open = true;
+		return true;
+	}
+	return false;
+}
+
+/* smartypants, returns the characters it replaced. */
+static size_t
+pants(struct render *r, const char *p)
+{
+	size_t i;
+	char *pat;
+
+	if ('\'' == *p && quote(r, p, &r->squote, "&lsquo;", "&rsquo;")) return 1;
+	if ('"'  == *p && quote(r, p, &r->dquote, "&ldquo;", "&rdquo;")) return 1;
+	for (i = 0; i < LEN(smarties); ++i) {
+		pat = smarties[i].pat;
+		if (*p == pat['<' == pat[0]] && like(r, p, pat)) {
+			outs(r, smarties[i].entity);
+			return smarties[i].eat;
+		}
+	}
+	return 0;
+}
+
+static size_t
+codespan(struct render *r, const char *p, const char *e)
+{
+	const char *q, *s, *t;
+	size_t k, m;
+
+	for (k = 0; p + k < e && '`' == p[k]; ++k) ;
+	for (q = p + k; q < e; q += m ? m : 1) {
+		for (m = 0; q + m < e && '`' == q[m]; ++m) ;
+		if (m != k) continue;
+		for (s = p + k; s < q && ' ' == *s; ++s) ;
+		for (t = q; t > s && ' ' == t[-1]; --t) ;
+		outs(r, "<code>");
+		escape(r, s, t - s, false);
+		outs(r, "</code>");
+		return q + m - p;
+	}
+	return 0;
+}
+
+static size_t
+emphasis(struct render *r, const char *p, const char *e)
+{
+	static const char *open[]  = { "<em>",  "<strong>",  "<strong><em>" };
+	static const char *close[] = { "</em>", "</strong>", "</em></strong>" };
+	const char *q;
+	size_t k, m;
+
+	for (k = 0; p + k < e && *p == p[k]; ++k) ;
+	if (k > 3 || space(at(r, p + k))) return 0;
+	for (q = p + k; q < e; q += m) {
+		if ('\\' == *q) { m = 2; continue; }
+		for (m = 0; q + m < e && *p == q[m]; ++m) ;
+		if (0 == m) { m = 1; continue; }
+		if (m != k || space(at(r, q - 1))) continue;
+		outs(r, open[k - 1]);
+		inlines(r, p + k, q - p - k);
+		outs(r, close[k - 1]);
+		return q + k - p;
+	}
+	return 0;
+}
+
+/* [text](url "title") and ![alt](src "title"). */
+static size_t
+link(struct render *r, const char *p, const char *e, bool image)
+{
+	const char *text, *close, *href, *hrefend, *title, *titleend, *q;
+	char delim;
+	int depth;
+
+	text = p + 1 + image;
+	for (depth = 0, q = text; q < e; ++q) {
+		if ('\\' == *q) ++q;
+		else if ('[' == *q) ++depth;
+		else if (']' == *q && 0 == depth--) break;
+	}
+	if (q + 1 >= e || '(' != q[1]) return 0;
+	close = q;
+	for (q = close + 2; q < e && ' ' == *q; ++q) ;
+	if (q < e && '<' == *q) {
+		for (href = ++q; q < e && '>' != *q; ++q) ;
+		if (q >= e) return 0;
+		hrefend = q++;
+	} else {
+		for (depth = 0, href = q; q < e && !isspace((unsigned char)*q); ++q) {
+			if ('(' == *q) ++depth;
+			else if (')' == *q && 0 == depth--) break;
+		}
+		hrefend = q;
+	}
+	while (q < e && isspace((unsigned char)*q)) ++q;
+	title = titleend = NULL;
+	if (q < e && ('"' == *q || '\'' == *q)) {
+		for (delim = *q, title = ++q; q < e; ++q) {
+			if (delim != *q) continue;
+			for (titleend = q++; q < e && ' ' == *q; ++q) ;
+			if (q < e && ')' == *q) break;
+			q = titleend;
+			titleend = NULL;
+		}
+		if (NULL == titleend) return 0;
+	}
+	if (q >= e || ')' != *q) return 0;
+
+	outs(r, image ? "<img src=\"" : "<a href=\"");
+	url(r, href, hrefend - href, false);
+	outc(r, '"');
+	if (NULL != title) {
+		outs(r, " title=\"");
+		escape(r, title, titleend - title, true);
+		outc(r, '"');
+	}
+	if (image) {
+		outs(r, " alt=\"");
+		escape(r, text, close - text, true);
+		outs(r, "\" />");
+	} else {
+		outc(r, '>');
+		r->linking = true;
+		inlines(r, text, close - text);
+		r->linking = false;
+		outs(r, "</a>");
+	}
+	return q + 1 - p;
+}
+
+static bool
+isurl(const char *p, const char *e)
+{
+	static const char *schemes[] = { "https://", "http://", "ftp://" };
+	size_t i, n;
+
+	for (i = 0; i < LEN(schemes); ++i) {
+		n = strlen(schemes[i]);
+		if ((size_t)(e - p) > n && 0 == strncasecmp(p, schemes[i], n))
+			return true;
+	}
+	return false;
+}
+
+static void
+anchor(struct render *r, const char *s, size_t n)
+{
+	outs(r, "<a href=\"");
+	url(r, s, n, false);
+	outs(r, "\">");
+	url(r, s, n, true);
+	outs(r, "</a>");
+}
+
+/* <https://...>, or raw html, which only discount knows. */
+static size_t
+angle(struct render *r, const char *p, const char *e)
+{
+	const char *q;
+
+	for (q = p + 1; q < e && '>' != *q && !isspace((unsigned char)*q); ++q) ;
+	if (q < e && '>' == *q && !r->linking && isurl(p + 1, q)) {
+		anchor(r, p + 1, q - p - 1);
+		return q + 1 - p;
+	}
+	if (p + 1 < e && (isalpha((unsigned char)p[1]) || NULL != strchr("/!?", p[1])))
+		r->failed = true;
+	outs(r, "&lt;");
+	return 1;
+}
+
+/* bare urls (MKD_AUTOLINK), up to a blank or bracket. */
+static size_t
+bare(struct render *r, const char *p, const char *e)
+{
+	const char *q;
+
+	if (r->linking || !isurl(p, e)) return 0;
+	for (q = p; q < e && !isspace((unsigned char)*q)
+	         && NULL == strchr("'\"()[]{}<>`", *q); ++q)
+		if ('\\' == *q && q + 1 < e) ++q;
+	anchor(r, p, q - p);
+	return q - p;
+}
+
+static size_t
+entity(struct render *r, const char *p, const char *e)
+{
+	const char *q = p + 1;
+
+	if (q < e && '#' == *q) ++q;
+	while (q < e && isalnum((unsigned char)*q)) ++q;
+	if (q > p + 1 && q < e && ';' == *q) {
+		out(r, p, q + 1 - p);
+		return q + 1 - p;
+	}
+	outs(r, "&amp;");
+	return 1;
+}
+
+static void
+inlines(struct render *r, const char *s, size_t n)
+{
+	const char *p = s, *e = s + n, *q;
+	size_t used;
+
+	while (p < e && !r->failed) {
+		if (0 != (used = pants(r, p))) {
+			p += used;
+			continue;
+		}
+		switch (*p) {
+		case '\\':
+			if (p + 1 < e && '\0' != p[1] && NULL != strchr(ESCAPABLE, p[1])) {
+				escape(r, p + 1, 1, false);
+				used = 2;
+			}
+			break;
+		case '`':
+			if (0 == (used = codespan(r, p, e)))
+				for (; p + used < e && '`' == p[used]; ++used) outc(r, '`');
+			break;
+		case '*':
+		case '_':
+			if (0 == (used = emphasis(r, p, e)))
+				for (; p + used < e && *p == p[used]; ++used) outc(r, *p);
+			break;
+		case '!':
+			if (p + 1 < e && '[' == p[1]) used = link(r, p, e, true);
+			break;
+		case '[':
+			used = link(r, p, e, false);
+			break;
+		case '<':
+			used = angle(r, p, e);
+			break;
+		case '&':
+			used = entity(r, p, e);
+			break;
+		case ' ':
+			/* two trailing spaces break the line */
+			for (q = p; q < e && ' ' == *q; ++q) ;
+			if (q - p >= 2 && q < e && '\n' == *q) {
+				outs(r, "<br/>\n");
+				used = q + 1 - p;
+			}
+			break;
+		default:
+			if (isalpha((unsigned char)*p) && !isalnum(at(r, p - 1)))
+				used = bare(r, p, e);
+		}
+		if (0 == used) {
+			outc(r, *p);
+			used = 1;
+		}
+		p += used;
+	}
+}
+
+/* renders a paragraph or heading, from the start of its smartypants. */
+static void
+span(struct render *r, const char *s, size_t n)
+{
+	r->from = s;
+	r->to = s + n;
+	r->squote = r->dquote = false;
+	inlines(r, s, n);
+}
+
+static bool
+blank(struct line *l)
+{
+	return l->dle == l->n;
+}
+
+static void
+trim(struct line *l, int clip)
+{
+	if (clip > l->n) clip = l->n;
+	l->s += clip;
+	l->n -= clip;
+	for (l->dle = 0; l->dle < l->n && ' ' == l->s[l->dle]; ++l->dle) ;
+}
+
+static bool
+ishr(struct line *l)
+{
+	int i, count = 0;
+	char dash = 0;
+
+	if (l->dle >= 4) return false;
+	for (i = 0; i < l->n; ++i) {
+		if (0 == dash && ('-' == l->s[i] || '_' == l->s[i] || '*' == l->s[i]))
+			dash = l->s[i];
+		if (dash == l->s[i]) ++count;
+		else if (' ' != l->s[i]) return false;
+	}
+	return count >= 3;
+}
+
+static bool
+ishdr(struct line *l)
+{
+	return 0 == l->dle && l->n > 1 && '#' == l->s[0];
+}
+
+static bool
+isfence(struct line *l)
+{
+	return l->dle < 4 && l->n - l->dle >= 3
+	    && (0 == strncmp(l->s + l->dle, "```", 3) || 0 == strncmp(l->s + l->dle, "~~~", 3));
+}
+
+/* returns the kind of list the line is an item of, if any,
+ * and where its text starts. */
+static int
+islist(struct line *l, int *clip)
+{
+	char *s = l->s;
+	int i, j;
+
+	if (blank(l) || ishr(l) || ishdr(l)) return 0;
+	if (l->dle + 1 < l->n && NULL != strchr("*-+", s[l->dle]) && ' ' == s[l->dle + 1]) {
+		for (i = l->dle + 1; i < l->n && ' ' == s[i]; ++i) ;
+		*clip = i > 4 ? 4 : i;
+		return UL;
+	}
+	for (j = l->dle; j < l->n && ' ' != s[j]; ++j) ;
+	if (j > l->dle + 1 && '.' == s[j - 1]) {
+		for (i = l->dle; i < j - 1 && isdigit((unsigned char)s[i]); ++i) ;
+		if (i == j - 1) {
+			for (i = j; i < l->n && ' ' == s[i]; ++i) ;
+			*clip = i > 4 ? 4 : i;
+			return OL;
+		}
+	}
+	return 0;
+}
+
+static size_t
+code(struct render *r, struct line *l, size_t i, size_t count)
+{
+	size_t j, last;
+
+	for (last = j = i; j < count && (blank(&l[j]) || l[j].dle >= 4); ++j)
+		if (!blank(&l[j])) last = j;
+	outs(r, "<pre><code>");
+	for (j = i; j <= last; ++j) {
+		if (l[j].n > 4) escape(r, l[j].s + 4, l[j].n - 4, false);
+		outc(r, '\n');
+	}
+	outs(r, "</code></pre>\n\n");
+	return last + 1;
+}
+
+static size_t
+fenced(struct render *r, struct line *l, size_t i, size_t count)
+{
+	struct line *f = &l[i];
+	char mark = f->s[f->dle];
+	int n, k;
+	size_t j;
+
+	for (n = f->dle; n < f->n && mark == f->s[n]; ++n) ;
+	/* discount turns info strings into classes */
+	for (k = n; k < f->n && ' ' == f->s[k]; ++k) ;
+	if (k < f->n) {
+		r->failed = true;
+		return count;
+	}
+	n -= f->dle;
+	for (j = i + 1; j < count; ++j) {
+		if (!isfence(&l[j]) || l[j].s[l[j].dle] != mark) continue;
+		for (k = l[j].dle; k < l[j].n && mark == l[j].s[k]; ++k) ;
+		if (k - l[j].dle < n) continue;
+		while (k < l[j].n && ' ' == l[j].s[k]) ++k;
+		if (k == l[j].n) break;
+	}
+	if (j == count) {
+		r->failed = true;
+		return count;
+	}
+	outs(r, "<pre><code>");
+	for (++i; i < j; ++i) {
+		escape(r, l[i].s, l[i].n, false);
+		outc(r, '\n');
+	}
+	outs(r, "</code></pre>\n\n");
+	return j + 1;
+}
+
+static void
+header(struct render *r, struct line *h)
+{
+	char *s = h->s, *e = h->s + h->n;
+	char tag[8];
+	int level;
+
+	for (level = 0; s < e && level < 6 && '#' == *s; ++level) ++s;
+	while (s < e && ' ' == *s) ++s;
+	while (e > s && ' ' == e[-1]) --e;
+	while (e > s && '#' == e[-1]) --e;
+	while (e > s && ' ' == e[-1]) --e;
+
+	/* the ingredients section ends with the contribution section */
+	if (UNITS == r->section && 2 == level && e - s >= 7 && 0 == strncmp(s, "Contrib", 7))
+		end_units(r);
+	sprintf(tag, "<h%d>", level);
+	outs(r, tag);
+	span(r, s, e - s);
+	sprintf(tag, "</h%d>", level);
+	outs(r, tag);
+	if ((r->flags & RENDER_UNITS) && BEFORE == r->section && 2 == level
+	 && e - s == 11 && 0 == strncmp(s, "Ingredients", 11))
+		r->section = UNITS;
+	outs(r, "\n\n");
+}
+
+/* paragraphs in lists end at the next item, top-level ones don't.
+ * `p` wraps the text in <p>, like the items of a loose list. */
+static size_t
+paragraph(struct render *r, struct line *l, size_t i, size_t count, bool toplevel, bool p)
+{
+	size_t j;
+	int clip;
+
+	para.len = 0;
+	for (j = i; j < count; ++j) {
+		if (j > i && (blank(&l[j]) || ishr(&l[j]) || ishdr(&l[j]) || isfence(&l[j])
+		           || (!toplevel && islist(&l[j], &clip))))
+			break;
+		if (j > i) append(&para, "\n", 1);
+		append(&para, l[j].s + l[j].dle, l[j].n - l[j].dle);
+	}
+	while (para.len > 0 && ' ' == para.s[para.len - 1]) --para.len;
+
+	if (p) outs(r, "<p>");
+	span(r, para.s, para.len);
+	if (p) outs(r, "</p>\n\n");
+	else if (j < count) outc(r, '\n');
+	return j;
+}
+
+/* trims the lines of the list item at `i` as far as its marker,
+ * or its indentation, goes. returns where the item ends. */
+static size_t
+item(struct line *l, size_t i, size_t count, int clip)
+{
+	int indent = clip, z;
+	size_t t = i, q;
+
+	for (;;) {
+		trim(&l[t], clip);
+		if (indent > 4) indent = 4;
+		for (q = t + 1; q < count && blank(&l[q]); ++q) ;
+		if (q == count) return t + 1;
+		/* after a blank line, the item goes on while indented */
+		if (q != t + 1) {
+			if (l[q].dle < indent) return t + 1;
+			indent = clip ? clip : 2;
+		}
+		if (l[q].dle < indent && (ishr(&l[q]) || islist(&l[q], &z)) && !ishdr(&l[q]))
+			return t + 1;
+		clip = l[q].dle > indent ? indent : l[q].dle;
+		t = q;
+	}
+}
+
+static size_t
+list(struct render *r, struct line *l, size_t i, size_t count)
+{
+	size_t end, q;
+	int clip;
+	bool loose = false, more;
+	enum list type = islist(&l[i], &clip);
+
+	outs(r, OL == type ? "<ol>\n" : "<ul>\n");
+	for (;;) {
+		end = item(l, i, count, clip);
+		for (q = end; q < count && blank(&l[q]); ++q) ;
+		more = q < count && 0 != islist(&l[q], &clip);
+		/* items next to a blank line are wrapped in <p> */
+		outs(r, "<li>");
+		compile(r, l + i, end - i, false, loose || (more && q != end));
+		outs(r, "</li>\n");
+		if (!more) break;
+		loose = q != end;
+		i = q;
+	}
+	outs(r, OL == type ? "</ol>\n\n" : "</ul>\n\n");
+	return end;
+}
+
+static void
+compile(struct render *r, struct line *l, size_t count, bool toplevel, bool p)
+{
+	size_t i, j;
+	int clip;
+
+	for (i = 0; i < count && blank(&l[i]); ++i) ;
+	while (i < count && !r->failed) {
+		if (isfence(&l[i])) {
+			j = fenced(r, l, i, count);
+		} else if (l[i].dle >= 4) {
+			j = code(r, l, i, count);
+		} else if (ishr(&l[i])) {
+			outs(r, "<hr />\n\n");
+			j = i + 1;
+		} else if (islist(&l[i], &clip)) {
+			j = list(r, l, i, count);
+		} else if (ishdr(&l[i])) {
+			header(r, &l[i]);
+			j = i + 1;
+		} else {
+			j = paragraph(r, l, i, count, toplevel, p || toplevel);
+		}
+		for (p = false; j < count && blank(&l[j]); ++j) p = true;
+		i = j;
+	}
+}
+
+static void
+tags(struct md *md, const char *s, const char *eol)
+{
+	size_t tag, n;
+
+	for (tag = 0; tag < TAG_COUNT - 1 && '\0' != md->tags[tag][0]; ++tag) ;
+	for (; s < eol && tag < TAG_COUNT - 1; s += n + 1) {
+		for (n = 0; s + n < eol && ' ' != s[n]; ++n) ;
+		if (n > 0) memcpy(md->tags[tag++], s, n < TAG_NAME_LEN ? n : TAG_NAME_LEN - 1);
+	}
+}
+
+/* markdown that only discount knows about, looked for line by line:
+ * block quotes, html, reference links, setext headings, alphabetic
+ * and definition lists, and `` quotes. */
+static bool
+unsupported(const char *p, const char *eol, bool follows)
+{
+	const char *s = p;
+
+	while (s < eol && (' ' == *s || '\t' == *s)) ++s;
+	if (s == eol) return false;
+	if ('>' == *s || '=' == *p) return true;
+	if ('<' == *s && s + 1 < eol && (isalpha((unsigned char)s[1]) || NULL != strchr("/!?", s[1])))
+		return true;
+	if ('[' == *s && NULL != memchr(s, ']', eol - s)
+	 && ((char *)memchr(s, ']', eol - s))[1] == ':')
+		return true;
+	if (follows && '-' == *p) {
+		for (s = p; s < eol && '-' == *s; ++s) ;
+		while (s < eol && ' ' == *s) ++s;
+		if (s == eol) return true;
+	}
+	p = s;
+	if (p + 2 < eol && isalpha((unsigned char)p[0]) && '.' == p[1] && ' ' == p[2])
+		return true;
+	for (; p + 1 < eol; ++p)
+		if ('`' == p[0] && '`' == p[1]) return true;
+	return false;
+}
+
+/* splits the recipe into lines, expanding tabs, and takes out
+ * its title and ;tags: lines. returns -1 for unsupported markdown. */
+static long
+split(struct md *md, const char *src, size_t len)
+{
+	const char *p, *eol, *end = src + len;
+	size_t count = 0, start, i, n;
+	bool follows = false;
+
+	/* room for every tab expanded, so `text` doesn't move */
+	text.len = 0;
+	if (text.cap < len * TAB_STOP + 1) {
+		text.cap = len * TAB_STOP + 1;
+		free(text.s);
+		if (NULL == (text.s = malloc(text.cap)))
+			die("could not allocate memory for recipe.");
+	}
+	for (p = src; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (NULL == eol) eol = end;
+		n = eol - p;
+		if (n >= sizeof(TAGS_PREFIX) - 1 && 0 == strncmp(p, TAGS_PREFIX, sizeof(TAGS_PREFIX) - 1)) {
+			tags(md, p + sizeof(TAGS_PREFIX) - 1, eol);
+			continue;
+		}
+		if (unsupported(p, eol, follows)) return -1;
+		/* the #/<h1> header title */
+		if (n > 2 && '#' == p[0] && ' ' == p[1] && '\0' == md->title[0])
+			memcpy(md->title, p + 2, n - 2 < TITLE_LEN ? n - 2 : TITLE_LEN - 1);
+
+		start = text.len;
+		for (i = 0; i < n; ++i) {
+			if ('\t' == p[i])
+				do append(&text, " ", 1); while ((text.len - start) % TAB_STOP);
+			else
+				append(&text, p + i, 1);
+		}
+		if (count == linecap) {
+			linecap = 2 * linecap + 64;
+			lines = realloc(lines, linecap * sizeof(*lines));
+			if (NULL == lines) die("could not allocate memory for recipe.");
+		}
+		lines[count].s = text.s + start;
+		lines[count].n = text.len - start;
+		trim(&lines[count], 0);
+		follows = !blank(&lines[count]);
+		++count;
+	}
+	return count;
+}
+
+/* renders the recipe `src`, filling in the title and tags of `md`.
+ * the html is written into `buf`, NUL-terminated if it fits.
+ * returns its length, which may be `size` or more, or -1 when
+ * discount has to render the recipe instead. */
+long
+render_recipe(struct md *md, const char *src, size_t len, char *buf, size_t size, int flags)
+{
+	struct render r = { 0 };
+	long count;
+
+	memset(md->title, 0, sizeof(md->title));
+	memset(md->tags, 0, sizeof(md->tags));
+	r.buf = buf;
+	r.size = size;
+	r.flags = flags;
+	metric.len = imperial.len = 0;
+
+	if (-1 == (count = split(md, src, len))) return -1;
+	compile(&r, lines, count, true, true);
+	if (r.failed) return -1;
+
+	if (UNITS == r.section) {
+		end_units(&r);
+	} else if ((flags & RENDER_UNITS) && BEFORE == r.section) {
+		fprintf(stderr, "%swarning%s: recipe missing important sections.\n",
+			ansi(BOLD), ansi(RESET));
+		fprintf(stderr, " · missing ingredients section.\n");
+	}
+	if (r.len < size) buf[r.len] = '\0';
+	return r.len;
+}
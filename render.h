@@ -0,0 +1,13 @@
+/* built-in markdown engine, for the recipe dialect */
+#ifndef _RENDER_H
+#define _RENDER_H
+
+#include <stddef.h>
+#include "md.h"
+
+/* expand {metric,imperial} units (see expand_units()) while rendering */
+#define RENDER_UNITS 1
+
+long render_recipe(struct md *, const char *, size_t, char *, size_t, int);
+
+#endif
@@ -1,6 +1,11 @@
-#include "rss.h"
 #include "config.h"
+#include "rss.h"
 #include "based.h"
+#include "prof.h"
+#include "output.h"
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
 
 static void
 xmlencode(char *dst, char *src)
@@ -24,42 +29,144 @@ xmlencode(char *dst, char *src)
 	}
 }
 
-void write_rss_init(FILE *f)
+#define FEED_HISTORY_NS "http://purl.org/syndication/history/1.0"
+
+/* paging links of one feed document (RFC 5005 archived feeds).
+ * archive 0 is the subscription document (rss.xml/atom.xml),
+ * archives 1..n are numbered from oldest to newest.
+ * a tag's feeds are a subscription document without archives. */
+struct feedpage {
+	unsigned archive, prev, next;
+	char updated[26];
+	const char *tag;  /* NULL for the site's feeds */
+};
+
+static void
+feed_title(char *title, struct feedpage *page)
+{
+	if (NULL == page->tag) strcpy(title, PAGE_TITLE);
+	else sprintf(title, FMT_TAG_TITLE, page->tag, PAGE_TITLE);
+}
+
+/* the page a feed document is the feed of */
+static void
+feed_link(char *link, struct feedpage *page)
 {
+	if (NULL == page->tag) sprintf(link, "%s/", PAGE_URL_ROOT);
+	else sprintf(link, "%s/@%s.html", PAGE_URL_ROOT, page->tag);
+}
+
+static void
+feed_files(char *rssfile, char *atomfile, char *dst, struct feedpage *page)
+{
+	if (NULL != page->tag) {
+		sprintf(rssfile,  "%s/" FMT_TAG_RSS_FILE,  dst, page->tag);
+		sprintf(atomfile, "%s/" FMT_TAG_ATOM_FILE, dst, page->tag);
+	} else if (page->archive == 0) {
+		sprintf(rssfile,  "%s/%s", dst, RSS_FILE);
+		sprintf(atomfile, "%s/%s", dst, ATOM_FILE);
+	} else {
+		sprintf(rssfile,  "%s/" FMT_RSS_ARCHIVE_FILE,  dst, page->archive);
+		sprintf(atomfile, "%s/" FMT_ATOM_ARCHIVE_FILE, dst, page->archive);
+	}
+}
+
+static void
+write_rss_init(FILE *f, struct feedpage *page)
+{
+	char title[TAG_NAME_LEN + sizeof(PAGE_TITLE) + 20];
+	char link[PATH_LEN + TAG_NAME_LEN];
+
+	feed_title(title, page);
+	feed_link(link, page);
 	fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-	fprintf(f, "<rss version=\"2.0\">\n");
+	fprintf(f, "<rss version=\"2.0\" "
+		"xmlns:atom=\"http://www.w3.org/2005/Atom\" "
+		"xmlns:fh=\"" FEED_HISTORY_NS "\">\n");
 	fprintf(f, "<channel>\n");
-	fprintf(f, "	<title>%s</title>\n", PAGE_TITLE);
-	fprintf(f, "	<link>%s</link>\n", PAGE_URL_ROOT);
+	fprintf(f, "	<title>%s</title>\n", title);
+	fprintf(f, "	<link>%s</link>\n", NULL == page->tag ? PAGE_URL_ROOT : link);
 	fprintf(f, "	<description>%s</description>\n", DESCRIPTION);
 	fprintf(f, "	<category>%s</category>\n", CATEGORY);
+	if (page->archive != 0) {
+		fprintf(f, "	<fh:archive/>\n");
+		fprintf(f, "	<atom:link rel=\"current\" href=\"%s/%s\"/>\n", PAGE_URL_ROOT, RSS_FILE);
+	}
+	if (page->prev != 0)
+		fprintf(f, "	<atom:link rel=\"prev-archive\" href=\"%s/" FMT_RSS_ARCHIVE_FILE "\"/>\n",
+			PAGE_URL_ROOT, page->prev);
+	if (page->next != 0)
+		fprintf(f, "	<atom:link rel=\"next-archive\" href=\"%s/" FMT_RSS_ARCHIVE_FILE "\"/>\n",
+			PAGE_URL_ROOT, page->next);
 }
 
-void write_atom_init(FILE *f)
+static void
+write_atom_init(FILE *f, struct feedpage *page)
 {
-	time_t today;
-	struct tm *tm;
-	char updated[26] = { 0 };
+	char self[PATH_LEN];
+	char title[TAG_NAME_LEN + sizeof(PAGE_TITLE) + 20];
+	char link[PATH_LEN + TAG_NAME_LEN];
 
-	time(&today);
-	tm = localtime(&today);
-	rfc3339time(updated, tm);
+	if (NULL != page->tag) sprintf(self, FMT_TAG_ATOM_FILE, page->tag);
+	else if (page->archive == 0) sprintf(self, "%s", ATOM_FILE);
+	else sprintf(self, FMT_ATOM_ARCHIVE_FILE, page->archive);
+	feed_title(title, page);
+	feed_link(link, page);
 
 	fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-	fprintf(f, "<feed xmlns=\"http://www.w3.org/2005/Atom\" xml:lang=\"en\">\n");
-	fprintf(f, "	<title type=\"text\">%s</title>\n", PAGE_TITLE);
+	fprintf(f, "<feed xmlns=\"http://www.w3.org/2005/Atom\" "
+		"xmlns:fh=\"" FEED_HISTORY_NS "\" xml:lang=\"en\">\n");
+	fprintf(f, "	<title type=\"text\">%s</title>\n", title);
 	fprintf(f, "	<subtitle type=\"text\">%s</subtitle>\n", DESCRIPTION);
 	fprintf(f, "	<category term=\"%s\"/>\n", CATEGORY);
-	fprintf(f, "	<updated>%s</updated>\n", updated);
-	fprintf(f, "	<link rel=\"alternate\" type=\"text/html\" href=\"%s/\"/>\n", PAGE_URL_ROOT);
-	fprintf(f, "	<id>%s/%s</id>\n", PAGE_URL_ROOT, ATOM_FILE);
-	fprintf(f, "	<link rel=\"self\" type=\"application/atom+xml\" href=\"%s/%s\"/>\n", PAGE_URL_ROOT, ATOM_FILE);
+	fprintf(f, "	<updated>%s</updated>\n", page->updated);
+	fprintf(f, "	<link rel=\"alternate\" type=\"text/html\" href=\"%s\"/>\n", link);
+	fprintf(f, "	<id>%s/%s</id>\n", PAGE_URL_ROOT, self);
+	fprintf(f, "	<link rel=\"self\" type=\"application/atom+xml\" href=\"%s/%s\"/>\n", PAGE_URL_ROOT, self);
+	if (page->archive != 0) {
+		fprintf(f, "	<fh:archive/>\n");
+		fprintf(f, "	<link rel=\"current\" href=\"%s/%s\"/>\n", PAGE_URL_ROOT, ATOM_FILE);
+	}
+	if (page->prev != 0)
+		fprintf(f, "	<link rel=\"prev-archive\" href=\"%s/" FMT_ATOM_ARCHIVE_FILE "\"/>\n",
+			PAGE_URL_ROOT, page->prev);
+	if (page->next != 0)
+		fprintf(f, "	<link rel=\"next-archive\" href=\"%s/" FMT_ATOM_ARCHIVE_FILE "\"/>\n",
+			PAGE_URL_ROOT, page->next);
+}
+
+/* the recipe content embedded in a feed entry.
+ * in summary-only mode, this is the first paragraph of text
+ * (skipping paragraphs that only hold a picture). */
+static int
+feed_html(char *html, char **start)
+{
+	char *end;
+
+	*start = html;
+	if (!FEED_SUMMARY_ONLY) return strlen(html);
+	while (NULL != (*start = strstr(*start, "<p>"))) {
+		if (0 != strncmp(*start + 3, "<img ", 5)) break;
+		++*start;
+	}
+	if (NULL == *start || NULL == (end = strstr(*start, "</p>"))) {
+		*start = html;
+		return 0;
+	}
+	return end + 4 - *start;
 }
 
 void write_rss_entry(FILE *f, struct md *recipe)
 {
 	char (*tag)[TAG_NAME_LEN] = &(recipe->tags[0]);
 	char title[TITLE_LEN + 16] = { 0 };
+	char *html;
+	int htmllen;
+#if GIT_INTEGRATION
+	char publish[40] = { 0 };
+	struct tm tm;
+	strftime(publish, sizeof(publish), FMT_RFC2822, gitdate_tm(&recipe->added, &tm));
+#endif
 	xmlencode(title, recipe->title);
 
 	fprintf(f, "	<item>\n");
@@ -68,12 +175,13 @@ void write_rss_entry(FILE *f, struct md *recipe)
 	fprintf(f, "		<guid isPermaLink=\"true\">%s/%s.html</guid>\n", PAGE_URL_ROOT, recipe->slug);
 #if GIT_INTEGRATION
 	fprintf(f, "		<author>%s</author>\n", recipe->author);
-	fprintf(f, "		<pubDate>%s</pubDate>\n", recipe->adate);
+	fprintf(f, "		<pubDate>%s</pubDate>\n", publish);
 #endif
 	for (; tag[0][0] != '\0'; ++tag)
 		fprintf(f, "		<category>%s</category>\n", tag[0]);
 	fprintf(f, "		<description>\n");
-	fprintf(f, "			<![CDATA[%s]]>\n", recipe->html);
+	htmllen = feed_html(recipe->html, &html);
+	fprintf(f, "			<![CDATA[%.*s]]>\n", htmllen, html);
 	fprintf(f, "		</description>\n");
 	fprintf(f, "	</item>\n");
 }
@@ -82,11 +190,14 @@ void write_atom_entry(FILE *f, struct md *recipe)
 {
 	char (*tag)[TAG_NAME_LEN] = &(recipe->tags[0]);
 	char title[TITLE_LEN + 16] = { 0 };
+	char *html;
+	int htmllen;
 #if GIT_INTEGRATION
 	char publish[26] = { 0 };
 	char updated[26] = { 0 };
-	to_rfc3339(publish, recipe->adate, FMT_RFC2822);
-	to_rfc3339(updated, recipe->mdate, FMT_RFC2822);
+	struct tm tm;
+	rfc3339time(publish, gitdate_tm(&recipe->added, &tm));
+	rfc3339time(updated, gitdate_tm(&recipe->modified, &tm));
 #endif
 
 	xmlencode(title, recipe->title);
@@ -102,18 +213,272 @@ void write_atom_entry(FILE *f, struct md *recipe)
 	for (; tag[0][0] != '\0'; ++tag)
 		fprintf(f, "		<category term=\"%s\" label=\"%s\"/>\n", *tag, *tag);
 	fprintf(f, "		<summary type=\"html\">\n");
-	fprintf(f, "			<![CDATA[%s]]>\n", recipe->html);
+	htmllen = feed_html(recipe->html, &html);
+	fprintf(f, "			<![CDATA[%.*s]]>\n", htmllen, html);
 	fprintf(f, "		</summary>\n");
 	fprintf(f, "	</entry>\n");
 }
 
-void write_rss_end(FILE *f)
+static void
+write_rss_end(FILE *f)
 {
 	fprintf(f, "</channel>\n");
 	fprintf(f, "</rss>\n");
 }
 
-void write_atom_end(FILE *f)
+static void
+write_atom_end(FILE *f)
 {
 	fprintf(f, "</feed>\n");
 }
+
+static void
+date_feed_entry(struct feedentry *entry, struct md *recipe)
+{
+	strcpy(entry->slug, recipe->slug);
+#if GIT_INTEGRATION
+	entry->added   = recipe->added;
+	entry->updated = recipe->modified;
+#else
+	memset(&entry->added,   0, sizeof(entry->added));
+	memset(&entry->updated, 0, sizeof(entry->updated));
+#endif
+}
+
+void
+render_feed_entry(struct feedentry *entry, struct md *recipe)
+{
+	FILE *f;
+	size_t len;
+
+	date_feed_entry(entry, recipe);
+	f = open_memstream(&entry->rss, &len);
+	if (NULL == f) die("could not allocate memory for feed entry.");
+	write_rss_entry(f, recipe);
+	fclose(f);
+	f = open_memstream(&entry->atom, &len);
+	if (NULL == f) die("could not allocate memory for feed entry.");
+	write_atom_entry(f, recipe);
+	fclose(f);
+}
+
+/* fragments rendered by an earlier build, `rss` and `atom` are
+ * taken over by the entry. */
+void
+restore_feed_entry(struct feedentry *entry, struct md *recipe, char *rss, char *atom)
+{
+	date_feed_entry(entry, recipe);
+	entry->rss  = rss;
+	entry->atom = atom;
+}
+
+void
+free_feed_entry(struct feedentry *entry)
+{
+	free(entry->rss);
+	free(entry->atom);
+	entry->rss = entry->atom = NULL;
+}
+
+/* a document was last updated when its newest entry was, 0 if unknown */
+static time_t
+feed_updated(struct feedentry *entries, size_t *order, size_t n)
+{
+	time_t updated = 0;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		if (entries[order[i]].updated.epoch > updated)
+			updated = entries[order[i]].updated.epoch;
+	return updated;
+}
+
+/* writes the `n` entries at `order` into one feed document */
+static void
+write_feed(char *dst, struct feedpage *page, struct feedentry *entries,
+           size_t *order, size_t n)
+{
+	FILE *rssf, *atomf;
+	char rssfile[PATH_LEN * 2 + TAG_NAME_LEN], atomfile[PATH_LEN * 2 + TAG_NAME_LEN];
+	time_t updated;
+	size_t i;
+
+	feed_files(rssfile, atomfile, dst, page);
+	updated = feed_updated(entries, order, n);
+	if (updated == 0) time(&updated);
+	rfc3339time(page->updated, localtime(&updated));
+
+	rssf = output_open(rssfile);
+	atomf = output_open(atomfile);
+	if (NULL == rssf)  die("failed to open %s for writing.", rssfile);
+	if (NULL == atomf) die("failed to open %s for writing.", atomfile);
+	write_rss_init(rssf, page);
+	write_atom_init(atomf, page);
+	for (i = 0; i < n; ++i) {
+		fputs(entries[order[i]].rss, rssf);
+		fputs(entries[order[i]].atom, atomf);
+	}
+	write_rss_end(rssf);
+	write_atom_end(atomf);
+	prof_bytes(PHASE_FEEDS, output_close(rssf));
+	prof_bytes(PHASE_FEEDS, output_close(atomf));
+}
+
+/* writes rss.xml & atom.xml holding the newest FEED_ENTRIES recipes,
+ * and the older recipes into RFC 5005 archive documents.
+ * archives are filled oldest first, so an archive document never
+ * changes once full; new recipes only ever touch the subscription
+ * documents until a new archive fills up.
+ * `order` has the entries newest first, see dates.c.
+ */
+void
+write_feeds(char *dst, struct feedentry *entries, size_t *order, size_t count)
+{
+	struct feedpage page = { 0 };
+	size_t window, archives;
+	unsigned k;
+
+	window = count;
+	archives = 0;
+	if (FEED_ENTRIES > 0) {
+		if (window > FEED_ENTRIES) window = FEED_ENTRIES;
+		archives = count / FEED_ENTRIES;
+	}
+
+	page.prev = archives;
+	write_feed(dst, &page, entries, order, window);
+	for (k = 1; k <= archives; ++k) {
+		page.archive = k;
+		page.prev = k - 1;
+		page.next = k == archives ? 0 : k + 1;
+		/* archive k holds the oldest-first entries [(k - 1)N, kN) */
+		write_feed(dst, &page, entries, order + count - k * FEED_ENTRIES, FEED_ENTRIES);
+	}
+}
+
+#if TAG_FEEDS
+/* Tag feeds file format, a line per tag:
+ *	<fnv1a-64-hex of the entries in its feeds> <tag>\n
+ */
+static const char FMT_TAG_FEED_LINE[] = "%016" PRIx64 " %s\n";
+
+/* when each tag's feeds were last updated, in the order of the tags */
+struct tagfeed {
+	const char *tag;
+	time_t updated;
+};
+static struct tagfeed *tagfeeds = NULL;
+static size_t ntagfeeds = 0;
+
+/* whether `data`, the last build's tag feeds file, has `line` */
+static bool
+has_line(const char *data, const char *line)
+{
+	const char *p;
+
+	for (p = data; NULL != p && NULL != (p = strstr(p, line)); ++p)
+		if (p == data || '\n' == p[-1])
+			return true;
+	return false;
+}
+
+/* writes @<tag>.rss & @<tag>.atom for each of `tags`: the newest entries
+ * (up to FEED_ENTRIES) in `order` whose recipe, at the same position in
+ * `recipes`, has the tag. the entries' fragments are reused as they are.
+ * a tag's feeds are left alone when the fragments hash as they did when
+ * the last build wrote them. returns how many tags' feeds were written.
+ */
+size_t
+write_tag_feeds(char *dst, struct taglist *tags, struct recipelist *recipes,
+                struct feedentry *entries, size_t *order, size_t count)
+{
+	struct feedpage page = { 0 };
+	struct taglist *tag;
+	struct feedentry *e;
+	const char **names;
+	char file[PATH_LEN * 2], line[TAG_NAME_LEN + 20];
+	char rssfile[PATH_LEN * 2 + TAG_NAME_LEN], atomfile[PATH_LEN * 2 + TAG_NAME_LEN];
+	char *data = NULL, *buf = NULL;
+	size_t ntags, limit, *members, *n, size, i, j, k, t, written = 0;
+	uint64_t hash;
+	FILE *f;
+
+	for (ntags = 0, tag = tags; tag != NULL; tag = tag->next) ++ntags;
+	limit = FEED_ENTRIES > 0 && FEED_ENTRIES < count ? FEED_ENTRIES : count;
+	names   = malloc((ntags + 1) * sizeof(*names));
+	members = malloc((ntags * limit + 1) * sizeof(*members));
+	n       = calloc(ntags + 1, sizeof(*n));
+	if (NULL == names || NULL == members || NULL == n)
+		die("could not allocate tag feeds.");
+	for (i = 0, tag = tags; tag != NULL; tag = tag->next)
+		names[i++] = tag->name;
+	/* newest first, into each of the recipe's tags until full */
+	for (j = 0; j < count; ++j) {
+		k = order[j];
+		for (t = 0; t < TAG_COUNT && recipes[k].tags[t][0] != '\0'; ++t) {
+			for (i = 0; i < ntags && 0 != strcoll(names[i], recipes[k].tags[t]); ++i);
+			if (i < ntags && n[i] < limit)
+				members[i * limit + n[i]++] = k;
+		}
+	}
+
+	tag_feeds_free();
+	tagfeeds = calloc(ntags + 1, sizeof(*tagfeeds));
+	if (NULL == tagfeeds) die("could not allocate tag feeds.");
+	for (i = 0; i < ntags; ++i)
+		tagfeeds[ntagfeeds++] = (struct tagfeed){
+			names[i], feed_updated(entries, members + i * limit, n[i]) };
+
+	/* the last build's hashes, a stream has none */
+	snprintf(file, sizeof(file), "%s/%s", dst, TAG_FEEDS_FILE);
+	if (!streaming) data = read_file(file, NULL);
+	f = open_memstream(&buf, &size);
+	if (NULL == f) die("could not allocate tag feeds.");
+	for (i = 0; i < ntags; ++i) {
+		hash = HASH_SEED;
+		for (j = 0; j < n[i]; ++j) {
+			e = &entries[members[i * limit + j]];
+			hash = hash_bytes(e->rss,  strlen(e->rss),  hash);
+			hash = hash_bytes(e->atom, strlen(e->atom), hash);
+		}
+		snprintf(line, sizeof(line), FMT_TAG_FEED_LINE, hash, names[i]);
+		fputs(line, f);
+		page.tag = names[i];
+		feed_files(rssfile, atomfile, dst, &page);
+		if (has_line(data, line)
+		 && 0 == access(rssfile, F_OK) && 0 == access(atomfile, F_OK))
+			continue;
+		write_feed(dst, &page, entries, members + i * limit, n[i]);
+		++written;
+	}
+	fclose(f);
+	if (!streaming && !write_atomic(file, buf, size))
+		die("failed to write %s.", file);
+	free(buf);
+	free(data);
+	free(names);
+	free(members);
+	free(n);
+	return written;
+}
+
+/* when `tag`'s feeds were last updated, 0 if unknown */
+time_t
+tag_feed_lastmod(const char *tag)
+{
+	size_t i;
+
+	for (i = 0; i < ntagfeeds; ++i)
+		if (0 == strcmp(tagfeeds[i].tag, tag))
+			return tagfeeds[i].updated;
+	return 0;
+}
+
+void
+tag_feeds_free(void)
+{
+	free(tagfeeds);
+	tagfeeds = NULL;
+	ntagfeeds = 0;
+}
+#endif
@@ -3,15 +3,32 @@
 #define _RSS_H
 
 #include <stdio.h>
+#include "config.h"
+#include "based.h"
 #include "md.h"
 
-void write_rss_init(FILE *);
-void write_atom_init(FILE *);
+/* a recipe's rendered rss and atom fragments, held on to
+ * until all recipes are known and the feeds can be ordered by date. */
+struct feedentry {
+	struct gitdate added;
+	struct gitdate updated;
+	char slug[SLUG_LEN];
+	char *rss;   /* must be freed! */
+	char *atom;  /* must be freed! */
+};
 
 void write_rss_entry(FILE *, struct md *);
 void write_atom_entry(FILE *, struct md *);
 
-void write_rss_end(FILE *);
-void write_atom_end(FILE *);
+void render_feed_entry(struct feedentry *, struct md *);
+void restore_feed_entry(struct feedentry *, struct md *, char *, char *);
+void free_feed_entry(struct feedentry *);
+void write_feeds(char *, struct feedentry *, size_t *, size_t);
+#if TAG_FEEDS
+size_t write_tag_feeds(char *, struct taglist *, struct recipelist *,
+                       struct feedentry *, size_t *, size_t);
+time_t tag_feed_lastmod(const char *);
+void tag_feeds_free(void);
+#endif
 
 #endif
@@ -0,0 +1,412 @@
+/* source scanning.
+ * the directory is listed up front, then a window of recipes ahead of
+ * the one being rendered is kept in flight on an io_uring: a statx of
+ * the source (mtime & size) and of its html (does it exist), an openat,
+ * and a read of the whole file once its size is known. the ring is set
+ * up with raw syscalls, there's no liburing to depend on.
+ * where io_uring is missing (not linux, old kernels, seccomp), or
+ * BATCHED_IO is off, each file is stat'ed and pread when it is asked for.
+ */
+#include "config.h"
+#include "scan.h"
+#include "based.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if BATCHED_IO && defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#if BATCHED_IO && defined(__linux__) && defined(__NR_io_uring_setup)
+#define URING 1
+#else
+#define URING 0
+#endif
+
+/* files read ahead of the one being rendered */
+#define WINDOW 32
+/* at most three operations per file are in flight at once */
+#define RING_ENTRIES (WINDOW * 4)
+
+enum { QUEUED, OPENING, READING, READY };
+
+/* reads `size` bytes of `fd`, from `done` on, into `text`. */
+static bool
+read_rest(int fd, char *text, size_t done, size_t size)
+{
+	ssize_t n;
+
+	while (done < size) {
+		n = pread(fd, text + done, size - done, done);
+		if (n < 0 && EINTR == errno) continue;
+		if (n <= 0) return false;
+		done += n;
+	}
+	text[size] = '\0';
+	return true;
+}
+
+static void
+sync_read(struct scan *s, struct source *f)
+{
+	char path[PATH_LEN * 2];
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s.md", s->src, f->slug);
+	f->text = NULL;
+	if (NULL != s->dst) {
+		snprintf(path, sizeof(path), "%s/%s.html", s->dst, f->slug);
+		f->dst_exists = 0 == access(path, F_OK);
+		snprintf(path, sizeof(path), "%s/%s.md", s->src, f->slug);
+	}
+	fd = open(path, O_RDONLY);
+	if (-1 == fd) return;
+	if (0 == fstat(fd, &st)) {
+		f->mtime = st.st_mtime;
+		f->size = st.st_size;
+		f->text = malloc(f->size + 1);
+		if (NULL == f->text) die("could not allocate memory for %s.", path);
+		if (!read_rest(fd, f->text, 0, f->size)) {
+			free(f->text);
+			f->text = NULL;
+		}
+	}
+	close(fd);
+}
+
+#if URING
+/* per file state while it's in flight, reused round the window */
+struct slot {
+	char src[PATH_LEN * 2];
+	char dst[PATH_LEN * 2];
+	struct statx srcx, dstx;
+	int srcres, dstres;
+	int fd;
+	int pending;  /* statx & openat completions still to come */
+};
+
+enum op { OP_SRCSTAT, OP_DSTSTAT, OP_OPEN, OP_READ, OP_CLOSE };
+
+static struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned tail, submitted, inflight;
+} ring = { .fd = -1 };
+
+static struct slot slots[WINDOW];
+
+static bool
+ring_supports(void)
+{
+	static const int ops[] = {
+		IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE
+	};
+	struct io_uring_probe *probe;
+	size_t i;
+	bool ok;
+
+	probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+	if (NULL == probe) return false;
+	ok = 0 <= syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256);
+	for (i = 0; ok && i < sizeof(ops) / sizeof(*ops); ++i)
+		ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return ok;
+}
+
+static bool
+ring_init(void)
+{
+	struct io_uring_params p;
+	size_t sqlen, cqlen;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+	if (ring.fd < 0) return false;
+	if (!ring_supports()) goto fail;
+
+	sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		sqlen = cqlen = sqlen > cqlen ? sqlen : cqlen;
+	sq = mmap(NULL, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == sq) goto fail;
+	cq = sq;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL, cqlen, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == cq) goto fail;
+	}
+	ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, IORING_OFF_SQES);
+	if (MAP_FAILED == ring.sqes) goto fail;
+
+	ring.sq_head  = (unsigned *)(sq + p.sq_off.head);
+	ring.sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+	ring.sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring.cq_head  = (unsigned *)(cq + p.cq_off.head);
+	ring.cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+	ring.cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring.cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ring.tail = ring.submitted = *ring.sq_tail;
+	ring.inflight = 0;
+	return true;
+fail:
+	/* the mappings go with the process, this only happens once */
+	close(ring.fd);
+	ring.fd = -1;
+	return false;
+}
+
+static struct io_uring_sqe *
+ring_sqe(int opcode, size_t file, enum op op)
+{
+	struct io_uring_sqe *sqe;
+	unsigned i = ring.tail & *ring.sq_mask;
+
+	sqe = &ring.sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = (uint64_t)file << 3 | op;
+	ring.sq_array[i] = i;
+	++ring.tail;
+	++ring.inflight;
+	return sqe;
+}
+
+/* submits what was queued, waiting for a completion if `wait`. */
+static void
+ring_enter(bool wait)
+{
+	int n;
+
+	__atomic_store_n(ring.sq_tail, ring.tail, __ATOMIC_RELEASE);
+	do n = syscall(__NR_io_uring_enter, ring.fd, ring.tail - ring.submitted,
+	               wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	while (n < 0 && EINTR == errno);
+	if (n < 0) die("io_uring_enter failed.");
+	ring.submitted += n;
+}
+
+static void
+issue(struct scan *s, size_t file)
+{
+	struct slot *slot = &slots[file % WINDOW];
+	struct source *f = &s->files[file];
+	struct io_uring_sqe *sqe;
+
+	snprintf(slot->src, sizeof(slot->src), "%s/%s.md", s->src, f->slug);
+	slot->fd = -1;
+	slot->pending = 2;
+	sqe = ring_sqe(IORING_OP_STATX, file, OP_SRCSTAT);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)slot->src;
+	sqe->len = STATX_MTIME | STATX_SIZE;
+	sqe->off = (uintptr_t)&slot->srcx;
+	sqe = ring_sqe(IORING_OP_OPENAT, file, OP_OPEN);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)slot->src;
+	sqe->open_flags = O_RDONLY;
+	if (NULL != s->dst) {
+		snprintf(slot->dst, sizeof(slot->dst), "%s/%s.html", s->dst, f->slug);
+		++slot->pending;
+		sqe = ring_sqe(IORING_OP_STATX, file, OP_DSTSTAT);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)slot->dst;
+		sqe->len = STATX_TYPE;
+		sqe->off = (uintptr_t)&slot->dstx;
+	}
+	f->state = OPENING;
+}
+
+static void
+close_file(size_t file, int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = ring_sqe(IORING_OP_CLOSE, file, OP_CLOSE);
+	sqe->fd = fd;
+}
+
+/* once the file is stat'ed and open, its read can be started. */
+static void
+opened(struct scan *s, size_t file)
+{
+	struct slot *slot = &slots[file % WINDOW];
+	struct source *f = &s->files[file];
+	struct io_uring_sqe *sqe;
+	struct stat st;
+
+	f->dst_exists = NULL != s->dst && 0 == slot->dstres;
+	if (slot->fd < 0) {
+		f->state = READY;
+		return;
+	}
+	if (0 == slot->srcres) {
+		f->mtime = slot->srcx.stx_mtime.tv_sec;
+		f->size = slot->srcx.stx_size;
+	} else if (0 == fstat(slot->fd, &st)) {
+		f->mtime = st.st_mtime;
+		f->size = st.st_size;
+	}
+	f->text = malloc(f->size + 1);
+	if (NULL == f->text) die("could not allocate memory for %s.", slot->src);
+	if (0 == f->size) {
+		f->text[0] = '\0';
+		f->state = READY;
+		close_file(file, slot->fd);
+		return;
+	}
+	sqe = ring_sqe(IORING_OP_READ, file, OP_READ);
+	sqe->fd = slot->fd;
+	sqe->addr = (uintptr_t)f->text;
+	sqe->len = f->size;
+	sqe->off = 0;
+	f->state = READING;
+}
+
+static void
+complete(struct scan *s, uint64_t data, int res)
+{
+	size_t file = data >> 3;
+	struct slot *slot = &slots[file % WINDOW];
+	struct source *f = &s->files[file];
+
+	--ring.inflight;
+	switch ((enum op)(data & 7)) {
+	case OP_SRCSTAT: slot->srcres = res; break;
+	case OP_DSTSTAT: slot->dstres = res; break;
+	case OP_OPEN:    slot->fd = res;     break;
+	case OP_READ:
+		/* short reads are finished off synchronously */
+		if (res < 0 || !read_rest(slot->fd, f->text, res, f->size)) {
+			free(f->text);
+			f->text = NULL;
+		}
+		f->state = READY;
+		close_file(file, slot->fd);
+		return;
+	case OP_CLOSE:
+		return;
+	}
+	if (0 == --slot->pending) opened(s, file);
+}
+
+static void
+reap(struct scan *s)
+{
+	unsigned head = *ring.cq_head;
+	unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	struct io_uring_cqe *cqe;
+
+	for (; head != tail; ++head) {
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		complete(s, cqe->user_data, cqe->res);
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* starts reading files up to a window ahead of `next`. */
+static void
+refill(struct scan *s)
+{
+	while (s->issued < s->count && s->issued < s->next + WINDOW
+	    && ring.inflight + 3 <= RING_ENTRIES)
+		issue(s, s->issued++);
+}
+#endif  /* URING */
+
+/* lists `src`, as picked by `filter` (all if NULL) and sorted by
+ * `compar` (last first), and starts reading the first recipes.
+ * `dst` is checked for their html, unless NULL.
+ * returns the number of recipes, or -1 if `src` can't be read. */
+int
+scan_open(struct scan *s, char *src, char *dst,
+          int (*filter)(const struct dirent *),
+          int (*compar)(const struct dirent **, const struct dirent **))
+{
+	size_t len;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->src = src;
+	s->dst = dst;
+	s->entries = scandir(src, &s->names, filter, compar);
+	if (-1 == s->entries) return -1;
+	s->files = calloc(s->entries + 1, sizeof(*s->files));
+	if (NULL == s->files) die("could not allocate file list.");
+	for (i = s->entries - 1; i >= 0; --i) {
+		if (s->names[i]->d_name[0] == '.')
+			continue;  /* skip filenames starting with '.' */
+		len = strlen(s->names[i]->d_name);
+		if (len > 3) s->names[i]->d_name[len - 3] = '\0';  /* trim `.md` off */
+		s->files[s->count++].slug = s->names[i]->d_name;
+	}
+#if URING
+	s->batched = -1 != ring.fd || ring_init();
+	if (s->batched) {
+		refill(s);
+		ring_enter(false);
+	}
+#endif
+	return s->count;
+}
+
+/* hands out the next recipe, waiting for its reads if need be.
+ * the previous recipe's text is freed. returns NULL when done. */
+struct source *
+scan_next(struct scan *s)
+{
+	struct source *f;
+
+	if (s->next > 0) {
+		free(s->files[s->next - 1].text);
+		s->files[s->next - 1].text = NULL;
+	}
+	if (s->next == s->count) return NULL;
+	f = &s->files[s->next];
+#if URING
+	if (s->batched) {
+		/* `next` moves on once `f` is ready: its slot is free from then */
+		for (reap(s); READY != f->state; reap(s)) {
+			refill(s);
+			ring_enter(true);
+		}
+		++s->next;
+		refill(s);
+		if (ring.tail != ring.submitted) ring_enter(false);
+		return f;
+	}
+#endif
+	++s->next;
+	sync_read(s, f);
+	f->state = READY;
+	return f;
+}
+
+void
+scan_close(struct scan *s)
+{
+	int i;
+
+	while (NULL != scan_next(s)) ;
+#if URING
+	/* let the last closes land, before the slots are reused */
+	while (s->batched && ring.inflight > 0) {
+		ring_enter(true);
+		reap(s);
+	}
+#endif
+	for (i = 0; i < s->entries; ++i) free(s->names[i]);
+	free(s->names);
+	free(s->files);
+}
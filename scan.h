@@ -0,0 +1,39 @@
+/* reading recipe sources ahead of rendering them */
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stdbool.h>
+#include <dirent.h>
+#include "config.h"
+
+#ifndef __USE_XOPEN
+#define __USE_XOPEN
+#endif
+#include <time.h>
+
+struct source {
+	char *slug;        /* file name, without `.md' */
+	char *text;        /* contents, NUL terminated, NULL if unreadable */
+	size_t size;
+	time_t mtime;
+	bool dst_exists;   /* the recipe's html is in the destination */
+	int state;
+};
+
+struct scan {
+	char *src, *dst;
+	struct dirent **names;
+	int entries;
+	struct source *files;
+	size_t count;
+	size_t next;       /* next file handed out */
+	size_t issued;     /* files whose reads have been started */
+	bool batched;      /* reads go through io_uring */
+};
+
+int scan_open(struct scan *, char *, char *, int (*)(const struct dirent *),
+              int (*)(const struct dirent **, const struct dirent **));
+struct source *scan_next(struct scan *);
+void scan_close(struct scan *);
+
+#endif
@@ -0,0 +1,415 @@
+/* trigram search over recipe titles and tags.
+ * titles and tags are transliterated to ascii (Älplermagronen is
+ * found by "alplermagronen"), lowercased and split into words, and
+ * every word padded with a space either side is cut into trigrams.
+ * the index maps each trigram to the recipes having it, as a delta
+ * and varint coded posting list.
+ * a query counts the trigrams each recipe shares with it, then the
+ * best CANDIDATES are reranked by how many edits turn the query's
+ * words into the recipe's closest words (or their beginnings, for
+ * queries still being typed).
+ */
+#include "config.h"
+
+#if SEARCH_INDEX
+
+#include "search.h"
+#include "output.h"
+#include "prof.h"
+
+#include <iconv.h>
+#include <ctype.h>
+
+/* Search index file format, in host byte order:
+ *	"BTRI" <docs> <trigrams> <postings-size> <strings-size>
+ *	<docs> x <strings-offset>
+ *	<trigrams> x <key> <postings-offset> <count>
+ *	<postings-size> bytes of posting lists
+ *	<strings-size> bytes of strings
+ * all numbers are 32 bit. each doc (recipe, in title order) has three
+ * strings: "<title>\0<url>\0<normalized-words>\0". trigram keys pack
+ * three bytes of normalized words, and are sorted.
+ */
+static const char MAGIC[4] = { 'B', 'T', 'R', 'I' };
+#define HEADER_SIZE (sizeof(MAGIC) + 4 * sizeof(uint32_t))
+
+/* longer words are cut short, for trigrams and edit distances */
+#define WORD_LEN 32
+/* recipes reranked by edit distance, per query */
+#define CANDIDATES 64
+#define QUERY_LEN 256
+
+struct posting {
+	uint32_t key, doc;
+};
+
+struct candidate {
+	uint32_t doc;
+	unsigned shared, distance;
+};
+
+/* transliterates to lowercase ascii letters & digits, in words
+ * separated by single spaces. returns the length. */
+static size_t
+normalize(const char *src, char *dst, size_t size)
+{
+	static iconv_t cd = (iconv_t)-1;
+	char *in = (char *)src, *out = dst, *r, *w;
+	size_t inlen = strlen(src), outlen = size - 1;
+	bool space = true;
+
+	if ((iconv_t)-1 == cd) cd = iconv_open("ASCII//TRANSLIT", "UTF-8");
+	if ((iconv_t)-1 == cd) die("could not open iconv to transliterate.");
+	iconv(cd, NULL, NULL, NULL, NULL);
+	while (inlen > 0 && (size_t)-1 == iconv(cd, &in, &inlen, &out, &outlen)) {
+		if (E2BIG == errno) break;
+		++in;  /* skip what can't be transliterated */
+		--inlen;
+	}
+	*out = '\0';
+
+	for (r = w = dst; '\0' != *r; ++r) {
+		if (isalnum((unsigned char)*r)) {
+			*w++ = tolower((unsigned char)*r);
+			space = false;
+		} else if (!space) {
+			*w++ = ' ';
+			space = true;
+		}
+	}
+	if (w > dst && ' ' == w[-1]) --w;
+	*w = '\0';
+	return w - dst;
+}
+
+static int
+keycmp(const void *_a, const void *_b)
+{
+	uint32_t a = *(const uint32_t *)_a, b = *(const uint32_t *)_b;
+	return (a > b) - (a < b);
+}
+
+/* the distinct trigrams of normalized `text`, sorted. */
+static size_t
+trigrams(const char *text, uint32_t *keys, size_t max)
+{
+	unsigned char pad[WORD_LEN + 2];
+	const char *word, *end;
+	size_t n = 0, len, i, j;
+
+	for (word = text; '\0' != *word; word = '\0' != *end ? end + 1 : end) {
+		end = strchr(word, ' ');
+		if (NULL == end) end = word + strlen(word);
+		len = end - word;
+		if (len > WORD_LEN) len = WORD_LEN;
+		pad[0] = ' ';
+		memcpy(pad + 1, word, len);
+		pad[len + 1] = ' ';
+		for (i = 0; i < len && n < max; ++i)
+			keys[n++] = (uint32_t)pad[i] << 16 | (uint32_t)pad[i + 1] << 8 | pad[i + 2];
+	}
+	qsort(keys, n, sizeof(*keys), keycmp);
+	for (i = j = 0; i < n; ++i)
+		if (0 == j || keys[j - 1] != keys[i]) keys[j++] = keys[i];
+	return j;
+}
+
+static int
+postingcmp(const void *_a, const void *_b)
+{
+	const struct posting *a = _a, *b = _b;
+	if (a->key != b->key) return (a->key > b->key) - (a->key < b->key);
+	return (a->doc > b->doc) - (a->doc < b->doc);
+}
+
+static void
+put_varint(FILE *f, uint32_t n)
+{
+	for (; n >= 0x80; n >>= 7) fputc((n & 0x7f) | 0x80, f);
+	fputc(n, f);
+}
+
+static void
+put_u32(FILE *f, uint32_t n)
+{
+	fwrite(&n, sizeof(n), 1, f);
+}
+
+/* indexes the titles & tags of `recipes`, written to `file`. */
+void
+write_search_index(char *file, struct recipelist *recipes)
+{
+	FILE *f, *strs, *posts;
+	char *strbuf = NULL, *postbuf = NULL;
+	size_t strsize, postsize;
+	char text[TITLE_LEN + TAG_COUNT * TAG_NAME_LEN + 1];
+	char norm[sizeof(text) * 4];
+	uint32_t keys[sizeof(norm)];
+	char (*tag)[TAG_NAME_LEN];
+	struct recipelist *recipe;
+	struct posting *postings = NULL;
+	uint32_t *docoff = NULL, *table, doc, prev, trigramcount;
+	size_t npostings = 0, capacity = 0, docs, n, i, j;
+
+	strs = open_memstream(&strbuf, &strsize);
+	posts = open_memstream(&postbuf, &postsize);
+	if (NULL == strs || NULL == posts) die("could not allocate search index.");
+	for (docs = 0, recipe = recipes; NULL != recipe; recipe = recipe->next) ++docs;
+	docoff = malloc((docs + 1) * sizeof(*docoff));
+	if (NULL == docoff) die("could not allocate search index.");
+
+	for (doc = 0, recipe = recipes; NULL != recipe; recipe = recipe->next, ++doc) {
+		n = sprintf(text, "%s", recipe->title);
+		for (tag = &recipe->tags[0]; tag < &recipe->tags[TAG_COUNT] && (*tag)[0] != '\0'; ++tag)
+			n += sprintf(text + n, " %.*s", TAG_NAME_LEN, *tag);
+		normalize(text, norm, sizeof(norm));
+		docoff[doc] = ftell(strs);
+		fprintf(strs, "%s%c%s%c%s%c", recipe->title, '\0', recipe->url, '\0', norm, '\0');
+
+		n = trigrams(norm, keys, sizeof(keys) / sizeof(*keys));
+		if (npostings + n > capacity) {
+			capacity = 2 * (npostings + n);
+			postings = realloc(postings, capacity * sizeof(*postings));
+			if (NULL == postings) die("could not allocate search index.");
+		}
+		for (i = 0; i < n; ++i)
+			postings[npostings++] = (struct posting){ keys[i], doc };
+	}
+	qsort(postings, npostings, sizeof(*postings), postingcmp);
+
+	/* posting lists, and the table pointing into them */
+	table = malloc((3 * npostings + 1) * sizeof(*table));
+	if (NULL == table) die("could not allocate search index.");
+	for (trigramcount = 0, i = 0; i < npostings; i = j, ++trigramcount) {
+		table[3 * trigramcount]     = postings[i].key;
+		table[3 * trigramcount + 1] = ftell(posts);
+		for (prev = 0, j = i; j < npostings && postings[j].key == postings[i].key; ++j) {
+			put_varint(posts, postings[j].doc - prev);
+			prev = postings[j].doc;
+		}
+		table[3 * trigramcount + 2] = j - i;
+	}
+	fflush(posts);
+	fflush(strs);
+
+	f = output_open(file);
+	if (NULL == f) die("failed to open %s for writing.", file);
+	fwrite(MAGIC, sizeof(MAGIC), 1, f);
+	put_u32(f, docs);
+	put_u32(f, trigramcount);
+	put_u32(f, postsize);
+	put_u32(f, strsize);
+	fwrite(docoff, sizeof(*docoff), docs, f);
+	fwrite(table, 3 * sizeof(*table), trigramcount, f);
+	fwrite(postbuf, 1, postsize, f);
+	fwrite(strbuf, 1, strsize, f);
+	prof_bytes(PHASE_SEARCH, output_close(f));
+
+	fclose(strs);
+	fclose(posts);
+	free(strbuf);
+	free(postbuf);
+	free(postings);
+	free(docoff);
+	free(table);
+}
+
+/* loads an index written by write_search_index().
+ * returns false if it can't be read, or isn't an index. */
+bool
+search_open(struct search_index *ix, const char *file)
+{
+	uint32_t header[4];
+	size_t size, tablesize;
+
+	memset(ix, 0, sizeof(*ix));
+	ix->data = read_file(file, &size);
+	if (NULL == ix->data) return false;
+	if (size < HEADER_SIZE || 0 != memcmp(ix->data, MAGIC, sizeof(MAGIC)))
+		goto bad;
+	memcpy(header, ix->data + sizeof(MAGIC), sizeof(header));
+	ix->docs = header[0];
+	ix->trigrams = header[1];
+	tablesize = 3 * sizeof(uint32_t) * (size_t)ix->trigrams;
+	if (size != HEADER_SIZE + sizeof(uint32_t) * (size_t)ix->docs + tablesize
+	          + header[2] + header[3])
+		goto bad;
+	/* read_file()'s buffer is malloc aligned, and so are the tables */
+	ix->docoff   = (const uint32_t *)(ix->data + HEADER_SIZE);
+	ix->table    = ix->docoff + ix->docs;
+	ix->postings = (const unsigned char *)(ix->table + 3 * (size_t)ix->trigrams);
+	ix->strings  = (const char *)ix->postings + header[2];
+	ix->shared  = calloc(ix->docs + 1, sizeof(*ix->shared));
+	ix->touched = malloc((ix->docs + 1) * sizeof(*ix->touched));
+	if (NULL == ix->shared || NULL == ix->touched)
+		die("could not allocate memory for searching.");
+	return true;
+bad:
+	free(ix->data);
+	ix->data = NULL;
+	return false;
+}
+
+void
+search_close(struct search_index *ix)
+{
+	free(ix->data);
+	free(ix->shared);
+	free(ix->touched);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/* optimal string alignment distance: edits, swapping neighbours
+ * counting as one. */
+static unsigned
+edits(const char *a, size_t alen, const char *b, size_t blen)
+{
+	unsigned rows[3][WORD_LEN + 1], *prev2, *prev, *row, *spare, cost, best;
+	size_t i, j;
+
+	if (alen > WORD_LEN) alen = WORD_LEN;
+	if (blen > WORD_LEN) blen = WORD_LEN;
+	prev2 = rows[0]; prev = rows[1]; row = rows[2];
+	for (j = 0; j <= blen; ++j) prev[j] = j;
+	for (i = 1; i <= alen; ++i) {
+		row[0] = i;
+		for (j = 1; j <= blen; ++j) {
+			cost = a[i - 1] != b[j - 1];
+			best = prev[j - 1] + cost;
+			if (prev[j] + 1 < best) best = prev[j] + 1;
+			if (row[j - 1] + 1 < best) best = row[j - 1] + 1;
+			if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]
+			 && prev2[j - 2] + 1 < best)
+				best = prev2[j - 2] + 1;
+			row[j] = best;
+		}
+		spare = prev2; prev2 = prev; prev = row; row = spare;
+	}
+	return prev[blen];
+}
+
+/* edits from each query word to its closest word (or word beginning)
+ * in `words`, summed. */
+static unsigned
+distance(const char *query, const char *words)
+{
+	const char *q, *qend, *w, *wend;
+	unsigned total = 0, best, d;
+	size_t qlen, wlen;
+
+	for (q = query; '\0' != *q; q = '\0' != *qend ? qend + 1 : qend) {
+		qend = strchr(q, ' ');
+		if (NULL == qend) qend = q + strlen(q);
+		qlen = qend - q;
+		best = qlen;
+		for (w = words; '\0' != *w && best > 0; w = '\0' != *wend ? wend + 1 : wend) {
+			wend = strchr(w, ' ');
+			if (NULL == wend) wend = w + strlen(w);
+			wlen = wend - w;
+			d = edits(q, qlen, w, wlen);
+			if (d < best) best = d;
+			if (wlen > qlen && (d = edits(q, qlen, w, qlen)) < best) best = d;
+		}
+		total += best;
+	}
+	return total;
+}
+
+static int
+by_shared(const void *_a, const void *_b)
+{
+	const struct candidate *a = _a, *b = _b;
+	if (a->shared != b->shared) return a->shared < b->shared ? 1 : -1;
+	return (a->doc > b->doc) - (a->doc < b->doc);
+}
+
+static int
+by_distance(const void *_a, const void *_b)
+{
+	const struct candidate *a = _a, *b = _b;
+	if (a->distance != b->distance) return a->distance > b->distance ? 1 : -1;
+	return by_shared(_a, _b);
+}
+
+static const uint32_t *
+find_trigram(struct search_index *ix, uint32_t key)
+{
+	size_t lo = 0, hi = ix->trigrams, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ix->table[3 * mid] < key) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == ix->trigrams || ix->table[3 * lo] != key) return NULL;
+	return &ix->table[3 * lo];
+}
+
+/* looks `query` up, filling in at most `max` hits, best first.
+ * returns how many hits there are. */
+size_t
+search_query(struct search_index *ix, const char *query, struct search_hit *hits, size_t max)
+{
+	char norm[QUERY_LEN];
+	uint32_t keys[QUERY_LEN];
+	struct candidate candidates[CANDIDATES], c;
+	const uint32_t *entry;
+	const unsigned char *p;
+	const char *str;
+	size_t n, k, i, touched = 0, count = 0, letters;
+	uint32_t doc, delta;
+	unsigned shift;
+
+	letters = normalize(query, norm, sizeof(norm));
+	n = trigrams(norm, keys, sizeof(keys) / sizeof(*keys));
+	for (k = 0; k < n; ++k) {
+		entry = find_trigram(ix, keys[k]);
+		if (NULL == entry) continue;
+		p = ix->postings + entry[1];
+		for (doc = 0, i = 0; i < entry[2]; ++i) {
+			for (delta = 0, shift = 0; *p & 0x80; shift += 7)
+				delta |= (uint32_t)(*p++ & 0x7f) << shift;
+			delta |= (uint32_t)*p++ << shift;
+			doc += delta;
+			if (0 == ix->shared[doc]++) ix->touched[touched++] = doc;
+		}
+	}
+
+	/* the recipes sharing the most trigrams, as a bounded sorted list */
+	for (i = 0; i < touched; ++i) {
+		doc = ix->touched[i];
+		c.doc = doc;
+		c.shared = ix->shared[doc];
+		c.distance = 0;
+		ix->shared[doc] = 0;  /* clean for the next query */
+		if (count == CANDIDATES && by_shared(&c, &candidates[count - 1]) >= 0)
+			continue;
+		if (count < CANDIDATES) ++count;
+		for (k = count - 1; k > 0 && by_shared(&c, &candidates[k - 1]) < 0; --k)
+			candidates[k] = candidates[k - 1];
+		candidates[k] = c;
+	}
+
+	/* rerank by edits, dropping those too far off */
+	for (i = k = 0; i < count; ++i) {
+		str = ix->strings + ix->docoff[candidates[i].doc];
+		str += strlen(str) + 1;  /* url */
+		str += strlen(str) + 1;  /* words */
+		candidates[i].distance = distance(norm, str);
+		if (candidates[i].distance <= 1 + letters / 3)
+			candidates[k++] = candidates[i];
+	}
+	count = k;
+	qsort(candidates, count, sizeof(*candidates), by_distance);
+
+	for (i = 0; i < count && i < max; ++i) {
+		str = ix->strings + ix->docoff[candidates[i].doc];
+		hits[i].title = str;
+		hits[i].url = str + strlen(str) + 1;
+		hits[i].shared = candidates[i].shared;
+		hits[i].distance = candidates[i].distance;
+	}
+	return i;
+}
+
+#endif  /* SEARCH_INDEX */
@@ -0,0 +1,35 @@
+/* trigram search over recipe titles and tags */
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "based.h"
+
+struct search_hit {
+	const char *title;
+	const char *url;
+	unsigned shared;    /* trigrams in common with the query */
+	unsigned distance;  /* edits from the query to the closest words */
+};
+
+/* an index as loaded from the file, see search.c */
+struct search_index {
+	char *data;
+	uint32_t docs, trigrams;
+	const uint32_t *docoff;
+	const uint32_t *table;   /* key, postings offset, count */
+	const unsigned char *postings;
+	const char *strings;
+	/* query scratch space */
+	uint16_t *shared;
+	uint32_t *touched;
+};
+
+void write_search_index(char *, struct recipelist *);
+bool search_open(struct search_index *, const char *);
+size_t search_query(struct search_index *, const char *, struct search_hit *, size_t);
+void search_close(struct search_index *);
+
+#endif
@@ -0,0 +1,192 @@
+/* sharded builds.
+ * a shard renders only the recipes whose slug hashes to it, and leaves
+ * its part of everything built from all recipes (recipe list, tags and
+ * feed fragments) in a partial file in the destination directory.
+ * merging reads back every partial and writes the index, paginator,
+ * tag pages and feeds, as one build would have.
+ */
+#include "config.h"
+#include "shard.h"
+
+#include <dirent.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+/* Partial file format, one entry per recipe:
+ *	<slug>:\n
+ *	\t<title>\n
+ *	\t<tags>\n
+ *	\t<added> <updated> <rss-length> <atom-length>\n
+ *	<rss-fragment><atom-fragment>\n
+ * and with CATALOG, its catalog entry:
+ *	\t<html-offset> <html-length>\t<author>\t<images>\n
+ * the dates are "<epoch> <utc-offset-seconds>". the fragments are
+ * written as they are, hence their lengths.
+ */
+static const char FMT_PARTIAL_FEED[]  = "\t%lld %ld %lld %ld %zu %zu\n";
+static const char SCAN_PARTIAL_FEED[] = "\t%lld %ld %lld %ld %zu %zu%*c";
+#if CATALOG
+static const char FMT_PARTIAL_CATALOG[] = "\t%" PRIu32 " %" PRIu32 "\t%s\t%s\n";
+#endif
+
+/* parses "<k>/<n>", shards are numbered from 1. */
+bool
+parse_shard(const char *spec, unsigned *k, unsigned *n)
+{
+	char end;
+
+	if (NULL == spec || 2 != sscanf(spec, "%u/%u%c", k, n, &end))
+		return false;
+	return 0 < *k && *k <= *n;
+}
+
+bool
+in_shard(const char *slug, unsigned k, unsigned n)
+{
+	return hash_bytes(slug, strlen(slug), HASH_SEED) % n == k - 1;
+}
+
+/* writes the `count` recipes built by this shard, with their
+ * feed and catalog entries (in the same order as `recipes`).
+ * the file is replaced whole, a merge never sees half of it. */
+void
+write_partial(char *file, struct recipelist *recipes, struct feedentry *feeds,
+              struct catalogentry *catalog, size_t count)
+{
+	FILE *f;
+	char *buf = NULL;
+	char (*tag)[TAG_NAME_LEN];
+	size_t i, size, rsslen, atomlen;
+
+	f = open_memstream(&buf, &size);
+	if (NULL == f) die("could not allocate memory for %s.", file);
+	for (i = 0; i < count; ++i) {
+		fprintf(f, "%s:\n\t%s\n\t", feeds[i].slug, recipes[i].title);
+		for (tag = &recipes[i].tags[0]; (*tag)[0] != '\0'; ++tag)
+			fprintf(f, "%s%s", *tag, tag[1][0] == '\0' ? "" : " ");
+		rsslen  = strlen(feeds[i].rss);
+		atomlen = strlen(feeds[i].atom);
+		fprintf(f, "\n");
+		fprintf(f, FMT_PARTIAL_FEED,
+			(long long)feeds[i].added.epoch,   feeds[i].added.offset,
+			(long long)feeds[i].updated.epoch, feeds[i].updated.offset,
+			rsslen, atomlen);
+		fwrite(feeds[i].rss,  1, rsslen,  f);
+		fwrite(feeds[i].atom, 1, atomlen, f);
+		fputc('\n', f);
+#if CATALOG
+		fprintf(f, FMT_PARTIAL_CATALOG, catalog[i].offset, catalog[i].length,
+			catalog[i].author, catalog[i].images);
+#else
+		(void)catalog;
+#endif
+	}
+	fclose(f);
+	if (!write_atomic(file, buf, size)) die("failed to write %s.", file);
+	free(buf);
+}
+
+/* checks `dst` holds the partials of every shard of one sharded build.
+ * returns how many shards there were, 0 if there are no partials. */
+unsigned
+find_partials(char *dst)
+{
+	struct dirent **names;
+	unsigned k, n, shards = 0;
+	bool *seen = NULL;
+	int count, i;
+
+	count = scandir(dst, &names, NULL, alphasort);
+	if (-1 == count) die("could not open destination directory: %s.", dst);
+	for (i = 0; i < count; free(names[i++])) {
+		if (2 != sscanf(names[i]->d_name, FMT_SHARD_FILE, &k, &n)
+		 || 0 == k || k > n)
+			continue;
+		if (0 == shards) {
+			shards = n;
+			seen = calloc(n + 1, sizeof(*seen));
+			if (NULL == seen) die("could not allocate shard list.");
+		} else if (n != shards) {
+			die("%s has partials of %u and of %u shards.", dst, shards, n);
+		}
+		seen[k] = true;
+	}
+	free(names);
+	for (k = 1; k <= shards; ++k)
+		if (!seen[k]) die("shard %u/%u is missing from %s.", k, shards, dst);
+	free(seen);
+	return shards;
+}
+
+FILE *
+open_partial(char *dst, unsigned k, unsigned n)
+{
+	char file[PATH_LEN * 2];
+	FILE *f;
+
+	snprintf(file, sizeof(file), "%s/" FMT_SHARD_FILE, dst, k, n);
+	f = fopen(file, "r");
+	if (NULL == f) die("failed to open %s.", file);
+	return f;
+}
+
+/* reads the next recipe of a partial into `meta` (slug, title & tags),
+ * `entry`, whose fragments must be freed, and `catalog`.
+ * returns false at the end of the partial. */
+bool
+read_partial(FILE *f, struct md *meta, struct feedentry *entry,
+             struct catalogentry *catalog)
+{
+	char line[TAG_COUNT * TAG_NAME_LEN + 2];
+	long long added, updated;
+	size_t len, rsslen, atomlen;
+#if CATALOG
+	char cat[sizeof(*catalog) + 32], *author, *images;
+#endif
+
+	memset(meta, 0, sizeof(*meta));
+	memset(entry, 0, sizeof(*entry));
+	memset(catalog, 0, sizeof(*catalog));
+	if (NULL == fgets(line, sizeof(line), f)) return false;
+	len = strlen(line);
+	if (len < 3 || len - 2 >= SLUG_LEN || 0 != strcmp(line + len - 2, ":\n"))
+		die("malformed partial entry: %s", line);
+	memcpy(meta->slug, line, len - 2);
+	if (NULL == fgets(line, sizeof(line), f) || '\t' != line[0])
+		die("malformed partial entry for %s.", meta->slug);
+	line[strcspn(line, "\n")] = '\0';
+	strncpy(meta->title, line + 1, sizeof(meta->title) - 1);
+	if (NULL == fgets(line, sizeof(line), f) || '\t' != line[0])
+		die("malformed partial entry for %s.", meta->slug);
+	line[strcspn(line, "\n")] = '\0';
+	tags_from_string(meta->tags, line + 1);
+	if (6 != fscanf(f, SCAN_PARTIAL_FEED, &added, &entry->added.offset,
+	                &updated, &entry->updated.offset, &rsslen, &atomlen))
+		die("malformed partial entry for %s.", meta->slug);
+
+	strcpy(entry->slug, meta->slug);
+	entry->added.epoch   = added;
+	entry->updated.epoch = updated;
+	entry->rss  = malloc(rsslen + 1);
+	entry->atom = malloc(atomlen + 1);
+	if (NULL == entry->rss || NULL == entry->atom)
+		die("could not allocate memory for %s.", meta->slug);
+	if (rsslen  != fread(entry->rss,  1, rsslen,  f)
+	 || atomlen != fread(entry->atom, 1, atomlen, f)
+	 || '\n' != fgetc(f))
+		die("partial entry for %s is cut short.", meta->slug);
+	entry->rss[rsslen]   = '\0';
+	entry->atom[atomlen] = '\0';
+#if CATALOG
+	if (NULL == fgets(cat, sizeof(cat), f)
+	 || 2 != sscanf(cat, "\t%" SCNu32 " %" SCNu32, &catalog->offset, &catalog->length)
+	 || NULL == (author = strchr(cat + 1, '\t'))
+	 || NULL == (images = strchr(++author, '\t')))
+		die("malformed catalog entry for %s.", meta->slug);
+	*images++ = '\0';
+	images[strcspn(images, "\n")] = '\0';
+	snprintf(catalog->author, sizeof(catalog->author), "%s", author);
+	snprintf(catalog->images, sizeof(catalog->images), "%s", images);
+#endif
+	return true;
+}
@@ -0,0 +1,21 @@
+/* sharded builds: partial results of a shard, merged into the site */
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "config.h"
+#include "based.h"
+#include "md.h"
+#include "rss.h"
+#include "catalog.h"
+
+bool parse_shard(const char *, unsigned *, unsigned *);
+bool in_shard(const char *, unsigned, unsigned);
+void write_partial(char *, struct recipelist *, struct feedentry *,
+                   struct catalogentry *, size_t);
+unsigned find_partials(char *);
+FILE *open_partial(char *, unsigned, unsigned);
+bool read_partial(FILE *, struct md *, struct feedentry *, struct catalogentry *);
+
+#endif
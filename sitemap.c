@@ -0,0 +1,170 @@
+/* sitemap.xml, and when each generated page last changed.
+ * a recipe page changed when its recipe was last committed, a tag page
+ * when the newest of its recipes was, its feeds when the newest of
+ * their entries was, and the index, paginator and feeds when the
+ * newest of all recipes was. these are the only dates
+ * a page's contents depend on, unlike its mtime, which every rebuild
+ * of the page resets.
+ */
+#include "config.h"
+
+#if SITEMAP
+
+#include "sitemap.h"
+#include "output.h"
+#include "prof.h"
+
+static const char FMT_SITEMAP_START[] = {
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<urlset xmlns=\"http://www.sitemaps.org/schemas/sitemap/0.9\">\n"
+};
+/* fmt: char *root, char *path, char *lastmod */
+static const char FMT_SITEMAP_URL[] = {
+	"	<url><loc>%s/%s</loc><lastmod>%s</lastmod></url>\n"
+};
+static const char FMT_SITEMAP_END[] = { "</urlset>\n" };
+
+struct pagedate {
+	char path[PATH_LEN];  /* relative to the destination */
+	time_t lastmod;       /* 0 if unknown */
+};
+
+/* recipe and tag pages, sorted by path */
+static struct pagedate *pages = NULL;
+static size_t pagecount = 0;
+/* when the newest recipe changed */
+static time_t newest = 0;
+
+static int
+pathsort(const void *a, const void *b)
+{
+	return strcmp(((struct pagedate *)a)->path,
+	              ((struct pagedate *)b)->path);
+}
+
+static struct pagedate *
+find_page(const char *path)
+{
+	struct pagedate key;
+
+	if (strlen(path) >= sizeof(key.path)) return NULL;
+	strcpy(key.path, path);
+	return bsearch(&key, pages, pagecount, sizeof(*pages), pathsort);
+}
+
+static bool
+ends_with(const char *s, const char *suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+	return n >= m && 0 == strcmp(s + n - m, suffix);
+}
+
+/* dates every recipe and tag page from the recipes' feed `entries`,
+ * which know when each recipe was added and last modified. */
+void
+sitemap_build(struct feedentry *entries, size_t count, struct recipelist *recipes)
+{
+	struct recipelist *r;
+	struct pagedate *page, *tag;
+	char tagpath[PATH_LEN];
+	size_t capacity, i, t;
+
+	for (capacity = count, r = recipes; r != NULL; r = r->next)
+		for (t = 0; t < TAG_COUNT && r->tags[t][0] != '\0'; ++t)
+			++capacity;
+	pages = calloc(capacity + 1, sizeof(*pages));
+	if (NULL == pages) die("could not allocate memory for %lu sitemap pages.", capacity);
+	for (i = 0; i < count; ++i) {
+		page = &pages[pagecount++];
+		snprintf(page->path, sizeof(page->path), "%s.html", entries[i].slug);
+		page->lastmod = entries[i].updated.epoch ? entries[i].updated.epoch
+		                                         : entries[i].added.epoch;
+		if (page->lastmod > newest) newest = page->lastmod;
+	}
+	/* a tag page per recipe tag, undated, then one per distinct tag */
+	for (r = recipes; r != NULL; r = r->next)
+		for (t = 0; t < TAG_COUNT && r->tags[t][0] != '\0'; ++t)
+			snprintf(pages[pagecount++].path, sizeof(pages->path), "@%s.html", r->tags[t]);
+	qsort(pages, pagecount, sizeof(*pages), pathsort);
+	for (capacity = pagecount, pagecount = i = 0; i < capacity; ++i)
+		if (pagecount == 0 || 0 != strcmp(pages[pagecount - 1].path, pages[i].path))
+			pages[pagecount++] = pages[i];
+	/* tag pages changed when their newest recipe did */
+	for (r = recipes; r != NULL; r = r->next) {
+		page = find_page(r->url + 2);  /* skip `./' */
+		if (NULL == page) continue;
+		for (t = 0; t < TAG_COUNT && r->tags[t][0] != '\0'; ++t) {
+			snprintf(tagpath, sizeof(tagpath), "@%s.html", r->tags[t]);
+			tag = find_page(tagpath);
+			if (NULL != tag && page->lastmod > tag->lastmod)
+				tag->lastmod = page->lastmod;
+		}
+	}
+	if (newest == 0) time(&newest);
+}
+
+/* when the generated file at `path` last changed, 0 if unknown */
+time_t
+sitemap_lastmod(const char *path)
+{
+	struct pagedate *page = find_page(path);
+#if TAG_FEEDS
+	char tag[TAG_NAME_LEN];
+	time_t lastmod;
+#endif
+
+	if (NULL != page) return page->lastmod ? page->lastmod : newest;
+#if TAG_FEEDS
+	/* a tag's feeds changed when their newest entry did */
+	if ('@' == path[0] && NULL == strchr(path, '/')
+	 && (ends_with(path, ".rss") || ends_with(path, ".atom"))) {
+		snprintf(tag, sizeof(tag), "%.*s", (int)(strrchr(path, '.') - path - 1), path + 1);
+		lastmod = tag_feed_lastmod(tag);
+		return lastmod ? lastmod : newest;
+	}
+#endif
+	/* index, paginator and feeds list the newest recipes */
+	if (NULL == strchr(path, '/')
+	 && (ends_with(path, ".html") || ends_with(path, ".xml")))
+		return newest;
+	return 0;
+}
+
+static void
+write_url(FILE *f, const char *path, time_t lastmod)
+{
+	char date[32];
+
+	rfc3339time(date, localtime(&lastmod));
+	fprintf(f, FMT_SITEMAP_URL, PAGE_URL_ROOT, path, date);
+}
+
+/* writes `dst`/SITEMAP_FILE, listing the index, recipe and tag pages */
+void
+write_sitemap(char *dst)
+{
+	FILE *f;
+	char file[PATH_LEN * 2];
+	size_t i;
+
+	sprintf(file, "%s/%s", dst, SITEMAP_FILE);
+	f = output_open(file);
+	if (NULL == f) die("failed to open %s for writing.", file);
+	fputs(FMT_SITEMAP_START, f);
+	write_url(f, "", newest);  /* the index */
+	for (i = 0; i < pagecount; ++i)
+		write_url(f, pages[i].path, pages[i].lastmod ? pages[i].lastmod : newest);
+	fputs(FMT_SITEMAP_END, f);
+	prof_bytes(PHASE_SITEMAP, output_close(f));
+}
+
+void
+sitemap_free(void)
+{
+	free(pages);
+	pages = NULL;
+	pagecount = 0;
+	newest = 0;
+}
+
+#endif
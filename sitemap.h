@@ -0,0 +1,15 @@
+/* sitemap.xml, and when each generated page last changed */
+#ifndef _SITEMAP_H
+#define _SITEMAP_H
+
+#include <stddef.h>
+#include "config.h"
+#include "based.h"
+#include "rss.h"
+
+void sitemap_build(struct feedentry *, size_t, struct recipelist *);
+time_t sitemap_lastmod(const char *);
+void write_sitemap(char *);
+void sitemap_free(void);
+
+#endif
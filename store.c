@@ -0,0 +1,155 @@
+/* artifact store, so builds of different checkouts (pull-request
+ * previews) can reuse each others' rendered recipes. */
+#include "config.h"
+
+#if GIT_INTEGRATION
+/* artifacts are keyed on git metadata, as is the build cache */
+
+#include "store.h"
+#include "assets.h"
+#include "based.h"
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Store layout:
+ *	<dir>/<kk>/<key>.html   rendered recipe page
+ *	<dir>/<kk>/<key>.rss    rss feed entry
+ *	<dir>/<kk>/<key>.atom   atom feed entry
+ *	<dir>/pix/<variant>     resized pictures, already content named
+ *	<dir>/cache/<commit>    build cache as of a commit
+ * where <key> is 16 hex digits and <kk> its first two.
+ * files are written with write_atomic(), so any number of builds may
+ * share a store, and a file which exists is always complete.
+ */
+
+/* the generator's own executable stands in for the templates,
+ * config.h and anything else compiled in. */
+#define SELF_EXE "/proc/self/exe"
+#define PIX_REF "pix/"
+
+bool
+init_store(struct store *s, char *dir)
+{
+	char sub[PATH_LEN * 2];
+
+	snprintf(s->dir, sizeof(s->dir), "%s", dir);
+	s->templates = hash_file(SELF_EXE);
+	if (0 == s->templates) {
+		fprintf(stderr, "warning: can't read %s, not using store %s.\n",
+			SELF_EXE, dir);
+		return false;
+	}
+#if IMAGE_PIPELINE
+	/* pages only get a srcset when pictures can be resized */
+	s->templates ^= 0 == access(IMAGE_RESIZE_PATH, X_OK);
+#endif
+#if FINGERPRINT_ASSETS
+	/* pages link the assets by their content hash */
+	s->templates ^= assets_key();
+#endif
+	mkdir(dir, 0755);
+	sprintf(s->pixdir, "%s/pix", s->dir);
+	mkdir(s->pixdir, 0755);
+	sprintf(sub, "%s/cache", dir);
+	mkdir(sub, 0755);
+	return true;
+}
+
+/* a recipe's key covers its source `text`, the git metadata shown
+ * on the page, and every picture in `pubdir` the source refers to.
+ * returns 0 when the source couldn't be read (`text` is NULL).
+ */
+uint64_t
+store_key(struct store *s, const char *text, char *pubdir, struct md *meta)
+{
+	const char *ref;
+	char pix[PATH_LEN * 2];
+	size_t len;
+	uint64_t h, pixhash;
+
+	if (NULL == text) return 0;
+
+	h = hash_bytes(&s->templates, sizeof(s->templates), HASH_SEED);
+	h = hash_bytes(meta->slug,   strlen(meta->slug)   + 1, h);
+	h = hash_bytes(meta->author, strlen(meta->author) + 1, h);
+	h = hash_bytes(&meta->added.epoch,     sizeof(meta->added.epoch),     h);
+	h = hash_bytes(&meta->added.offset,    sizeof(meta->added.offset),    h);
+	h = hash_bytes(&meta->modified.epoch,  sizeof(meta->modified.epoch),  h);
+	h = hash_bytes(&meta->modified.offset, sizeof(meta->modified.offset), h);
+	h = hash_bytes(text, strlen(text), h);
+	for (ref = text; NULL != (ref = strstr(ref, PIX_REF)); ref += len) {
+		len = strcspn(ref, " \t\n)\"'");
+		if (len >= PATH_LEN) continue;
+		sprintf(pix, "%s/%.*s", pubdir, (int)len, ref);
+		pixhash = hash_file(pix);
+		h = hash_bytes(&pixhash, sizeof(pixhash), h);
+	}
+	return h ? h : 1;
+}
+
+void
+store_path(char *path, struct store *s, uint64_t key, char *ext)
+{
+	sprintf(path, "%s/%02x/%016" PRIx64 ".%s",
+		s->dir, (unsigned)(key >> 56), key, ext);
+}
+
+/* allocates memory, must be freed,
+ * or returns NULL when the artifact is not stored. */
+char *
+store_get(struct store *s, uint64_t key, char *ext, size_t *size)
+{
+	char path[PATH_LEN * 2];
+	store_path(path, s, key, ext);
+	return read_file(path, size);
+}
+
+void
+store_put(struct store *s, uint64_t key, char *ext, char *data, size_t size)
+{
+	char path[PATH_LEN * 2];
+
+	sprintf(path, "%s/%02x", s->dir, (unsigned)(key >> 56));
+	mkdir(path, 0755);
+	store_path(path, s, key, ext);
+	if (!write_atomic(path, data, size))
+		fprintf(stderr, "warning: can't write %s.\n", path);
+}
+
+/* copies the build cache stored for `commit` to `cachefile`. */
+bool
+store_fetch_cache(struct store *s, char *commit, char *cachefile)
+{
+	FILE *f;
+	char path[PATH_LEN * 2], *data;
+	size_t size;
+
+	sprintf(path, "%s/cache/%s", s->dir, commit);
+	data = read_file(path, &size);
+	if (NULL == data) return false;
+	f = fopen(cachefile, "w");
+	if (NULL == f) die("failed to create cache.");
+	fwrite(data, 1, size, f);
+	fclose(f);
+	free(data);
+	return true;
+}
+
+void
+store_save_cache(struct store *s, char *commit, char *cachefile)
+{
+	char path[PATH_LEN * 2], *data;
+	size_t size;
+
+	data = read_file(cachefile, &size);
+	if (NULL == data) return;
+	sprintf(path, "%s/cache/%s", s->dir, commit);
+	if (!write_atomic(path, data, size))
+		fprintf(stderr, "warning: can't write %s.\n", path);
+	free(data);
+}
+
+#endif  /* GIT_INTEGRATION */
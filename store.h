@@ -0,0 +1,24 @@
+/* content-addressed artifact store, shared between builds */
+#ifndef _STORE_H
+#define _STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+#include "md.h"
+
+struct store {
+	char dir[PATH_LEN];
+	char pixdir[PATH_LEN + 8];
+	uint64_t templates;  /* everything compiled into the generator */
+};
+
+bool init_store(struct store *, char *);
+uint64_t store_key(struct store *, const char *, char *, struct md *);
+void store_path(char *, struct store *, uint64_t, char *);
+char *store_get(struct store *, uint64_t, char *, size_t *);
+void store_put(struct store *, uint64_t, char *, char *, size_t);
+bool store_fetch_cache(struct store *, char *, char *);
+void store_save_cache(struct store *, char *, char *);
+
+#endif